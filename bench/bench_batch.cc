@@ -0,0 +1,107 @@
+// Throughput of `normalize_batch()` and `normalize_column()`(the same
+// documents in one buffer plus offsets) for 1, 2, 4, ... threads.
+//
+// $ ./bench_batch [num_docs] [max_threads]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+
+#ifdef __clang__
+#if __has_warning("-Wc++20-compat")
+// suppress UTF8 string literal in source code warning.
+#pragma clang diagnostic ignored "-Wc++20-compat"
+#endif
+#endif
+
+// Documents with very skewed lengths(log-normal), as in web corpora.
+static std::vector<std::string> generate_docs(size_t num_docs) {
+  static const char *const kWords[] = {
+      "ﾜｶﾞﾊｲは", "㈱である", "　", " ", "Natural Language Processing ",
+      "ＰＲＭＬ", "副読本", "ウェーーーイ", "1995〜2001年", "ｗｗｗｗ",
+      "http://example.com/index.html ", "。", "、"};
+  const size_t num_words = sizeof(kWords) / sizeof(kWords[0]);
+
+  std::mt19937 rng(12345);
+  std::lognormal_distribution<double> len_dist(4.0, 1.5);
+
+  std::vector<std::string> docs(num_docs);
+  for (auto &doc : docs) {
+    size_t n = size_t(len_dist(rng)) + 1;
+    for (size_t i = 0; i < n; i++) {
+      doc += kWords[rng() % num_words];
+    }
+  }
+  return docs;
+}
+
+int main(int argc, char **argv) {
+  size_t num_docs = (argc > 1) ? size_t(std::strtoull(argv[1], nullptr, 10)) : 200000;
+  size_t max_threads = (argc > 2) ? size_t(std::strtoull(argv[2], nullptr, 10))
+                                  : size_t(std::thread::hardware_concurrency());
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  std::vector<std::string> docs = generate_docs(num_docs);
+  size_t total_bytes = 0;
+  for (const auto &doc : docs) {
+    total_bytes += doc.size();
+  }
+
+  std::cout << "docs: " << num_docs << ", bytes: " << total_bytes << "\n";
+
+  std::string column_data;
+  std::vector<uint64_t> column_offsets(1, 0);
+  column_data.reserve(total_bytes);
+  for (const auto &doc : docs) {
+    column_data += doc;
+    column_offsets.push_back(column_data.size());
+  }
+
+  jpnormalizer::NormalizationOption option;
+  option.repeat = 3;
+
+  double base_mbs = 0.0;
+  for (size_t num_threads = 1;; num_threads *= 2) {
+    if (num_threads > max_threads) {
+      num_threads = max_threads;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> results =
+        jpnormalizer::normalize_batch(docs, option, num_threads);
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    double mbs = double(total_bytes) / (1024.0 * 1024.0) / sec;
+    if (num_threads == 1) {
+      base_mbs = mbs;
+    }
+
+    start = std::chrono::steady_clock::now();
+    std::string out_data;
+    std::vector<uint64_t> out_offsets;
+    jpnormalizer::normalize_column(column_data.data(), column_offsets.data(),
+                                   num_docs, out_data, out_offsets, option,
+                                   num_threads);
+    end = std::chrono::steady_clock::now();
+    double column_mbs = double(total_bytes) / (1024.0 * 1024.0) /
+                        std::chrono::duration<double>(end - start).count();
+
+    std::cout << "threads: " << num_threads << ", " << mbs << " MB/s"
+              << ", speedup: " << (mbs / base_mbs)
+              << ", column: " << column_mbs << " MB/s\n";
+
+    if (num_threads == max_threads) {
+      break;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,376 @@
+// Throughput of `normalize()` for each combination of `NormalizationOption`,
+// `normalize<StaticNormalizationOption<>>()`, `normalize_into()` with the
+// offset map, UTF-16 `normalize()`, `is_normalized()`, `NormalizationCache`,
+// `find_invalid_utf8()`, `shorten_repeat_codepoints()`, `normalize_for_dedup()`
+// and `compute_dedup_signature()` over generated corpora.
+//
+// $ ./bench_normalize [corpus_size_in_kb(default 2048)] [min_sec_per_case(default 0.2)]
+//
+// Results are printed as JSON Lines(one object per case) to stdout:
+//
+// {"function":"normalize","corpus":"hankaku_kana","remove_space":true,
+//  "tilde":"remove","parenthesized_ideographs":true,"repeat":0,
+//  "bytes":2097152,"chars":699051,"iterations":12,"mb_per_sec":...,
+//  "ns_per_char":...,"peak_rss_kb":...}
+//
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+
+#ifdef __clang__
+#if __has_warning("-Wc++20-compat")
+// suppress UTF8 string literal in source code warning.
+#pragma clang diagnostic ignored "-Wc++20-compat"
+#endif
+#endif
+
+namespace {
+
+struct Corpus {
+  const char *name;
+  std::string text;
+};
+
+// Concatenate randomly chosen `words` up to `num_bytes`.
+std::string generate(const std::vector<const char *> &words, size_t num_bytes,
+                     uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::string text;
+  text.reserve(num_bytes + 64);
+  while (text.size() < num_bytes) {
+    text += words[rng() % words.size()];
+  }
+  return text;
+}
+
+std::vector<Corpus> generate_corpora(size_t num_bytes) {
+  std::vector<Corpus> corpora;
+
+  // Mostly half-width kana(with ﾞ/ﾟ to be merged).
+  corpora.push_back({"hankaku_kana",
+                     generate({"ﾊﾝｶｸｶﾅ", "ｶﾞｷﾞｸﾞ", "ﾊﾟﾋﾟﾌﾟ", "ﾜｶﾞﾊｲﾊ", "ｰ", "｡",
+                               "｢ﾃｽﾄ｣", "ｳﾞｧｲｵﾘﾝ", "ﾈｺ", "､"},
+                              num_bytes, 1)});
+
+  // Full-width alphanumerics and symbols.
+  corpora.push_back({"zenkaku_alnum",
+                     generate({"ＡＢＣＤＥ", "ａｂｃｄｅ", "０１２３４", "！？＠＃",
+                               "ＰＲＭＬ", "（ｘ＋ｙ）", "＝", "全角", "－"},
+                              num_bytes, 2)});
+
+  // ASCII-heavy text with some Japanese.
+  corpora.push_back({"ascii_mixed",
+                     generate({"Natural Language Processing ", "the ", "quick ",
+                               "brown fox ", "http://example.com/index.html ",
+                               "x = y + 1; ", "\n", "日本語", "テキスト", "。"},
+                              num_bytes, 3)});
+
+  // Parenthesized ideographs.
+  corpora.push_back({"parenthesized",
+                     generate({"㈱", "㈲", "㈠", "㈡", "㉃", "㈴", "㉄", "会社",
+                               "である", "漢字"},
+                              num_bytes, 4)});
+
+  // Spaces between Japanese and latin words.
+  corpora.push_back({"whitespace",
+                     generate({" ", "  ", "　", "　 ", "\t", "日本", "語",
+                               "ABC", "def", " ｶﾅ ", "*"},
+                              num_bytes, 5)});
+
+  // Worst case for repeat shortening: long runs and near repeats of all
+  // lengths up to `max_repeat_substr_len`.
+  corpora.push_back({"repeat_spam",
+                     generate({"ｗｗｗｗｗｗｗｗｗｗｗｗｗｗｗｗ", "ーーーーーーーー",
+                               "草草草草草", "ﾎﾟﾎﾟﾎﾟﾎﾟ", "abababababababab",
+                               "abcabcabcabcabx", "あいうえおかきくあいうえおかきく",
+                               "！！！！！！！！", "?"},
+                              num_bytes, 6)});
+
+  return corpora;
+}
+
+// Short queries(about 32 bytes, cut at char boundaries) sampled from the
+// first `num_distinct` pieces of `text` with a skewed distribution, up to
+// `num_bytes` in total.
+std::vector<std::string> generate_queries(const std::string &text,
+                                          size_t num_distinct, size_t num_bytes,
+                                          uint32_t seed) {
+  std::vector<std::string> pieces;
+  size_t pos = 0;
+  while ((pos < text.size()) && (pieces.size() < num_distinct)) {
+    size_t end = (std::min)(pos + 32, text.size());
+    while ((end < text.size()) && ((uint8_t(text[end]) & 0xc0) == 0x80)) {
+      end++;
+    }
+    pieces.push_back(text.substr(pos, end - pos));
+    pos = end;
+  }
+
+  std::mt19937 rng(seed);
+  std::vector<std::string> queries;
+  size_t total = 0;
+  while (total < num_bytes) {
+    // small indices are much more frequent.
+    size_t idx = rng() % (1 + rng() % pieces.size());
+    queries.push_back(pieces[idx]);
+    total += pieces[idx].size();
+  }
+  return queries;
+}
+
+size_t count_chars(const std::string &text) {
+  size_t n = 0;
+  for (char c : text) {
+    if ((uint8_t(c) & 0xc0) != 0x80) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Reset the peak RSS of this process(Linux). Returns false if not supported.
+bool reset_peak_rss() {
+  std::ofstream ofs("/proc/self/clear_refs");
+  if (!ofs) {
+    return false;
+  }
+  ofs << "5";
+  return bool(ofs);
+}
+
+// Peak RSS in KB(since the last `reset_peak_rss()` when supported).
+long peak_rss_kb() {
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::atol(line.c_str() + 6);
+    }
+  }
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;  // bytes
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+const char *tilde_name(jpnormalizer::NormalizationOption::TildeMode mode) {
+  switch (mode) {
+    case jpnormalizer::NormalizationOption::TildeMode::Remove:
+      return "remove";
+    case jpnormalizer::NormalizationOption::TildeMode::Ignore:
+      return "ignore";
+    case jpnormalizer::NormalizationOption::TildeMode::Normalize:
+      return "normalize";
+    case jpnormalizer::NormalizationOption::TildeMode::Zenkaku:
+      return "zenkaku";
+  }
+  return "unknown";
+}
+
+///
+/// Run `func` repeatedly for at least `min_sec`(and at least 3 times) and
+/// print the result of the fastest run.
+///
+template <class Func>
+void run_case(const char *function, const Corpus &corpus,
+              const jpnormalizer::NormalizationOption &option, double min_sec,
+              Func &&func) {
+  reset_peak_rss();
+
+  double best = 0.0;
+  double total = 0.0;
+  size_t iterations = 0;
+  while ((iterations < 3) || (total < min_sec)) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    if ((iterations == 0) || (sec < best)) {
+      best = sec;
+    }
+    total += sec;
+    iterations++;
+  }
+
+  size_t bytes = corpus.text.size();
+  size_t chars = count_chars(corpus.text);
+
+  std::printf(
+      "{\"function\":\"%s\",\"corpus\":\"%s\",\"remove_space\":%s,"
+      "\"tilde\":\"%s\",\"parenthesized_ideographs\":%s,\"repeat\":%u,"
+      "\"bytes\":%zu,\"chars\":%zu,\"iterations\":%zu,\"mb_per_sec\":%.2f,"
+      "\"ns_per_char\":%.3f,\"peak_rss_kb\":%ld}\n",
+      function, corpus.name, option.remove_space ? "true" : "false",
+      tilde_name(option.tilde),
+      option.parenthesized_ideographs ? "true" : "false", option.repeat, bytes,
+      chars, iterations, double(bytes) / (1024.0 * 1024.0) / best,
+      best * 1e9 / double(chars), peak_rss_kb());
+  std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t size_kb = (argc > 1) ? size_t(std::strtoull(argv[1], nullptr, 10)) : 2048;
+  double min_sec = (argc > 2) ? std::atof(argv[2]) : 0.2;
+
+  std::vector<Corpus> corpora = generate_corpora(size_kb * 1024);
+
+  const jpnormalizer::NormalizationOption::TildeMode kTildeModes[] = {
+      jpnormalizer::NormalizationOption::TildeMode::Remove,
+      jpnormalizer::NormalizationOption::TildeMode::Ignore,
+      jpnormalizer::NormalizationOption::TildeMode::Normalize,
+      jpnormalizer::NormalizationOption::TildeMode::Zenkaku};
+  const uint32_t kRepeats[] = {0, 3};
+
+  for (const auto &corpus : corpora) {
+    for (int remove_space = 1; remove_space >= 0; remove_space--) {
+      for (auto tilde : kTildeModes) {
+        for (int paren = 1; paren >= 0; paren--) {
+          for (uint32_t repeat : kRepeats) {
+            jpnormalizer::NormalizationOption option;
+            option.remove_space = (remove_space != 0);
+            option.tilde = tilde;
+            option.parenthesized_ideographs = (paren != 0);
+            option.repeat = repeat;
+
+            std::string result;
+            run_case("normalize", corpus, option, min_sec, [&]() {
+              result = jpnormalizer::normalize(corpus.text, option);
+            });
+          }
+        }
+      }
+    }
+
+    // Options fixed at compile time(the default options).
+    {
+      jpnormalizer::NormalizationOption option;
+      std::string result;
+      run_case("normalize_static", corpus, option, min_sec, [&]() {
+        result = jpnormalizer::normalize<
+            jpnormalizer::StaticNormalizationOption<>>(corpus.text);
+      });
+    }
+
+    // With the output-to-input offset map(default options).
+    {
+      jpnormalizer::NormalizationOption option;
+      jpnormalizer::Normalizer normalizer(option);
+      jpnormalizer::OffsetMap offsets;
+      std::string result;
+      run_case("normalize_offset_map", corpus, option, min_sec, [&]() {
+        normalizer.normalize_into(corpus.text.data(), corpus.text.size(),
+                                  result, offsets);
+      });
+    }
+
+    // UTF-16 input and output(default options). "bytes" is the size of the
+    // UTF-8 corpus.
+    {
+      jpnormalizer::NormalizationOption option;
+      std::vector<uint32_t> codepoints =
+          jpnormalizer::detail::to_codepoints(corpus.text);
+      std::u16string text;
+      jpnormalizer::detail::codepoints_to_units(codepoints.data(),
+                                                codepoints.size(), text);
+      std::u16string result;
+      run_case("normalize_utf16", corpus, option, min_sec, [&]() {
+        result = jpnormalizer::normalize(text, option);
+      });
+    }
+
+    // Quick check of already normalized text(default options). "bytes" is
+    // the size of the original corpus.
+    {
+      jpnormalizer::NormalizationOption option;
+      std::string normalized = jpnormalizer::normalize(corpus.text, option);
+      volatile bool unchanged = false;
+      run_case("is_normalized", corpus, option, min_sec, [&]() {
+        unchanged = jpnormalizer::is_normalized(normalized, option);
+      });
+      (void)unchanged;
+    }
+
+    // Short repeated queries, with and without the result cache(default
+    // options). "bytes" is the total size of the queries.
+    {
+      jpnormalizer::NormalizationOption option;
+      std::vector<std::string> queries =
+          generate_queries(corpus.text, 1000, corpus.text.size(), 7);
+      Corpus query_corpus{corpus.name, std::string()};
+      for (const auto &query : queries) {
+        query_corpus.text += query;
+      }
+
+      jpnormalizer::Normalizer normalizer(option);
+      std::string result;
+      run_case("normalize_queries", query_corpus, option, min_sec, [&]() {
+        for (const auto &query : queries) {
+          normalizer.normalize_into(query.data(), query.size(), result);
+        }
+      });
+
+      jpnormalizer::NormalizationCache cache;
+      run_case("normalize_cached", query_corpus, option, min_sec, [&]() {
+        for (const auto &query : queries) {
+          cache.normalize_into(query.data(), query.size(), option, result);
+        }
+      });
+    }
+
+    // UTF-8 validation alone(it runs ahead of the normalization).
+    {
+      jpnormalizer::NormalizationOption option;
+      volatile size_t pos = 0;
+      run_case("find_invalid_utf8", corpus, option, min_sec, [&]() {
+        pos = jpnormalizer::find_invalid_utf8(corpus.text.data(),
+                                              corpus.text.size());
+      });
+      (void)pos;
+    }
+
+    // Repeat shortening alone.
+    jpnormalizer::NormalizationOption option;
+    option.repeat = 3;
+    std::vector<uint32_t> codepoints =
+        jpnormalizer::detail::to_codepoints(corpus.text);
+    std::vector<uint32_t> result;
+    run_case("shorten_repeat_codepoints", corpus, option, min_sec, [&]() {
+      result = jpnormalizer::detail::shorten_repeat_codepoints(
+          codepoints, option.repeat, option.max_repeat_substr_len);
+    });
+
+    // Deduplication(fixed options).
+    option = jpnormalizer::detail::dedup_normalization_option();
+    std::string dedup_result;
+    run_case("normalize_for_dedup", corpus, option, min_sec, [&]() {
+      dedup_result = jpnormalizer::normalize_for_dedup(corpus.text);
+    });
+
+    jpnormalizer::DedupHasher hasher;
+    jpnormalizer::DedupSignature signature;
+    run_case("compute_dedup_signature", corpus, option, min_sec, [&]() {
+      hasher.compute(corpus.text.data(), corpus.text.size(), signature);
+    });
+  }
+
+  return EXIT_SUCCESS;
+}
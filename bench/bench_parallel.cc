@@ -0,0 +1,83 @@
+// Throughput of `normalize_parallel()` on a single large text for 1, 2, 4, ...
+// threads.
+//
+// $ ./bench_parallel [size_in_mb] [max_threads]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+
+#ifdef __clang__
+#if __has_warning("-Wc++20-compat")
+// suppress UTF8 string literal in source code warning.
+#pragma clang diagnostic ignored "-Wc++20-compat"
+#endif
+#endif
+
+// A book-like text: lines of mixed Japanese and latin words.
+static std::string generate_text(size_t num_bytes) {
+  static const char *const kWords[] = {
+      "ﾜｶﾞﾊｲは", "㈱である", "　", " ", "Natural Language Processing ",
+      "ＰＲＭＬ", "副読本", "ウェーーーイ", "1995〜2001年", "ｗｗｗｗ",
+      "http://example.com/index.html ", "。", "、", "\n"};
+  const size_t num_words = sizeof(kWords) / sizeof(kWords[0]);
+
+  std::mt19937 rng(12345);
+
+  std::string text;
+  text.reserve(num_bytes + 64);
+  while (text.size() < num_bytes) {
+    text += kWords[rng() % num_words];
+  }
+  return text;
+}
+
+int main(int argc, char **argv) {
+  size_t size_mb = (argc > 1) ? size_t(std::strtoull(argv[1], nullptr, 10)) : 64;
+  size_t max_threads = (argc > 2) ? size_t(std::strtoull(argv[2], nullptr, 10))
+                                  : size_t(std::thread::hardware_concurrency());
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  std::string text = generate_text(size_mb * 1024 * 1024);
+
+  std::cout << "bytes: " << text.size() << "\n";
+
+  jpnormalizer::NormalizationOption option;
+  option.repeat = 3;
+
+  std::string expected = jpnormalizer::normalize(text, option);
+
+  double base_mbs = 0.0;
+  for (size_t num_threads = 1;; num_threads *= 2) {
+    if (num_threads > max_threads) {
+      num_threads = max_threads;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string result = jpnormalizer::normalize_parallel(text, option, num_threads);
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    double mbs = double(text.size()) / (1024.0 * 1024.0) / sec;
+    if (num_threads == 1) {
+      base_mbs = mbs;
+    }
+
+    std::cout << "threads: " << num_threads << ", " << mbs << " MB/s"
+              << ", speedup: " << (mbs / base_mbs)
+              << ((result == expected) ? "" : " (MISMATCH)") << "\n";
+
+    if (num_threads == max_threads) {
+      break;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,433 @@
+//
+// Algorithmic complexity fuzzer of `normalize()`.
+//
+// The first 4 bytes of the input select the option(see `decode_option()`),
+// the rest is the text. An input fails(aborts) when
+//
+// - normalizing it takes longer than a per-byte time budget(superlinear
+//   behavior, e.g. on repeat spam), or
+// - the result differs from a reference: a scalar per-codepoint normalizer
+//   (no SIMD validation, no ASCII run skip, rules found by binary search in
+//   `kRules` instead of the page table) followed by the classic repeat
+//   shortening algorithm, UTF-16/UTF-32 normalization, `StreamNormalizer` fed
+//   in chunks or `is_normalized()`.
+//
+// $ make fuzz-complexity
+// $ ./fuzz-complexity -max_len=65536 -len_control=0 corpus/
+//
+// Budget(nanoseconds): JPN_FUZZ_BASE_NS + size * JPN_FUZZ_NS_PER_BYTE * (1 +
+// max_repeat_substr_len / 8). Set the environment variables to override the
+// defaults(which are loose enough for ASan builds).
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+
+#ifdef __clang__
+#if __has_warning("-Wc++20-compat")
+// suppress UTF8 string literal in source code warning.
+#pragma clang diagnostic ignored "-Wc++20-compat"
+#endif
+#endif
+
+static const size_t kOptionBytes = 4;
+
+// The classic algorithm is quadratic, so only short texts are compared.
+static const size_t kMaxReferenceLen = 4096;
+
+struct FuzzParam {
+  jpnormalizer::NormalizationOption option;
+  size_t chunk_size;  // of `StreamNormalizer::feed()`
+};
+
+//
+// byte 0: bit 0: remove_space, bit 1-2: tilde, bit 3: parenthesized_ideographs,
+//         bit 4-5: invalid_char
+// byte 1: repeat(0 - 7)
+// byte 2: max_repeat_substr_len(0 - 47, beyond `RepeatChecker::kInlineLen`)
+// byte 3: chunk size - 1
+//
+static FuzzParam decode_option(const uint8_t *data) {
+  FuzzParam param;
+  jpnormalizer::NormalizationOption &opt = param.option;
+  opt.remove_space = (data[0] & 1) != 0;
+  opt.tilde = jpnormalizer::NormalizationOption::TildeMode((data[0] >> 1) & 3);
+  opt.parenthesized_ideographs = (data[0] & 8) != 0;
+  opt.invalid_char =
+      jpnormalizer::NormalizationOption::InvalidCharMode(((data[0] >> 4) & 3) % 3);
+  opt.repeat = data[1] % 8;
+  opt.max_repeat_substr_len = data[2] % 48;
+  param.chunk_size = size_t(data[3]) + 1;
+  return param;
+}
+
+static uint64_t env_or(const char *name, uint64_t default_value) {
+  const char *s = std::getenv(name);
+  if (!s || !*s) {
+    return default_value;
+  }
+  return std::strtoull(s, nullptr, 10);
+}
+
+static uint64_t budget_ns(const FuzzParam &param, size_t size) {
+  static const uint64_t base_ns = env_or("JPN_FUZZ_BASE_NS", 20000000);  // 20 ms
+  static const uint64_t ns_per_byte = env_or("JPN_FUZZ_NS_PER_BYTE", 2000);
+  return base_ns + uint64_t(size) * ns_per_byte *
+                       (1 + param.option.max_repeat_substr_len / 8);
+}
+
+static void fail(const char *what, const FuzzParam &param) {
+  const jpnormalizer::NormalizationOption &opt = param.option;
+  std::cerr << "fail: " << what << "(remove_space " << opt.remove_space
+            << ", tilde " << int(opt.tilde) << ", parenthesized_ideographs "
+            << opt.parenthesized_ideographs << ", invalid_char "
+            << int(opt.invalid_char) << ", repeat " << opt.repeat
+            << ", max_repeat_substr_len " << opt.max_repeat_substr_len
+            << ", chunk " << param.chunk_size << ")\n";
+  std::abort();
+}
+
+//
+// Repeat shortening before the one pass `RepeatShortener`: at each position,
+// for each repeat length, count the copies and erase the ones beyond the
+// threshold.
+//
+static std::vector<uint32_t> reference_shorten_repeat(std::vector<uint32_t> text,
+                                                      uint32_t repeat_threshold,
+                                                      uint32_t max_repeat_substr_len) {
+  size_t i = 0;
+  while (i < text.size()) {
+    size_t text_len = text.size();
+
+    // upper bound of repeat size = 1/2 of input text.
+    size_t ceil_repeat_len = (text_len - i) / 2;
+
+    if (max_repeat_substr_len < ceil_repeat_len) {
+      ceil_repeat_len = max_repeat_substr_len + 1;
+    }
+
+    for (size_t repeat_len = 1; repeat_len < ceil_repeat_len; repeat_len++) {
+      size_t right_start = i + repeat_len;
+      size_t right_end = right_start + repeat_len;
+
+      size_t num_repeat = 1;
+      while (right_end <= text_len) {
+        if (!jpnormalizer::detail::is_equal(text, i, right_start, repeat_len)) {
+          break;
+        }
+
+        num_repeat++;
+        right_start += repeat_len;
+        right_end += repeat_len;
+      }
+
+      if (num_repeat > repeat_threshold) {
+        text.erase(text.begin() + int64_t((std::min)(i + repeat_len * repeat_threshold, text.size())),
+                   text.begin() + int64_t(i + repeat_len * num_repeat));
+      }
+    }
+
+    i++;
+  }
+
+  return text;
+}
+
+//
+// Length of the well-formed UTF-8 char at s[0, n). 0 when it is ill-formed,
+// and `bad_len` is set to the length of its maximal subpart(Unicode Table
+// 3-7). Byte by byte, independent of `find_invalid_utf8()`.
+//
+static size_t reference_char_len(const uint8_t *s, size_t n, size_t &bad_len) {
+  size_t len;
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xbf;
+  if (s[0] <= 0x7f) {
+    return 1;
+  } else if ((s[0] >= 0xc2) && (s[0] <= 0xdf)) {
+    len = 2;
+  } else if ((s[0] >= 0xe0) && (s[0] <= 0xef)) {
+    len = 3;
+    lo = (s[0] == 0xe0) ? 0xa0 : 0x80;
+    hi = (s[0] == 0xed) ? 0x9f : 0xbf;
+  } else if ((s[0] >= 0xf0) && (s[0] <= 0xf4)) {
+    len = 4;
+    lo = (s[0] == 0xf0) ? 0x90 : 0x80;
+    hi = (s[0] == 0xf4) ? 0x8f : 0xbf;
+  } else {
+    bad_len = 1;
+    return 0;
+  }
+
+  for (size_t k = 1; k < len; k++) {
+    if ((k >= n) || (s[k] < lo) || (s[k] > hi)) {
+      bad_len = k;
+      return 0;
+    }
+    lo = 0x80;
+    hi = 0xbf;
+  }
+  return len;
+}
+
+// Rule of `code`, by binary search in `kRules`. nullptr when no rule.
+static const jpnormalizer::detail::RuleSource *reference_find_rule(uint32_t code) {
+  using jpnormalizer::detail::kRules;
+  using jpnormalizer::detail::literal_code;
+
+  size_t lo = 0;
+  size_t hi = sizeof(kRules) / sizeof(kRules[0]);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (literal_code(kRules[mid].from) < code) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if ((lo < (sizeof(kRules) / sizeof(kRules[0]))) &&
+      (literal_code(kRules[lo].from) == code)) {
+    return &kRules[lo];
+  }
+  return nullptr;
+}
+
+template <size_t N>
+static std::string reference_kana_pair(const jpnormalizer::detail::KanaPair (&pairs)[N],
+                                       const std::string &prev_c) {
+  for (size_t i = 0; i < N; i++) {
+    if (prev_c == pairs[i].from) {
+      return pairs[i].to;
+    }
+  }
+  return std::string();
+}
+
+//
+// Scalar reference of `normalize()` without repeat shortening: one UTF-8
+// string per output char, as in the original neologdn port. Shares only the
+// rule data with the library.
+//
+static std::string reference_normalize(const std::string &input,
+                                       const jpnormalizer::NormalizationOption &opt) {
+  typedef jpnormalizer::NormalizationOption Option;
+  using jpnormalizer::detail::RuleKind;
+  using jpnormalizer::detail::is_cjk_code;
+  using jpnormalizer::detail::utf8_code;
+
+  std::vector<std::string> slots;
+  std::string prev_c;
+  bool latin_space = false;
+
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(input.data());
+  size_t i = 0;
+  while (i < input.size()) {
+    size_t bad_len = 0;
+    size_t len = reference_char_len(p + i, input.size() - i, bad_len);
+    std::string c;
+    if (len == 0) {
+      if (opt.invalid_char == Option::InvalidCharMode::Stop) {
+        break;
+      }
+      i += bad_len;
+      if (opt.invalid_char == Option::InvalidCharMode::Skip) {
+        continue;
+      }
+      c = "\xef\xbf\xbd";
+    } else {
+      c = input.substr(i, len);
+      i += len;
+    }
+
+    const jpnormalizer::detail::RuleSource *rule = reference_find_rule(utf8_code(c));
+    RuleKind kind = rule ? rule->kind : RuleKind::None;
+    uint32_t prev_code = utf8_code(prev_c);
+
+    if (kind == RuleKind::Space) {
+      if (((prev_c == " ") || is_cjk_code(prev_code)) && opt.remove_space) {
+        continue;
+      }
+      if ((prev_c != "*") && !slots.empty() && (prev_code < 128)) {
+        latin_space = true;
+        slots.push_back(" ");
+      } else if (!opt.remove_space) {
+        slots.push_back(" ");
+      }
+      prev_c = " ";
+      continue;
+    }
+
+    if (kind == RuleKind::Hyphen) {
+      if (prev_c == "-") {
+        continue;
+      }
+      c = "-";
+    } else if (kind == RuleKind::Choonpu) {
+      if (prev_c == "ー") {
+        continue;
+      }
+      c = "ー";
+    } else if (kind == RuleKind::Tilde) {
+      if (opt.tilde == Option::TildeMode::Remove) {
+        continue;
+      } else if (opt.tilde == Option::TildeMode::Normalize) {
+        c = "~";
+      } else if (opt.tilde == Option::TildeMode::Zenkaku) {
+        c = "〜";
+      }
+    } else {
+      if ((kind == RuleKind::Replace) ||
+          ((kind == RuleKind::Parenthesized) && opt.parenthesized_ideographs)) {
+        c = rule->to;
+      }
+
+      std::string merged;
+      if (c == "ﾞ") {
+        merged = reference_kana_pair(jpnormalizer::detail::kKanaTen, prev_c);
+      } else if (c == "ﾟ") {
+        merged = reference_kana_pair(jpnormalizer::detail::kKanaMaru, prev_c);
+      }
+      if (!merged.empty()) {
+        if (slots.empty()) {
+          return std::string();
+        }
+        slots.pop_back();
+        c = merged;
+      }
+
+      if (latin_space && is_cjk_code(utf8_code(c)) && opt.remove_space) {
+        if (slots.empty()) {
+          return std::string();
+        }
+        slots.pop_back();
+      }
+      latin_space = false;
+    }
+
+    slots.push_back(c);
+    prev_c = c;
+  }
+
+  if (!slots.empty() && (slots.back() == " ")) {
+    slots.pop_back();
+  }
+
+  std::string dst;
+  for (size_t k = 0; k < slots.size(); k++) {
+    dst += slots[k];
+  }
+  return dst;
+}
+
+static std::string normalize_timed(const std::string &input, const FuzzParam &param) {
+  typedef std::chrono::steady_clock Clock;
+
+  uint64_t budget = budget_ns(param, input.size());
+  std::string ret;
+  // Measure twice, so that a single preemption does not fail the input.
+  for (int trial = 0; trial < 2; trial++) {
+    Clock::time_point start = Clock::now();
+    ret = jpnormalizer::normalize(input, param.option);
+    uint64_t elapsed = uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    if (elapsed <= budget) {
+      return ret;
+    }
+    if (trial == 1) {
+      std::cerr << "normalize() of " << input.size() << " bytes took " << elapsed
+                << " ns(budget " << budget << " ns)\n";
+      fail("time budget exceeded", param);
+    }
+  }
+  return ret;
+}
+
+static int run_complexity(const uint8_t *data, size_t size) {
+  if ((size < kOptionBytes) || (size > (16 * 1024 * 1024))) {
+    return -1;
+  }
+
+  const FuzzParam param = decode_option(data);
+  const std::string input(reinterpret_cast<const char *>(data + kOptionBytes),
+                          size - kOptionBytes);
+  const std::string ret = normalize_timed(input, param);
+
+  // Scalar reference. The classic repeat shortening is quadratic, so for long
+  // texts only the normalization itself is compared.
+  {
+    std::string expected = reference_normalize(input, param.option);
+    if (param.option.repeat == 0) {
+      if (expected != ret) {
+        fail("differs from the scalar reference", param);
+      }
+    } else if (input.size() <= kMaxReferenceLen) {
+      std::vector<uint32_t> codes = reference_shorten_repeat(
+          jpnormalizer::detail::to_codepoints(expected), param.option.repeat,
+          param.option.max_repeat_substr_len);
+      if (jpnormalizer::detail::codepoints_to_string(codes) != ret) {
+        fail("differs from the scalar reference with classic repeat shortening",
+             param);
+      }
+    } else {
+      jpnormalizer::NormalizationOption no_repeat = param.option;
+      no_repeat.repeat = 0;
+      if (expected != jpnormalizer::normalize(input, no_repeat)) {
+        fail("differs from the scalar reference", param);
+      }
+    }
+  }
+
+  // UTF-16/UTF-32(the input must be representable).
+  if (jpnormalizer::find_invalid_utf8(input.data(), input.size()) == input.size()) {
+    std::vector<uint32_t> codes = jpnormalizer::detail::to_codepoints(input);
+    std::u16string input16;
+    std::u32string input32;
+    jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), input16);
+    jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), input32);
+
+    codes = jpnormalizer::detail::to_codepoints(ret);
+    std::u16string expected16;
+    std::u32string expected32;
+    jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), expected16);
+    jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), expected32);
+
+    if (jpnormalizer::normalize(input16, param.option) != expected16) {
+      fail("UTF-16 differs from UTF-8", param);
+    }
+    if (jpnormalizer::normalize(input32, param.option) != expected32) {
+      fail("UTF-32 differs from UTF-8", param);
+    }
+  }
+
+  // Streaming.
+  {
+    jpnormalizer::StreamNormalizer stream(param.option);
+    std::string out;
+    for (size_t i = 0; i < input.size(); i += param.chunk_size) {
+      stream.feed(input.data() + i, (std::min)(param.chunk_size, input.size() - i), out);
+    }
+    stream.finish(out);
+    if (out != ret) {
+      fail("StreamNormalizer differs from normalize()", param);
+    }
+  }
+
+  if (jpnormalizer::is_normalized(input, param.option) != (ret == input)) {
+    fail("is_normalized() differs from normalize()", param);
+  }
+
+  return 0;
+}
+
+extern "C"
+int LLVMFuzzerTestOneInput(std::uint8_t const* data, std::size_t size)
+{
+   int ret = run_complexity(data, size);
+   return ret;
+}
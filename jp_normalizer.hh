@@ -4,10 +4,18 @@
 // Assume this file is encoded in UTF-8
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 201703L))
+#include <string_view>
+#define JP_NORMALIZER_HAS_STRING_VIEW 1
+#endif
 
 namespace jpnormalizer {
 
@@ -19,6 +27,13 @@ struct NormalizationOption {
     Zenkaku,    // convert to Zenkaku '〜'
   };
 
+  // Ill-formed UTF-8 sequences(and lone surrogates in UTF-16/UTF-32 text).
+  enum class InvalidCharMode {
+    Stop,     // stop normalization. the rest of the text is dropped.
+    Skip,     // remove invalid bytes.
+    Replace,  // replace each maximal ill-formed subpart with U+FFFD.
+  };
+
   uint32_t max_tokens{1024ull*1024ull*1024ull}; // default 1 GB tokens(~= 3GB in Japanese UTF-8 chars)
 
   bool remove_space{true};
@@ -26,8 +41,11 @@ struct NormalizationOption {
   uint32_t max_repeat_substr_len{8};
   TildeMode tilde{TildeMode::Remove};
 
-  // jpnormalizer specific feature.
+  // jpnormalizer specific feature: expand enclosed and squared forms
+  // (e.g. '㈱' -> '(株)', '①' -> '1', '㍻' -> '平成', '㌔' -> 'キロ').
   bool parenthesized_ideographs{true};
+
+  InvalidCharMode invalid_char{InvalidCharMode::Stop};
 };
 
 struct DedupNormalizationOption {
@@ -35,12 +53,651 @@ struct DedupNormalizationOption {
   char digit_placeholder{'0'};
 };
 
+///
+/// Start of a segment of the normalized text: output[output, next.output)
+/// came from input[input, next.input). Offsets are in code units(bytes for
+/// UTF-8).
+///
+struct OffsetMapEntry {
+  uint32_t output;
+  uint32_t input;
+};
+
+///
+/// Output-to-input offset map(run-length encoded).
+/// A segment starts only where the output stops following the input one to
+/// one(replaced, merged, expanded or removed chars, cut repeats), so a copied
+/// run of text is a single entry. The last entry is
+/// (output length, input length).
+///
+typedef std::vector<OffsetMapEntry> OffsetMap;
+
+///
+/// Counters of the normalization: which rules fired, how many chars took the
+/// ASCII fast path, bytes in/out and ill-formed input.
+/// Counts are added to(never reset by) the normalizer, so one instance
+/// aggregates over calls. `clear()` it to count a single call.
+///
+struct NormalizationStats {
+  uint64_t texts{0};
+  uint64_t bytes_in{0};   // bytes(not code units) of the input
+  uint64_t bytes_out{0};  // bytes of the result
+  uint64_t chars{0};      // well-formed input chars
+  uint64_t ascii_fast_path{0};  // input chars copied by the ASCII fast path
+
+  uint64_t halfwidth_kana{0};   // half-width kana converted to full-width
+  uint64_t fullwidth_ascii{0};  // full-width alphanumerics/symbols to ASCII
+  uint64_t other_replaced{0};   // chars replaced by other rules
+  uint64_t kana_merged{0};      // ﾞ/ﾟ merged into the previous kana
+  uint64_t hyphens{0};          // hyphens converted to '-'
+  uint64_t hyphens_collapsed{0};  // hyphens removed after '-'
+  uint64_t choonpu{0};            // choonpus converted to 'ー'
+  uint64_t choonpu_collapsed{0};  // choonpus removed after 'ー'
+  uint64_t tildes_removed{0};
+  uint64_t tildes_replaced{0};  // TildeMode::Normalize/Zenkaku
+  uint64_t spaces_removed{0};
+  uint64_t parenthesized{0};    // enclosed and squared forms expanded
+  uint64_t repeat_cut{0};       // chars removed by repeat shortening
+  uint64_t invalid_sequences{0};  // ill-formed chars(see `InvalidCharMode`)
+  uint64_t invalid_units{0};      // code units of them
+
+  NormalizationStats &operator+=(const NormalizationStats &rhs);
+  void clear() { *this = NormalizationStats(); }
+};
+
+///
+/// Input offset of `output_offset` in `map`.
+/// Exact within copied text. An offset inside a replaced char maps into(or
+/// to the end of) its source.
+///
+size_t map_to_input(const OffsetMap &map, size_t output_offset);
+
+///
+/// Offset of the first byte of str[0, len) which is not a part of a
+/// well-formed UTF-8 char(`len` when the text is valid). A char cut by the
+/// end of the text is ill-formed. Vectorized(AVX2, SSSE3 or NEON. AVX2 is
+/// also selected at runtime on x86 with GCC/Clang).
+///
+size_t find_invalid_utf8(const char *str, size_t len);
+
+///
+/// Max size of the normalized UTF-8 text of `len` bytes(SIZE_MAX on
+/// overflow). See `Normalizer::normalize_to()`.
+///
+size_t normalize_bound(size_t len);
+
 std::string normalize(const std::string& str,
                       const NormalizationOption option = NormalizationOption());
 
+///
+/// UTF-16/UTF-32(native endian) versions of `normalize()`.
+/// Rules are applied to the decoded chars directly(no conversion to UTF-8),
+/// and the result is identical to `normalize()` of the UTF-8 text.
+/// Lone surrogates are invalid chars(see `InvalidCharMode`).
+///
+std::u16string normalize(const std::u16string& str,
+                         const NormalizationOption option = NormalizationOption());
+std::u32string normalize(const std::u32string& str,
+                         const NormalizationOption option = NormalizationOption());
+
+///
+/// `normalize()` which also computes the output-to-input offset map of the
+/// result(see `OffsetMap`).
+///
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      OffsetMap &offsets);
+
+///
+/// `normalize()` which also adds its counters to `stats`.
+///
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      NormalizationStats &stats);
+
+///
+/// `normalize()` which sets `unchanged` when the result equals `str`.
+/// The result is not built then(an empty string is returned), so the caller
+/// can keep `str` itself. See `is_normalized()`.
+///
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      bool &unchanged);
+
+///
+/// Normalize `str` in place(same result as `normalize()`).
+/// The result is written over the consumed input, so no output buffer is
+/// allocated. Only an expanding rule(e.g. '㌖' to 'キロメートル', '~' to '〜')
+/// which would overtake the unread input uses a small spill buffer.
+///
+/// @return false when the input is rejected(e.g. exceeds `max_tokens`).
+/// `str` is cleared in that case.
+///
+bool normalize_inplace(std::string &str,
+                       const NormalizationOption &option = NormalizationOption());
+
+///
+/// `normalize_inplace()` of buf[0, len) with `capacity`(>= `len`) bytes of
+/// room. The length of the result is set to `len`.
+///
+/// @return false when the input is rejected(`len` is set to 0), or when the
+/// result does not fit in `capacity`(`len` is set to the required size and
+/// the content of `buf` is unspecified).
+///
+bool normalize_inplace(char *buf, size_t &len, size_t capacity,
+                       const NormalizationOption &option = NormalizationOption());
+
+///
+/// True when `normalize(str, option)` returns `str` as is.
+/// Scans `str` once without building the result and returns at the first
+/// char which a rule changes. No allocation, except a ring of
+/// `max_repeat_substr_len` codepoints when it exceeds 32 with repeat
+/// shortening(kept by `Normalizer::is_normalized()` across calls).
+///
+bool is_normalized(const char *str, size_t len,
+                   const NormalizationOption &option = NormalizationOption());
+bool is_normalized(const char16_t *str, size_t len,
+                   const NormalizationOption &option = NormalizationOption());
+bool is_normalized(const char32_t *str, size_t len,
+                   const NormalizationOption &option = NormalizationOption());
+
+#if defined(JP_NORMALIZER_HAS_STRING_VIEW)
+inline bool is_normalized(std::string_view str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+inline bool is_normalized(std::u16string_view str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+inline bool is_normalized(std::u32string_view str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+#else
+inline bool is_normalized(const std::string &str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+inline bool is_normalized(const std::u16string &str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+inline bool is_normalized(const std::u32string &str,
+                          const NormalizationOption &option = NormalizationOption()) {
+  return is_normalized(str.data(), str.size(), option);
+}
+#endif
+
+///
+/// `NormalizationOption` fixed at compile time.
+///
+template <bool RemoveSpace = true,
+          NormalizationOption::TildeMode Tilde = NormalizationOption::TildeMode::Remove,
+          bool ParenthesizedIdeographs = true, uint32_t Repeat = 0,
+          uint32_t MaxRepeatSubstrLen = 8,
+          NormalizationOption::InvalidCharMode InvalidChar =
+              NormalizationOption::InvalidCharMode::Stop>
+struct StaticNormalizationOption {
+  static constexpr uint32_t max_tokens = 1024u * 1024u * 1024u;
+  static constexpr bool remove_space = RemoveSpace;
+  static constexpr uint32_t repeat = Repeat;
+  static constexpr uint32_t max_repeat_substr_len = MaxRepeatSubstrLen;
+  static constexpr NormalizationOption::TildeMode tilde = Tilde;
+  static constexpr bool parenthesized_ideographs = ParenthesizedIdeographs;
+  static constexpr NormalizationOption::InvalidCharMode invalid_char =
+      InvalidChar;
+};
+
+///
+/// `normalize()` specialized for `Opts`(a `StaticNormalizationOption`).
+/// The rules disabled by `Opts` are compiled out of the per-char loop.
+///
+/// It is defined with the implementation. All combinations of
+/// (RemoveSpace, Tilde, ParenthesizedIdeographs) with the default repeat
+/// parameters are instantiated there and can be used from any translation
+/// unit. Other instantiations must be in the translation unit which defines
+/// `JP_NORMALIZER_IMPLEMENTATION`.
+///
+/// `normalize()` with a runtime option dispatches to the same
+/// instantiations.
+///
+template <class Opts>
+std::string normalize(const std::string &str);
+
+// X(remove_space, tilde, parenthesized_ideographs) for all combinations of
+// `StaticNormalizationOption` which are precompiled.
+#define JP_NORMALIZER_FOR_EACH_FIXED_OPTION(X) \
+  X(true, Remove, true)                        \
+  X(true, Remove, false)                       \
+  X(true, Ignore, true)                        \
+  X(true, Ignore, false)                       \
+  X(true, Normalize, true)                     \
+  X(true, Normalize, false)                    \
+  X(true, Zenkaku, true)                       \
+  X(true, Zenkaku, false)                      \
+  X(false, Remove, true)                       \
+  X(false, Remove, false)                      \
+  X(false, Ignore, true)                       \
+  X(false, Ignore, false)                      \
+  X(false, Normalize, true)                    \
+  X(false, Normalize, false)                   \
+  X(false, Zenkaku, true)                      \
+  X(false, Zenkaku, false)
+
+#define JP_NORMALIZER_FIXED_OPTION(rs, td, paren) \
+  StaticNormalizationOption<rs, NormalizationOption::TildeMode::td, paren>
+
+#define JP_NORMALIZER_EXTERN_TEMPLATE(rs, td, paren)                     \
+  extern template std::string normalize<JP_NORMALIZER_FIXED_OPTION(     \
+      rs, td, paren)>(const std::string &);
+JP_NORMALIZER_FOR_EACH_FIXED_OPTION(JP_NORMALIZER_EXTERN_TEMPLATE)
+#undef JP_NORMALIZER_EXTERN_TEMPLATE
+
+///
+/// Normalize for deduplication: `normalize()` with fixed options(remove
+/// spaces and tildes, shorten repeats of more than 8 times) and all digits
+/// replaced by `digit_placeholder`(an ASCII char).
+///
 std::string normalize_for_dedup(const std::string& str,
                       const DedupNormalizationOption option = DedupNormalizationOption());
 
+struct DedupSignatureOption {
+  // Length of char n-grams(shingles).
+  // A text shorter than this is a single shingle.
+  uint32_t ngram{5};
+
+  // Number of MinHash values(0: no MinHash).
+  uint32_t num_minhash{128};
+
+  // Compute 64bit SimHash.
+  bool simhash{true};
+
+  uint64_t seed{0};
+};
+
+///
+/// Signature for near-duplicate detection.
+/// Signatures are comparable only when computed with the same options.
+///
+struct DedupSignature {
+  // One permutation MinHash(with densification) of the shingles.
+  // Empty when the normalized text is empty.
+  std::vector<uint64_t> minhash;
+
+  // SimHash of the shingles(equally weighted).
+  uint64_t simhash{0};
+};
+
+///
+/// Compute MinHash/SimHash of char n-grams of `normalize_for_dedup(str)`.
+/// The input is normalized block by block and shingles are hashed from the
+/// codepoints of each block, so neither the normalized string nor its
+/// codepoints are held as a whole(memory does not grow with the text). The
+/// cost is O(1) per char in addition to the normalization(plus O(64) for
+/// SimHash).
+///
+DedupSignature compute_dedup_signature(
+    const std::string &str,
+    const DedupNormalizationOption &option = DedupNormalizationOption(),
+    const DedupSignatureOption &signature_option = DedupSignatureOption());
+
+///
+/// Estimated Jaccard similarity of the shingle sets(ratio of equal MinHash
+/// values). 0 when either signature has no MinHash.
+///
+double estimate_jaccard(const DedupSignature &a, const DedupSignature &b);
+
+///
+/// Hamming distance of two SimHash values.
+///
+uint32_t simhash_distance(uint64_t a, uint64_t b);
+
+namespace detail {
+
+// State of `RepeatShortener`: run of text[p] == text[p - l] for
+// p in [head + l, head + l + len). When `closed`, the run is known to end
+// at `head + l + len`.
+struct RepeatRun {
+  size_t len{0};
+  bool closed{false};
+};
+
+}  // namespace detail
+
+///
+/// Reusable normalizer.
+/// Holds the option and internal scratch buffers, so normalizing many(short)
+/// texts with one instance does not allocate once the buffers have grown.
+/// Not thread-safe: use one instance per thread.
+///
+class Normalizer {
+ public:
+  Normalizer() = default;
+  explicit Normalizer(const NormalizationOption &option) : option_(option) {}
+
+  const NormalizationOption &option() const { return option_; }
+  void set_option(const NormalizationOption &option) { option_ = option; }
+
+  ///
+  /// Add the counters of the following calls to `stats`(nullptr: off).
+  /// Without it, counting is compiled out of the normalization loop.
+  ///
+  void set_stats(NormalizationStats *stats) { stats_ = stats; }
+
+  ///
+  /// Normalize `str` and write the result into `dst`.
+  /// The capacity of `dst` is reused across calls.
+  ///
+  /// @return false when the input is rejected(e.g. exceeds `max_tokens`).
+  /// `dst` is cleared in that case.
+  ///
+  bool normalize_into(const char *str, size_t len, std::string &dst);
+
+#if defined(JP_NORMALIZER_HAS_STRING_VIEW)
+  bool normalize_into(std::string_view str, std::string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+#else
+  bool normalize_into(const std::string &str, std::string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+#endif
+
+  std::string normalize(const std::string &str) {
+    std::string dst;
+    normalize_into(str.data(), str.size(), dst);
+    return dst;
+  }
+
+  ///
+  /// `normalize_into()` which appends the result to `dst`, without an
+  /// intermediate buffer. `dst` is left as is when the input is rejected.
+  ///
+  bool normalize_append(const char *str, size_t len, std::string &dst);
+
+  ///
+  /// `normalize_into()` which writes the result straight into
+  /// dst[0, capacity) and sets its size to `dst_len`.
+  ///
+  /// @return false when the input is rejected, or when `capacity` is less
+  /// than `normalize_bound(len)`(`dst_len` is set to 0).
+  ///
+  bool normalize_to(const char *str, size_t len, char *dst, size_t capacity,
+                    size_t &dst_len);
+
+  ///
+  /// UTF-16/UTF-32 input and output. `len` is the number of code units.
+  ///
+  bool normalize_into(const char16_t *str, size_t len, std::u16string &dst);
+  bool normalize_into(const char32_t *str, size_t len, std::u32string &dst);
+
+  ///
+  /// `normalize_into()` which also computes the output-to-input offset map
+  /// of `dst` in the same pass(including repeat shortening).
+  /// `offsets` is cleared when the input is rejected.
+  ///
+  bool normalize_into(const char *str, size_t len, std::string &dst,
+                      OffsetMap &offsets);
+  bool normalize_into(const char16_t *str, size_t len, std::u16string &dst,
+                      OffsetMap &offsets);
+  bool normalize_into(const char32_t *str, size_t len, std::u32string &dst,
+                      OffsetMap &offsets);
+
+#if defined(JP_NORMALIZER_HAS_STRING_VIEW)
+  bool normalize_into(std::u16string_view str, std::u16string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+  bool normalize_into(std::u32string_view str, std::u32string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+#else
+  bool normalize_into(const std::u16string &str, std::u16string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+  bool normalize_into(const std::u32string &str, std::u32string &dst) {
+    return normalize_into(str.data(), str.size(), dst);
+  }
+#endif
+
+  std::u16string normalize(const std::u16string &str) {
+    std::u16string dst;
+    normalize_into(str.data(), str.size(), dst);
+    return dst;
+  }
+
+  std::u32string normalize(const std::u32string &str) {
+    std::u32string dst;
+    normalize_into(str.data(), str.size(), dst);
+    return dst;
+  }
+
+  ///
+  /// True when `normalize_into(str, len, ...)` would write `str` as is.
+  /// See `jpnormalizer::is_normalized()`. Counters are not added.
+  ///
+  bool is_normalized(const char *str, size_t len);
+  bool is_normalized(const char16_t *str, size_t len);
+  bool is_normalized(const char32_t *str, size_t len);
+
+  ///
+  /// `normalize_into()` which first checks `is_normalized()`. When `str` is
+  /// already normalized, `unchanged` is set and `dst` is left empty, so the
+  /// caller can keep `str`. Otherwise `str` is scanned again up to the first
+  /// change. Counters are added only for changed text.
+  ///
+  bool normalize_into(const char *str, size_t len, std::string &dst,
+                      bool &unchanged);
+  bool normalize_into(const char16_t *str, size_t len, std::u16string &dst,
+                      bool &unchanged);
+  bool normalize_into(const char32_t *str, size_t len, std::u32string &dst,
+                      bool &unchanged);
+
+ private:
+  template <class Unit>
+  bool is_normalized_units(const Unit *str, size_t len);
+
+  // `offsets` is nullptr when the offset map is not needed.
+  template <class Unit>
+  bool normalize_units(const Unit *str, size_t len,
+                       std::basic_string<Unit> &dst, OffsetMap *offsets);
+  template <class Unit, class Stats>
+  bool normalize_units(const Unit *str, size_t len,
+                       std::basic_string<Unit> &dst, OffsetMap *offsets,
+                       Stats stats);
+  template <class Stats>
+  bool normalize_append(const char *str, size_t len, std::string &dst,
+                        Stats stats);
+  template <class Stats>
+  bool normalize_to(const char *str, size_t len, char *dst, size_t &dst_len,
+                    Stats stats);
+
+  NormalizationOption option_;
+  NormalizationStats *stats_{nullptr};
+
+  // scratch buffers
+  std::vector<uint32_t> codepoints_;
+  std::vector<uint32_t> codepoint_offsets_;
+  std::vector<detail::RepeatRun> repeat_runs_;
+  std::vector<uint32_t> repeat_ring_;
+  std::vector<size_t> repeat_check_runs_;
+};
+
+///
+/// Reusable `compute_dedup_signature()`.
+/// Holds the options and internal scratch buffers. Not thread-safe: use one
+/// instance per thread.
+///
+class DedupHasher {
+ public:
+  DedupHasher() = default;
+  DedupHasher(const DedupNormalizationOption &option,
+              const DedupSignatureOption &signature_option)
+      : option_(option), signature_option_(signature_option) {}
+
+  ///
+  /// Compute the signature of `str` into `signature`.
+  /// The capacity of `signature.minhash` is reused across calls.
+  ///
+  void compute(const char *str, size_t len, DedupSignature &signature);
+
+ private:
+  DedupNormalizationOption option_;
+  DedupSignatureOption signature_option_;
+
+  // scratch buffers
+  std::vector<uint32_t> codepoints_;
+  std::vector<detail::RepeatRun> repeat_runs_;
+  std::vector<uint32_t> ngram_window_;
+};
+
+///
+/// Streaming normalizer.
+/// Normalizes a text given in chunks with constant memory. State(partial
+/// UTF-8 char, previous char, space rules, a char waiting for following
+/// ﾞ/ﾟ, repeat window) is carried across chunk boundaries, so the output is
+/// identical to `normalize()` of the concatenated text.
+///
+/// `max_tokens` is not applied.
+///
+class StreamNormalizer {
+ public:
+  explicit StreamNormalizer(const NormalizationOption &option = NormalizationOption());
+  ~StreamNormalizer();
+
+  StreamNormalizer(StreamNormalizer &&) noexcept;
+  StreamNormalizer &operator=(StreamNormalizer &&) noexcept;
+
+  ///
+  /// Feed the next chunk. Normalized text decided so far is appended to `out`.
+  ///
+  void feed(const char *data, size_t len, std::string &out);
+
+  ///
+  /// End of text. The rest of normalized text is appended to `out`.
+  /// The state is reset, so the instance can be used for the next text.
+  ///
+  void finish(std::string &out);
+
+  ///
+  /// Add the counters to `stats`(nullptr: off). A text is counted by
+  /// `finish()`.
+  ///
+  void set_stats(NormalizationStats *stats);
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+///
+/// Normalize many documents in parallel.
+/// Documents are distributed to `num_threads` threads(0: number of cores) by
+/// work-stealing, so very skewed document lengths are balanced. Each thread
+/// reuses its own `Normalizer`. Results are in the input order.
+///
+/// When `stats` is given, each thread counts into its own
+/// `NormalizationStats` and they are added to `stats` at the end.
+///
+std::vector<std::string> normalize_batch(
+    const std::vector<std::string> &docs,
+    const NormalizationOption &option = NormalizationOption(),
+    size_t num_threads = 0, NormalizationStats *stats = nullptr);
+
+#if defined(JP_NORMALIZER_HAS_STRING_VIEW)
+std::vector<std::string> normalize_batch(
+    const std::vector<std::string_view> &docs,
+    const NormalizationOption &option = NormalizationOption(),
+    size_t num_threads = 0, NormalizationStats *stats = nullptr);
+#endif
+
+///
+/// Normalize a string column(Arrow-like layout): row `i` is
+/// data[offsets[i], offsets[i + 1]) for i in [0, n), so `offsets` has n + 1
+/// entries(offsets[0] need not be 0). The results are written in the same
+/// layout to `out_data` and `out_offsets`(n + 1 entries, starting at 0).
+/// Rejected rows are empty.
+///
+/// No per-row allocation. Rows are split into ranges of about the same
+/// byte size, which are normalized on `num_threads` threads(0: number of
+/// cores) into their own buffers and concatenated.
+///
+void normalize_column(const char *data, const uint64_t *offsets, size_t n,
+                      std::string &out_data, std::vector<uint64_t> &out_offsets,
+                      const NormalizationOption &option = NormalizationOption(),
+                      size_t num_threads = 1, NormalizationStats *stats = nullptr);
+
+///
+/// Normalize one large text on `num_threads` threads(0: number of cores).
+/// The text is split at points where no rule looks across(no ﾞ/ﾟ merge, no
+/// space rule, outside the repeat window), shards are normalized in parallel
+/// and stitched together. The result is identical to `normalize()`.
+/// Small texts are normalized on the calling thread.
+///
+/// @return false when the input is rejected(e.g. exceeds `max_tokens`).
+/// `dst` is cleared in that case.
+///
+bool normalize_parallel(const char *str, size_t len, std::string &dst,
+                        const NormalizationOption &option = NormalizationOption(),
+                        size_t num_threads = 0);
+
+std::string normalize_parallel(const std::string &str,
+                               const NormalizationOption &option = NormalizationOption(),
+                               size_t num_threads = 0);
+
+struct NormalizationCacheOption {
+  // Memory budget of the cached inputs and results(approx. Split evenly
+  // among the shards).
+  size_t max_bytes{64 * 1024 * 1024};
+  // Number of independently locked shards(rounded up to a power of two).
+  uint32_t num_shards{16};
+  // Longer inputs are normalized without the cache.
+  size_t max_input_len{256};
+};
+
+///
+/// Thread-safe cache of `normalize()` results for short, repeated inputs
+/// (e.g. search queries). Entries are keyed by a hash of the input bytes and
+/// the option. A hit also compares the stored input, so a hash collision
+/// never returns a wrong result.
+///
+/// Each shard has its own lock and evicts with CLOCK(second chance) when its
+/// part of `max_bytes` is exceeded. Misses are normalized outside the lock.
+///
+class NormalizationCache {
+ public:
+  explicit NormalizationCache(
+      const NormalizationCacheOption &cache_option = NormalizationCacheOption());
+  ~NormalizationCache();
+
+  NormalizationCache(const NormalizationCache &) = delete;
+  NormalizationCache &operator=(const NormalizationCache &) = delete;
+
+  ///
+  /// `Normalizer::normalize_into()` through the cache.
+  ///
+  bool normalize_into(const char *str, size_t len,
+                      const NormalizationOption &option, std::string &dst);
+
+  std::string normalize(const std::string &str,
+                        const NormalizationOption &option = NormalizationOption()) {
+    std::string dst;
+    normalize_into(str.data(), str.size(), option, dst);
+    return dst;
+  }
+
+  // Lookups of cacheable inputs(not longer than `max_input_len`).
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+  // Number of entries and their size in bytes(as counted for `max_bytes`).
+  size_t size() const;
+  size_t bytes() const;
+
+  void clear();
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
 std::unordered_set<std::string> get_digits();
 std::unordered_set<std::string> get_digits_and_parentized_ideographs();
 const std::unordered_set<std::string> &get_unicode_puncts();
@@ -53,149 +710,54 @@ const std::unordered_set<std::string> &get_unicode_puncts();
 
 #if defined(JP_NORMALIZER_IMPLEMENTATION)
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-namespace jpnormalizer {
+#if !defined(JP_NORMALIZER_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JP_NORMALIZER_USE_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define JP_NORMALIZER_USE_SSE2 1
+#endif
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <tmmintrin.h>
+#define JP_NORMALIZER_USE_SSSE3 1
+#endif
+// AVX2 functions selected at runtime(UTF-8 validation).
+#if !defined(__AVX2__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define JP_NORMALIZER_USE_AVX2_DISPATCH 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define JP_NORMALIZER_USE_NEON 1
+#endif
+#endif
 
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wexit-time-destructors"
-#pragma clang diagnostic ignored "-Wglobal-constructors"
+#if defined(_MSC_VER)
+#include <intrin.h>
 #endif
 
+namespace jpnormalizer {
 
-static std::unordered_map<std::string, char> sASCII{
-    {"ａ", 'a'}, {"ｂ", 'b'}, {"ｃ", 'c'}, {"ｄ", 'd'}, {"ｅ", 'e'},
-    {"ｆ", 'f'}, {"ｇ", 'g'}, {"ｈ", 'h'}, {"ｉ", 'i'}, {"ｊ", 'j'},
-    {"ｋ", 'k'}, {"ｌ", 'l'}, {"ｍ", 'm'}, {"ｎ", 'n'}, {"ｏ", 'o'},
-    {"ｐ", 'p'}, {"ｑ", 'q'}, {"ｒ", 'r'}, {"ｓ", 's'}, {"ｔ", 't'},
-    {"ｕ", 'u'}, {"ｖ", 'v'}, {"ｗ", 'w'}, {"ｘ", 'x'}, {"ｙ", 'y'},
-    {"ｚ", 'z'}, {"Ａ", 'A'}, {"Ｂ", 'B'}, {"Ｃ", 'C'}, {"Ｄ", 'D'},
-    {"Ｅ", 'E'}, {"Ｆ", 'F'}, {"Ｇ", 'G'}, {"Ｈ", 'H'}, {"Ｉ", 'I'},
-    {"Ｊ", 'J'}, {"Ｋ", 'K'}, {"Ｌ", 'L'}, {"Ｍ", 'M'}, {"Ｎ", 'N'},
-    {"Ｏ", 'O'}, {"Ｐ", 'P'}, {"Ｑ", 'Q'}, {"Ｒ", 'R'}, {"Ｓ", 'S'},
-    {"Ｔ", 'T'}, {"Ｕ", 'U'}, {"Ｖ", 'V'}, {"Ｗ", 'W'}, {"Ｘ", 'X'},
-    {"Ｙ", 'Y'}, {"Ｚ", 'Z'}, {"！", '!'}, {"”", '"'},  {"＃", '#'},
-    {"＄", '$'}, {"％", '%'}, {"＆", '&'}, {"’", '\''}, {"（", '{'},
-    {"）", '}'}, {"＊", '*'}, {"＋", '+'}, {"，", ','}, {"−", '-'},
-    {"．", '.'}, {"／", '/'}, {"：", ':'}, {"；", ';'}, {"＜", '<'},
-    {"＝", '='}, {"＞", '>'}, {"？", '?'}, {"＠", '@'}, {"［", '['},
-    {"¥", '\\'}, {"］", ']'}, {"＾", '^'}, {"＿", '_'}, {"‘", '`'},
-    {"｛", '{'}, {"｜", '|'}, {"｝", '}'}};
-
-static std::unordered_map<std::string, std::string> sKANA = {
-    {"ｱ", "ア"}, {"ｲ", "イ"}, {"ｳ", "ウ"}, {"ｴ", "エ"}, {"ｵ", "オ"},
-    {"ｶ", "カ"}, {"ｷ", "キ"}, {"ｸ", "ク"}, {"ｹ", "ケ"}, {"ｺ", "コ"},
-    {"ｻ", "サ"}, {"ｼ", "シ"}, {"ｽ", "ス"}, {"ｾ", "セ"}, {"ｿ", "ソ"},
-    {"ﾀ", "タ"}, {"ﾁ", "チ"}, {"ﾂ", "ツ"}, {"ﾃ", "テ"}, {"ﾄ", "ト"},
-    {"ﾅ", "ナ"}, {"ﾆ", "ニ"}, {"ﾇ", "ヌ"}, {"ﾈ", "ネ"}, {"ﾉ", "ノ"},
-    {"ﾊ", "ハ"}, {"ﾋ", "ヒ"}, {"ﾌ", "フ"}, {"ﾍ", "ヘ"}, {"ﾎ", "ホ"},
-    {"ﾏ", "マ"}, {"ﾐ", "ミ"}, {"ﾑ", "ム"}, {"ﾒ", "メ"}, {"ﾓ", "モ"},
-    {"ﾔ", "ヤ"}, {"ﾕ", "ユ"}, {"ﾖ", "ヨ"}, {"ﾗ", "ラ"}, {"ﾘ", "リ"},
-    {"ﾙ", "ル"}, {"ﾚ", "レ"}, {"ﾛ", "ロ"}, {"ﾜ", "ワ"}, {"ｦ", "ヲ"},
-    {"ﾝ", "ン"}, {"ｧ", "ァ"}, {"ｨ", "ィ"}, {"ｩ", "ゥ"}, {"ｪ", "ェ"},
-    {"ｫ", "ォ"}, {"ｯ", "ッ"}, {"ｬ", "ャ"}, {"ｭ", "ュ"}, {"ｮ", "ョ"},
-    {"｡", "。"}, {"､", "、"}, {"･", "・"}, {"゛", "ﾞ"}, {"゜", "ﾟ"},
-    {"｢", "「"}, {"｣", "」"}, {"ｰ", "ー"}};
-
-static std::unordered_map<std::string, std::string> sDIGIT = {
-    {"０", "0"}, {"１", "1"}, {"２", "2"}, {"３", "3"}, {"４", "4"},
-    {"５", "5"}, {"６", "6"}, {"７", "7"}, {"８", "8"}, {"９", "9"}};
-static std::unordered_map<std::string, std::string> sKANA_TEN = {
-    {"カ", "ガ"}, {"キ", "ギ"}, {"ク", "グ"}, {"ケ", "ゲ"}, {"コ", "ゴ"},
-    {"サ", "ザ"}, {"シ", "ジ"}, {"ス", "ズ"}, {"セ", "ゼ"}, {"ソ", "ゾ"},
-    {"タ", "ダ"}, {"チ", "ヂ"}, {"ツ", "ヅ"}, {"テ", "デ"}, {"ト", "ド"},
-    {"ハ", "バ"}, {"ヒ", "ビ"}, {"フ", "ブ"}, {"ヘ", "ベ"}, {"ホ", "ボ"},
-    {"ウ", "ヴ"}, {"う", "ゔ"}};
-static std::unordered_map<std::string, std::string> sKANA_MARU = {
-    {"ハ", "パ"}, {"ヒ", "ピ"}, {"フ", "プ"}, {"ヘ", "ペ"}, {"ホ", "ポ"},
-    {"は", "ぱ"}, {"ひ", "ぴ"}, {"ふ", "ぷ"}, {"へ", "ぺ"}, {"ほ", "ぽ"}};
-
-// not in neologdn
-static std::unordered_map<std::string, std::string> sParenthesizedIdeographs = {
-    {"㈠", "(一)"}, {"㈡", "(二)"}, {"㈢", "(三)"}, {"㈣", "(四)"},
-    {"㈤", "(五)"}, {"㈥", "(六)"}, {"㈦", "(七)"}, {"㈧", "(八)"},
-    {"㈨", "(九)"}, {"㈩", "(十)"}, {"㈪", "(月)"}, {"㈫", "(火)"},
-    {"㈬", "(水)"}, {"㈭", "(木)"}, {"㈮", "(金)"}, {"㈯", "(土)"},
-
-    {"㈰", "(日)"}, {"㈱", "(株)"}, {"㈲", "(有)"}, {"㈳", "(社)"},
-    {"㈴", "(名)"}, {"㈵", "(特)"}, {"㈶", "(財)"}, {"㈷", "(祝)"},
-    {"㈸", "(労)"}, {"㈹", "(代)"}, {"㈺", "(呼)"}, {"㈻", "(学)"},
-    {"㈼", "(監)"}, {"㈽", "(企)"}, {"㈾", "(資)"}, {"㈿", "(協)"},
-    {"㉀", "(祭)"}, {"㉁", "(休)"}, {"㉂", "(自)"}, {"㉃", "(至)"}};
-
-static std::unordered_set<std::string> sHYPHENS = {"˗", "֊", "‐", "‑", "‒",
-                                                   "–", "⁃", "⁻", "₋", "−"};
-
-static std::unordered_set<std::string> sCHOONPUS = {"﹣", "－", "ｰ", "—",
-                                                    "―",  "─",  "━", "ー"};
-
-static std::unordered_set<std::string> sTILDES = {"~",  "∼",  "∾",
-                                                  "〜", "〰", "～"};
-
-// TODO: We can simply use direct string comparision for space character.
-static std::unordered_set<std::string> sSPACE = {" ", "　"};
-
-static std::unordered_set<std::string> sUNICODE_PUNCT = {
-    "，",
-    "。",
-    "、",
-    "„",
-    "”",
-    "“",
-    "«",
-    "»",
-    "１",
-    "」",
-    "「",
-    "《",
-    "》",
-    "´",
-    "∶",
-    "：",
-    "？",
-    "！",
-    "（",
-    "）",
-    "；",
-    "–",
-    "—",
-    "．",
-    "～",
-    "’",
-    "…",
-    "━",
-    "〈",
-    "〉",
-    "【",
-    "】",
-    "％",
-    "►",
-    ":",
-    ";",
-    "-",
-    ",",
-    ".",
-    "?",
-    "!",
-    ")",
-    "(",
-    "<",
-    ">",
-    "[",
-    "]",
-    "\"",
-    "'"
-};
-
-
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
+// Returned by `get_unicode_puncts()`.
+static constexpr const char *kUnicodePuncts[] = {
+    "，", "。", "、", "„", "”", "“", "«", "»", "１", "」", "「", "《", "》", "´", "∶",
+    "：", "？", "！", "（", "）", "；", "–", "—", "．", "～", "’", "…", "━", "〈", "〉",
+    "【", "】", "％", "►", ":", ";", "-", ",", ".", "?", "!", ")", "(", "<", ">",
+    "[", "]", "\"", "'",
+};
 
 namespace detail {
 
@@ -262,7 +824,7 @@ namespace detail {
         unsigned char s2 = static_cast<unsigned char>(s[2]);
         unsigned char s3 = static_cast<unsigned char>(s[3]);
         if (((s0 & 0xf8) == 0xf0) && ((s1 & 0xc0) == 0x80) &&
-            ((s2 & 0xc0) == 0x80) && ((s2 & 0xc0) == 0x80)) {
+            ((s2 & 0xc0) == 0x80) && ((s3 & 0xc0) == 0x80)) {
           code = (uint32_t(s0 & 0x7) << 18) | (uint32_t(s1 & 0x3f) << 12) |
                  (uint32_t(s2 & 0x3f) << 6) | uint32_t(s3 & 0x3f);
         } else {
@@ -310,32 +872,6 @@ inline std::string codepoint_to_utf8(uint32_t code) {
 }
 
 
-inline std::vector<uint32_t> to_codepoints(const std::string &str)
-{
-  size_t i = 0;
-  std::vector<uint32_t> codes;
-  while (i < str.size()) {
-    uint32_t len;
-    uint32_t code = to_codepoint(&str[i], len);
-
-    codes.push_back(code);
-    i += len;
-  }
-
-  return codes;
-}
-
-inline std::string codepoints_to_string(const std::vector<uint32_t> &codepoints)
-{
-  std::string ret;
-
-  for (const auto &code : codepoints) {
-    ret += codepoint_to_utf8(code);
-  }
-
-  return ret;
-}
-
 inline std::string extract_utf8_char(const std::string& str, uint32_t start_i,
                                      int& len) {
   len = 0;
@@ -379,20 +915,20 @@ inline std::string extract_utf8_char(const std::string& str, uint32_t start_i,
   }
 }
 
-inline uint32_t utf8_code(const std::string &s) {
-  if (s.empty() || (s.size() > 4)) {
+inline uint32_t utf8_code(const char *s, size_t sz) {
+  if ((sz == 0) || (sz > 4)) {
     return ~0u; // invalid
   }
 
   // TODO: endianness
   uint32_t code = 0;
-  if (s.size() == 1) {
+  if (sz == 1) {
     unsigned char s0 = static_cast<unsigned char>(s[0]);
     if (s0 > 0x7f) {
       return ~0u;
     }
     code = uint32_t(s0) & 0x7f;
-  } else if (s.size() == 2) {
+  } else if (sz == 2) {
     // 11bit: 110y-yyyx	10xx-xxxx
     unsigned char s0 = static_cast<unsigned char>(s[0]);
     unsigned char s1 = static_cast<unsigned char>(s[1]);
@@ -402,7 +938,7 @@ inline uint32_t utf8_code(const std::string &s) {
     } else {
       return ~0u;
     }
-  } else if (s.size() == 3) {
+  } else if (sz == 3) {
     // 16bit: 1110-yyyy	10yx-xxxx	10xx-xxxx
     unsigned char s0 = static_cast<unsigned char>(s[0]);
     unsigned char s1 = static_cast<unsigned char>(s[1]);
@@ -418,7 +954,7 @@ inline uint32_t utf8_code(const std::string &s) {
     unsigned char s1 = static_cast<unsigned char>(s[1]);
     unsigned char s2 = static_cast<unsigned char>(s[2]);
     unsigned char s3 = static_cast<unsigned char>(s[3]);
-    if (((s0 & 0xf8) == 0xf0) && ((s1 & 0xc0) == 0x80) && ((s2 & 0xc0) == 0x80) && ((s2 & 0xc0) == 0x80)) {
+    if (((s0 & 0xf8) == 0xf0) && ((s1 & 0xc0) == 0x80) && ((s2 & 0xc0) == 0x80) && ((s3 & 0xc0) == 0x80)) {
       code = (uint32_t(s0 & 0x7) << 18) | (uint32_t(s1 & 0x3f) << 12) | (uint32_t(s2 & 0x3f) << 6) | uint32_t(s3 & 0x3f);
     } else {
       return ~0u;
@@ -428,7 +964,11 @@ inline uint32_t utf8_code(const std::string &s) {
   return code;
 }
 
-inline bool is_cjk_char(const std::string &s) {
+inline uint32_t utf8_code(const std::string &s) {
+  return utf8_code(s.data(), s.size());
+}
+
+inline bool is_cjk_code(const uint32_t code) {
 
   //    range(19968, 40960),  # CJK UNIFIED IDEOGRAPHS
   //    range(12352, 12448),  # HIRAGANA
@@ -436,8 +976,6 @@ inline bool is_cjk_char(const std::string &s) {
   //    range(12289, 12352),  # CJK SYMBOLS AND PUNCTUATION
   //    range(65280, 65520)   # HALFWIDTH AND FULLWIDTH FORMS
 
-  uint32_t code = utf8_code(s);
-
   if ((code >= 19968) && (code < 40960)) {
     return true;
   } else if ((code >= 12352) && (code < 12448)) {
@@ -453,453 +991,4885 @@ inline bool is_cjk_char(const std::string &s) {
   return false;
 }
 
+inline bool is_cjk_char(const std::string &s) {
+  return is_cjk_code(utf8_code(s));
+}
 
-inline bool is_equal(const std::vector<uint32_t> &in,
-  size_t s_pos0, size_t s_pos1, size_t len) {
-
-  // return false when pos is out-of-range.
-  if ((s_pos0 >= in.size()) ||
-      (s_pos1 >= in.size()) ||
-      ((s_pos0 + len) > in.size()) ||
-      ((s_pos1 + len) > in.size())) {
-    return false;
+// Decode a single UTF-8 char.
+// Unlike `utf8_code`, returns ~0u for overlong or malformed sequences, so the
+// result can be used as a key for rule lookup(rules are keyed by exact bytes).
+inline uint32_t decode_utf8(const char *s, size_t len) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(s);
+
+  if (len == 1) {
+    return (p[0] <= 0x7f) ? uint32_t(p[0]) : ~0u;
+  } else if (len == 2) {
+    if (((p[0] & 0xe0) == 0xc0) && ((p[1] & 0xc0) == 0x80)) {
+      uint32_t code = (uint32_t(p[0] & 0x1f) << 6) | uint32_t(p[1] & 0x3f);
+      return (code >= 0x80) ? code : ~0u;
+    }
+  } else if (len == 3) {
+    if (((p[0] & 0xf0) == 0xe0) && ((p[1] & 0xc0) == 0x80) &&
+        ((p[2] & 0xc0) == 0x80)) {
+      uint32_t code = (uint32_t(p[0] & 0xf) << 12) |
+                      (uint32_t(p[1] & 0x3f) << 6) | uint32_t(p[2] & 0x3f);
+      return (code >= 0x800) ? code : ~0u;
+    }
+  } else if (len == 4) {
+    if (((p[0] & 0xf8) == 0xf0) && ((p[1] & 0xc0) == 0x80) &&
+        ((p[2] & 0xc0) == 0x80) && ((p[3] & 0xc0) == 0x80)) {
+      uint32_t code = (uint32_t(p[0] & 0x7) << 18) |
+                      (uint32_t(p[1] & 0x3f) << 12) |
+                      (uint32_t(p[2] & 0x3f) << 6) | uint32_t(p[3] & 0x3f);
+      return ((code >= 0x10000) && (code <= 0x10ffff)) ? code : ~0u;
+    }
   }
 
-  return std::equal(std::begin(in) + int64_t(s_pos0), std::begin(in) + int64_t(s_pos0 + len),
-      std::begin(in) + int64_t(s_pos1));
+  return ~0u;
 }
 
-static std::vector<uint32_t> shorten_repeat_codepoints(const std::vector<uint32_t> &u8_codepoints, uint32_t repeat_threshold, uint32_t max_repeat_substr_len=8) {
-
-  std::vector<uint32_t> text = u8_codepoints;
-  size_t i = 0;
-  while (i < text.size()) {
-    size_t text_len = text.size();
+inline uint32_t decode_utf8(const std::string &s) {
+  return decode_utf8(s.data(), s.size());
+}
 
-    // upper bound of repeat size = 1/2 of input text.
-    size_t ceil_repeat_len = (text_len - i) / 2;
+// Bytes which are not a part of well-formed UTF-8 char are carried as
+// `kRawByte | byte` in codepoint arrays, so that they round-trip as is.
+static constexpr uint32_t kRawByte = 0x80000000u;
 
-    if (max_repeat_substr_len < ceil_repeat_len) {
-      ceil_repeat_len = max_repeat_substr_len + 1;
+// Decode UTF-8 string `s` and append codepoints to `codes`.
+inline void append_codepoints(const char *s, size_t len,
+                              std::vector<uint32_t> &codes) {
+  size_t i = 0;
+  while (i < len) {
+    uint32_t char_len = utf8_len(uint8_t(s[i]));
+    uint32_t code = ~0u;
+    if ((char_len > 0) && ((i + char_len) <= len)) {
+      code = decode_utf8(s + i, char_len);
     }
 
-    for (size_t repeat_len = 1; repeat_len < ceil_repeat_len; repeat_len++) {
-      size_t right_start = i + repeat_len;
-      size_t right_end = right_start + repeat_len;
+    if (code == ~0u) {
+      codes.push_back(kRawByte | uint8_t(s[i]));
+      i++;
+    } else {
+      codes.push_back(code);
+      i += char_len;
+    }
+  }
+}
 
-      size_t num_repeat = 1;
-      while (right_end <= text_len) {
-        if (!is_equal(text, i, right_start, repeat_len)) {
-          break;
-        }
+// Encode `code` to UTF-8 and returns the number of bytes written to `buf`.
+// `buf` must have room for 4 bytes.
+inline size_t encode_utf8(uint32_t code, char *buf) {
+  if (code & kRawByte) {
+    buf[0] = char(code & 0xff);
+    return 1;
+  } else if (code <= 0x7f) {
+    buf[0] = char(code);
+    return 1;
+  } else if (code <= 0x7ff) {
+    // 11bit: 110y-yyyx 10xx-xxxx
+    buf[0] = char(((code >> 6) & 0x1f) | 0xc0);
+    buf[1] = char(((code >> 0) & 0x3f) | 0x80);
+    return 2;
+  } else if (code <= 0xffff) {
+    // 16bit: 1110-yyyy 10yx-xxxx 10xx-xxxx
+    buf[0] = char(((code >> 12) & 0x0f) | 0xe0);
+    buf[1] = char(((code >>  6) & 0x3f) | 0x80);
+    buf[2] = char(((code >>  0) & 0x3f) | 0x80);
+    return 3;
+  } else if (code <= 0x10ffff) {
+    // 21bit: 1111-0yyy 10yy-xxxx 10xx-xxxx 10xx-xxxx
+    buf[0] = char(((code >> 18) & 0x07) | 0xf0);
+    buf[1] = char(((code >> 12) & 0x3f) | 0x80);
+    buf[2] = char(((code >>  6) & 0x3f) | 0x80);
+    buf[3] = char(((code >>  0) & 0x3f) | 0x80);
+    return 4;
+  }
 
-        num_repeat++;
-        right_start += repeat_len;
-        right_end += repeat_len;
-      }
+  // invalid
+  return 0;
+}
 
-      if (num_repeat > repeat_threshold) {
-        // cut out repeated substr
-#if 0
-        std::vector<uint32_t> buf;
+// Append codes[0, n) to `dst` in UTF-8.
+inline void append_utf8(const uint32_t *codes, size_t n, std::string &dst) {
+  size_t pos = dst.size();
+  dst.resize(pos + n * 4);
+  char *buf = &dst[0];
+  for (size_t i = 0; i < n; i++) {
+    pos += encode_utf8(codes[i], buf + pos);
+  }
+  dst.resize(pos);
+}
 
-        for (size_t k = 0; k < (std::min)(i + repeat_len * repeat_threshold, text.size()); k++) {
-          buf.push_back(text[k]);
-        }
+inline void codepoints_to_utf8(const uint32_t *codes, size_t n,
+                               std::string &dst) {
+  dst.clear();
+  append_utf8(codes, n, dst);
+}
 
-        for (size_t k = i + repeat_len * num_repeat; k < text.size(); k++) {
-          buf.push_back(text[k]);
-        }
+// Encode `code` to UTF-16 and returns the number of units written to `buf`.
+// `buf` must have room for 2 units.
+inline size_t encode_utf16(uint32_t code, char16_t *buf) {
+  if (code <= 0xffff) {
+    buf[0] = char16_t(code);
+    return 1;
+  } else if (code <= 0x10ffff) {
+    code -= 0x10000;
+    buf[0] = char16_t(0xd800 | (code >> 10));
+    buf[1] = char16_t(0xdc00 | (code & 0x3ff));
+    return 2;
+  }
 
-        text.swap(buf);
-#else
-        text.erase(text.begin() + int64_t((std::min)(i + repeat_len * repeat_threshold, text.size())), text.begin() + int64_t(i + repeat_len * num_repeat));
-#endif
-      }
-    }
+  // invalid
+  return 0;
+}
 
-    i++;
+inline size_t encode_utf32(uint32_t code, char32_t *buf) {
+  if (code <= 0x10ffff) {
+    buf[0] = char32_t(code);
+    return 1;
   }
 
-  return text;
+  // invalid
+  return 0;
 }
 
-static std::string shorten_repeat(const std::string &text, uint32_t repeat_threshold, uint32_t max_repeat_substr_len=8) {
+inline size_t encode_units(uint32_t code, char *buf) {
+  return encode_utf8(code, buf);
+}
 
-  std::vector<uint32_t> codepoints = to_codepoints(text);
+inline size_t encode_units(uint32_t code, char16_t *buf) {
+  return encode_utf16(code, buf);
+}
 
-  std::vector<uint32_t> ret = shorten_repeat_codepoints(codepoints, repeat_threshold, max_repeat_substr_len);
+inline size_t encode_units(uint32_t code, char32_t *buf) {
+  return encode_utf32(code, buf);
+}
 
-  return codepoints_to_string(ret);
+// UTF-8, UTF-16 or UTF-32 depending on `Unit`.
+template <class Unit>
+inline void codepoints_to_units(const uint32_t *codes, size_t n,
+                                std::basic_string<Unit> &dst) {
+  // max units of a char: 4(UTF-8), 2(UTF-16), 1(UTF-32)
+  dst.resize(n * (4 / sizeof(Unit)));
+  Unit *buf = &dst[0];
+  size_t pos = 0;
+  for (size_t i = 0; i < n; i++) {
+    pos += encode_units(codes[i], buf + pos);
+  }
+  dst.resize(pos);
 }
 
+inline std::vector<uint32_t> to_codepoints(const std::string &str)
+{
+  std::vector<uint32_t> codes;
+  append_codepoints(str.data(), str.size(), codes);
 
-}  // namespace detail
+  return codes;
+}
 
-std::string normalize(const std::string& str,
-                      const NormalizationOption option) {
+inline std::string codepoints_to_string(const std::vector<uint32_t> &codepoints)
+{
+  std::string ret;
+  codepoints_to_utf8(codepoints.data(), codepoints.size(), ret);
 
-  if (str.empty()) {
-    return std::string();
-  }
+  return ret;
+}
 
-  if (str.size() > option.max_tokens) {
-    return std::string();
-  }
+///
+/// Rule class of a codepoint. Each codepoint has exactly one class: when a
+/// char is in several neologdn tables, the first matching `if` branch in
+/// `normalize()`(space, hyphen, choonpu, tilde, then replacement) wins.
+///
+enum class RuleKind : uint8_t {
+  None = 0,
+  Space,
+  Hyphen,
+  Choonpu,
+  Tilde,
+  Replace,        // ASCII, digit and kana replacement
+  Parenthesized,  // enclosed and squared forms(not in neologdn)
+};
 
-  ///
-  /// Decompose input string into UTF8 char list.
-  ///
-  uint64_t sz = str.size();
-  std::vector<std::string> utf8_chars;
+///
+/// A rule of `kRules`. The tables are generated by tools/gen_rule_tables.py.
+///
+struct RuleSource {
+  const char *from;  // a single UTF-8 char
+  RuleKind kind;
+  const char *to;  // replacement(empty for the kinds with a fixed output)
+};
 
-  for (size_t i = 0; i <= sz;) {
-    int len=0;
-    std::string s = detail::extract_utf8_char(str, uint32_t(i), len);
-    if (len == 0) {
-      // invalid char
-      break;
-    }
+struct KanaPair {
+  const char *from;
+  const char *to;
+};
 
-    i += uint64_t(len);
-    utf8_chars.push_back(s);
-  }
+// BEGIN GENERATED RULES(tools/gen_rule_tables.py). Do not edit by hand.
+
+///
+/// All rules, sorted by the codepoint of `from`(checked at compile time).
+///
+static constexpr RuleSource kRules[] = {
+    {" ", RuleKind::Space, ""}, {"~", RuleKind::Tilde, ""},
+    {"¥", RuleKind::Replace, "\\"}, {"˗", RuleKind::Hyphen, ""},
+    {"֊", RuleKind::Hyphen, ""}, {"‐", RuleKind::Hyphen, ""},
+    {"‑", RuleKind::Hyphen, ""}, {"‒", RuleKind::Hyphen, ""},
+    {"–", RuleKind::Hyphen, ""}, {"—", RuleKind::Choonpu, ""},
+    {"―", RuleKind::Choonpu, ""}, {"‘", RuleKind::Replace, "`"},
+    {"’", RuleKind::Replace, "'"}, {"”", RuleKind::Replace, "\""},
+    {"⁃", RuleKind::Hyphen, ""}, {"⁻", RuleKind::Hyphen, ""},
+    {"₋", RuleKind::Hyphen, ""}, {"−", RuleKind::Hyphen, ""},
+    {"∼", RuleKind::Tilde, ""}, {"∾", RuleKind::Tilde, ""},
+    {"①", RuleKind::Parenthesized, "1"}, {"②", RuleKind::Parenthesized, "2"},
+    {"③", RuleKind::Parenthesized, "3"}, {"④", RuleKind::Parenthesized, "4"},
+    {"⑤", RuleKind::Parenthesized, "5"}, {"⑥", RuleKind::Parenthesized, "6"},
+    {"⑦", RuleKind::Parenthesized, "7"}, {"⑧", RuleKind::Parenthesized, "8"},
+    {"⑨", RuleKind::Parenthesized, "9"}, {"⑩", RuleKind::Parenthesized, "10"},
+    {"⑪", RuleKind::Parenthesized, "11"},
+    {"⑫", RuleKind::Parenthesized, "12"},
+    {"⑬", RuleKind::Parenthesized, "13"},
+    {"⑭", RuleKind::Parenthesized, "14"},
+    {"⑮", RuleKind::Parenthesized, "15"},
+    {"⑯", RuleKind::Parenthesized, "16"},
+    {"⑰", RuleKind::Parenthesized, "17"},
+    {"⑱", RuleKind::Parenthesized, "18"},
+    {"⑲", RuleKind::Parenthesized, "19"},
+    {"⑳", RuleKind::Parenthesized, "20"},
+    {"⑴", RuleKind::Parenthesized, "(1)"},
+    {"⑵", RuleKind::Parenthesized, "(2)"},
+    {"⑶", RuleKind::Parenthesized, "(3)"},
+    {"⑷", RuleKind::Parenthesized, "(4)"},
+    {"⑸", RuleKind::Parenthesized, "(5)"},
+    {"⑹", RuleKind::Parenthesized, "(6)"},
+    {"⑺", RuleKind::Parenthesized, "(7)"},
+    {"⑻", RuleKind::Parenthesized, "(8)"},
+    {"⑼", RuleKind::Parenthesized, "(9)"},
+    {"⑽", RuleKind::Parenthesized, "(10)"},
+    {"⑾", RuleKind::Parenthesized, "(11)"},
+    {"⑿", RuleKind::Parenthesized, "(12)"},
+    {"⒀", RuleKind::Parenthesized, "(13)"},
+    {"⒁", RuleKind::Parenthesized, "(14)"},
+    {"⒂", RuleKind::Parenthesized, "(15)"},
+    {"⒃", RuleKind::Parenthesized, "(16)"},
+    {"⒄", RuleKind::Parenthesized, "(17)"},
+    {"⒅", RuleKind::Parenthesized, "(18)"},
+    {"⒆", RuleKind::Parenthesized, "(19)"},
+    {"⒇", RuleKind::Parenthesized, "(20)"},
+    {"⒈", RuleKind::Parenthesized, "1."},
+    {"⒉", RuleKind::Parenthesized, "2."},
+    {"⒊", RuleKind::Parenthesized, "3."},
+    {"⒋", RuleKind::Parenthesized, "4."},
+    {"⒌", RuleKind::Parenthesized, "5."},
+    {"⒍", RuleKind::Parenthesized, "6."},
+    {"⒎", RuleKind::Parenthesized, "7."},
+    {"⒏", RuleKind::Parenthesized, "8."},
+    {"⒐", RuleKind::Parenthesized, "9."},
+    {"⒑", RuleKind::Parenthesized, "10."},
+    {"⒒", RuleKind::Parenthesized, "11."},
+    {"⒓", RuleKind::Parenthesized, "12."},
+    {"⒔", RuleKind::Parenthesized, "13."},
+    {"⒕", RuleKind::Parenthesized, "14."},
+    {"⒖", RuleKind::Parenthesized, "15."},
+    {"⒗", RuleKind::Parenthesized, "16."},
+    {"⒘", RuleKind::Parenthesized, "17."},
+    {"⒙", RuleKind::Parenthesized, "18."},
+    {"⒚", RuleKind::Parenthesized, "19."},
+    {"⒛", RuleKind::Parenthesized, "20."},
+    {"⒜", RuleKind::Parenthesized, "(a)"},
+    {"⒝", RuleKind::Parenthesized, "(b)"},
+    {"⒞", RuleKind::Parenthesized, "(c)"},
+    {"⒟", RuleKind::Parenthesized, "(d)"},
+    {"⒠", RuleKind::Parenthesized, "(e)"},
+    {"⒡", RuleKind::Parenthesized, "(f)"},
+    {"⒢", RuleKind::Parenthesized, "(g)"},
+    {"⒣", RuleKind::Parenthesized, "(h)"},
+    {"⒤", RuleKind::Parenthesized, "(i)"},
+    {"⒥", RuleKind::Parenthesized, "(j)"},
+    {"⒦", RuleKind::Parenthesized, "(k)"},
+    {"⒧", RuleKind::Parenthesized, "(l)"},
+    {"⒨", RuleKind::Parenthesized, "(m)"},
+    {"⒩", RuleKind::Parenthesized, "(n)"},
+    {"⒪", RuleKind::Parenthesized, "(o)"},
+    {"⒫", RuleKind::Parenthesized, "(p)"},
+    {"⒬", RuleKind::Parenthesized, "(q)"},
+    {"⒭", RuleKind::Parenthesized, "(r)"},
+    {"⒮", RuleKind::Parenthesized, "(s)"},
+    {"⒯", RuleKind::Parenthesized, "(t)"},
+    {"⒰", RuleKind::Parenthesized, "(u)"},
+    {"⒱", RuleKind::Parenthesized, "(v)"},
+    {"⒲", RuleKind::Parenthesized, "(w)"},
+    {"⒳", RuleKind::Parenthesized, "(x)"},
+    {"⒴", RuleKind::Parenthesized, "(y)"},
+    {"⒵", RuleKind::Parenthesized, "(z)"},
+    {"Ⓐ", RuleKind::Parenthesized, "A"}, {"Ⓑ", RuleKind::Parenthesized, "B"},
+    {"Ⓒ", RuleKind::Parenthesized, "C"}, {"Ⓓ", RuleKind::Parenthesized, "D"},
+    {"Ⓔ", RuleKind::Parenthesized, "E"}, {"Ⓕ", RuleKind::Parenthesized, "F"},
+    {"Ⓖ", RuleKind::Parenthesized, "G"}, {"Ⓗ", RuleKind::Parenthesized, "H"},
+    {"Ⓘ", RuleKind::Parenthesized, "I"}, {"Ⓙ", RuleKind::Parenthesized, "J"},
+    {"Ⓚ", RuleKind::Parenthesized, "K"}, {"Ⓛ", RuleKind::Parenthesized, "L"},
+    {"Ⓜ", RuleKind::Parenthesized, "M"}, {"Ⓝ", RuleKind::Parenthesized, "N"},
+    {"Ⓞ", RuleKind::Parenthesized, "O"}, {"Ⓟ", RuleKind::Parenthesized, "P"},
+    {"Ⓠ", RuleKind::Parenthesized, "Q"}, {"Ⓡ", RuleKind::Parenthesized, "R"},
+    {"Ⓢ", RuleKind::Parenthesized, "S"}, {"Ⓣ", RuleKind::Parenthesized, "T"},
+    {"Ⓤ", RuleKind::Parenthesized, "U"}, {"Ⓥ", RuleKind::Parenthesized, "V"},
+    {"Ⓦ", RuleKind::Parenthesized, "W"}, {"Ⓧ", RuleKind::Parenthesized, "X"},
+    {"Ⓨ", RuleKind::Parenthesized, "Y"}, {"Ⓩ", RuleKind::Parenthesized, "Z"},
+    {"ⓐ", RuleKind::Parenthesized, "a"}, {"ⓑ", RuleKind::Parenthesized, "b"},
+    {"ⓒ", RuleKind::Parenthesized, "c"}, {"ⓓ", RuleKind::Parenthesized, "d"},
+    {"ⓔ", RuleKind::Parenthesized, "e"}, {"ⓕ", RuleKind::Parenthesized, "f"},
+    {"ⓖ", RuleKind::Parenthesized, "g"}, {"ⓗ", RuleKind::Parenthesized, "h"},
+    {"ⓘ", RuleKind::Parenthesized, "i"}, {"ⓙ", RuleKind::Parenthesized, "j"},
+    {"ⓚ", RuleKind::Parenthesized, "k"}, {"ⓛ", RuleKind::Parenthesized, "l"},
+    {"ⓜ", RuleKind::Parenthesized, "m"}, {"ⓝ", RuleKind::Parenthesized, "n"},
+    {"ⓞ", RuleKind::Parenthesized, "o"}, {"ⓟ", RuleKind::Parenthesized, "p"},
+    {"ⓠ", RuleKind::Parenthesized, "q"}, {"ⓡ", RuleKind::Parenthesized, "r"},
+    {"ⓢ", RuleKind::Parenthesized, "s"}, {"ⓣ", RuleKind::Parenthesized, "t"},
+    {"ⓤ", RuleKind::Parenthesized, "u"}, {"ⓥ", RuleKind::Parenthesized, "v"},
+    {"ⓦ", RuleKind::Parenthesized, "w"}, {"ⓧ", RuleKind::Parenthesized, "x"},
+    {"ⓨ", RuleKind::Parenthesized, "y"}, {"ⓩ", RuleKind::Parenthesized, "z"},
+    {"⓪", RuleKind::Parenthesized, "0"}, {"─", RuleKind::Choonpu, ""},
+    {"━", RuleKind::Choonpu, ""}, {"　", RuleKind::Space, ""},
+    {"〜", RuleKind::Tilde, ""}, {"〰", RuleKind::Tilde, ""},
+    {"゛", RuleKind::Replace, "ﾞ"}, {"゜", RuleKind::Replace, "ﾟ"},
+    {"ー", RuleKind::Choonpu, ""}, {"㈠", RuleKind::Parenthesized, "(一)"},
+    {"㈡", RuleKind::Parenthesized, "(二)"},
+    {"㈢", RuleKind::Parenthesized, "(三)"},
+    {"㈣", RuleKind::Parenthesized, "(四)"},
+    {"㈤", RuleKind::Parenthesized, "(五)"},
+    {"㈥", RuleKind::Parenthesized, "(六)"},
+    {"㈦", RuleKind::Parenthesized, "(七)"},
+    {"㈧", RuleKind::Parenthesized, "(八)"},
+    {"㈨", RuleKind::Parenthesized, "(九)"},
+    {"㈩", RuleKind::Parenthesized, "(十)"},
+    {"㈪", RuleKind::Parenthesized, "(月)"},
+    {"㈫", RuleKind::Parenthesized, "(火)"},
+    {"㈬", RuleKind::Parenthesized, "(水)"},
+    {"㈭", RuleKind::Parenthesized, "(木)"},
+    {"㈮", RuleKind::Parenthesized, "(金)"},
+    {"㈯", RuleKind::Parenthesized, "(土)"},
+    {"㈰", RuleKind::Parenthesized, "(日)"},
+    {"㈱", RuleKind::Parenthesized, "(株)"},
+    {"㈲", RuleKind::Parenthesized, "(有)"},
+    {"㈳", RuleKind::Parenthesized, "(社)"},
+    {"㈴", RuleKind::Parenthesized, "(名)"},
+    {"㈵", RuleKind::Parenthesized, "(特)"},
+    {"㈶", RuleKind::Parenthesized, "(財)"},
+    {"㈷", RuleKind::Parenthesized, "(祝)"},
+    {"㈸", RuleKind::Parenthesized, "(労)"},
+    {"㈹", RuleKind::Parenthesized, "(代)"},
+    {"㈺", RuleKind::Parenthesized, "(呼)"},
+    {"㈻", RuleKind::Parenthesized, "(学)"},
+    {"㈼", RuleKind::Parenthesized, "(監)"},
+    {"㈽", RuleKind::Parenthesized, "(企)"},
+    {"㈾", RuleKind::Parenthesized, "(資)"},
+    {"㈿", RuleKind::Parenthesized, "(協)"},
+    {"㉀", RuleKind::Parenthesized, "(祭)"},
+    {"㉁", RuleKind::Parenthesized, "(休)"},
+    {"㉂", RuleKind::Parenthesized, "(自)"},
+    {"㉃", RuleKind::Parenthesized, "(至)"},
+    {"㉄", RuleKind::Parenthesized, "問"},
+    {"㉅", RuleKind::Parenthesized, "幼"},
+    {"㉆", RuleKind::Parenthesized, "文"},
+    {"㉇", RuleKind::Parenthesized, "箏"},
+    {"㉐", RuleKind::Parenthesized, "PTE"},
+    {"㉑", RuleKind::Parenthesized, "21"},
+    {"㉒", RuleKind::Parenthesized, "22"},
+    {"㉓", RuleKind::Parenthesized, "23"},
+    {"㉔", RuleKind::Parenthesized, "24"},
+    {"㉕", RuleKind::Parenthesized, "25"},
+    {"㉖", RuleKind::Parenthesized, "26"},
+    {"㉗", RuleKind::Parenthesized, "27"},
+    {"㉘", RuleKind::Parenthesized, "28"},
+    {"㉙", RuleKind::Parenthesized, "29"},
+    {"㉚", RuleKind::Parenthesized, "30"},
+    {"㉛", RuleKind::Parenthesized, "31"},
+    {"㉜", RuleKind::Parenthesized, "32"},
+    {"㉝", RuleKind::Parenthesized, "33"},
+    {"㉞", RuleKind::Parenthesized, "34"},
+    {"㉟", RuleKind::Parenthesized, "35"},
+    {"㊀", RuleKind::Parenthesized, "一"},
+    {"㊁", RuleKind::Parenthesized, "二"},
+    {"㊂", RuleKind::Parenthesized, "三"},
+    {"㊃", RuleKind::Parenthesized, "四"},
+    {"㊄", RuleKind::Parenthesized, "五"},
+    {"㊅", RuleKind::Parenthesized, "六"},
+    {"㊆", RuleKind::Parenthesized, "七"},
+    {"㊇", RuleKind::Parenthesized, "八"},
+    {"㊈", RuleKind::Parenthesized, "九"},
+    {"㊉", RuleKind::Parenthesized, "十"},
+    {"㊊", RuleKind::Parenthesized, "月"},
+    {"㊋", RuleKind::Parenthesized, "火"},
+    {"㊌", RuleKind::Parenthesized, "水"},
+    {"㊍", RuleKind::Parenthesized, "木"},
+    {"㊎", RuleKind::Parenthesized, "金"},
+    {"㊏", RuleKind::Parenthesized, "土"},
+    {"㊐", RuleKind::Parenthesized, "日"},
+    {"㊑", RuleKind::Parenthesized, "株"},
+    {"㊒", RuleKind::Parenthesized, "有"},
+    {"㊓", RuleKind::Parenthesized, "社"},
+    {"㊔", RuleKind::Parenthesized, "名"},
+    {"㊕", RuleKind::Parenthesized, "特"},
+    {"㊖", RuleKind::Parenthesized, "財"},
+    {"㊗", RuleKind::Parenthesized, "祝"},
+    {"㊘", RuleKind::Parenthesized, "労"},
+    {"㊙", RuleKind::Parenthesized, "秘"},
+    {"㊚", RuleKind::Parenthesized, "男"},
+    {"㊛", RuleKind::Parenthesized, "女"},
+    {"㊜", RuleKind::Parenthesized, "適"},
+    {"㊝", RuleKind::Parenthesized, "優"},
+    {"㊞", RuleKind::Parenthesized, "印"},
+    {"㊟", RuleKind::Parenthesized, "注"},
+    {"㊠", RuleKind::Parenthesized, "項"},
+    {"㊡", RuleKind::Parenthesized, "休"},
+    {"㊢", RuleKind::Parenthesized, "写"},
+    {"㊣", RuleKind::Parenthesized, "正"},
+    {"㊤", RuleKind::Parenthesized, "上"},
+    {"㊥", RuleKind::Parenthesized, "中"},
+    {"㊦", RuleKind::Parenthesized, "下"},
+    {"㊧", RuleKind::Parenthesized, "左"},
+    {"㊨", RuleKind::Parenthesized, "右"},
+    {"㊩", RuleKind::Parenthesized, "医"},
+    {"㊪", RuleKind::Parenthesized, "宗"},
+    {"㊫", RuleKind::Parenthesized, "学"},
+    {"㊬", RuleKind::Parenthesized, "監"},
+    {"㊭", RuleKind::Parenthesized, "企"},
+    {"㊮", RuleKind::Parenthesized, "資"},
+    {"㊯", RuleKind::Parenthesized, "協"},
+    {"㊰", RuleKind::Parenthesized, "夜"},
+    {"㊱", RuleKind::Parenthesized, "36"},
+    {"㊲", RuleKind::Parenthesized, "37"},
+    {"㊳", RuleKind::Parenthesized, "38"},
+    {"㊴", RuleKind::Parenthesized, "39"},
+    {"㊵", RuleKind::Parenthesized, "40"},
+    {"㊶", RuleKind::Parenthesized, "41"},
+    {"㊷", RuleKind::Parenthesized, "42"},
+    {"㊸", RuleKind::Parenthesized, "43"},
+    {"㊹", RuleKind::Parenthesized, "44"},
+    {"㊺", RuleKind::Parenthesized, "45"},
+    {"㊻", RuleKind::Parenthesized, "46"},
+    {"㊼", RuleKind::Parenthesized, "47"},
+    {"㊽", RuleKind::Parenthesized, "48"},
+    {"㊾", RuleKind::Parenthesized, "49"},
+    {"㊿", RuleKind::Parenthesized, "50"},
+    {"㋀", RuleKind::Parenthesized, "1月"},
+    {"㋁", RuleKind::Parenthesized, "2月"},
+    {"㋂", RuleKind::Parenthesized, "3月"},
+    {"㋃", RuleKind::Parenthesized, "4月"},
+    {"㋄", RuleKind::Parenthesized, "5月"},
+    {"㋅", RuleKind::Parenthesized, "6月"},
+    {"㋆", RuleKind::Parenthesized, "7月"},
+    {"㋇", RuleKind::Parenthesized, "8月"},
+    {"㋈", RuleKind::Parenthesized, "9月"},
+    {"㋉", RuleKind::Parenthesized, "10月"},
+    {"㋊", RuleKind::Parenthesized, "11月"},
+    {"㋋", RuleKind::Parenthesized, "12月"},
+    {"㋌", RuleKind::Parenthesized, "Hg"},
+    {"㋍", RuleKind::Parenthesized, "erg"},
+    {"㋎", RuleKind::Parenthesized, "eV"},
+    {"㋏", RuleKind::Parenthesized, "LTD"},
+    {"㋐", RuleKind::Parenthesized, "ア"},
+    {"㋑", RuleKind::Parenthesized, "イ"},
+    {"㋒", RuleKind::Parenthesized, "ウ"},
+    {"㋓", RuleKind::Parenthesized, "エ"},
+    {"㋔", RuleKind::Parenthesized, "オ"},
+    {"㋕", RuleKind::Parenthesized, "カ"},
+    {"㋖", RuleKind::Parenthesized, "キ"},
+    {"㋗", RuleKind::Parenthesized, "ク"},
+    {"㋘", RuleKind::Parenthesized, "ケ"},
+    {"㋙", RuleKind::Parenthesized, "コ"},
+    {"㋚", RuleKind::Parenthesized, "サ"},
+    {"㋛", RuleKind::Parenthesized, "シ"},
+    {"㋜", RuleKind::Parenthesized, "ス"},
+    {"㋝", RuleKind::Parenthesized, "セ"},
+    {"㋞", RuleKind::Parenthesized, "ソ"},
+    {"㋟", RuleKind::Parenthesized, "タ"},
+    {"㋠", RuleKind::Parenthesized, "チ"},
+    {"㋡", RuleKind::Parenthesized, "ツ"},
+    {"㋢", RuleKind::Parenthesized, "テ"},
+    {"㋣", RuleKind::Parenthesized, "ト"},
+    {"㋤", RuleKind::Parenthesized, "ナ"},
+    {"㋥", RuleKind::Parenthesized, "ニ"},
+    {"㋦", RuleKind::Parenthesized, "ヌ"},
+    {"㋧", RuleKind::Parenthesized, "ネ"},
+    {"㋨", RuleKind::Parenthesized, "ノ"},
+    {"㋩", RuleKind::Parenthesized, "ハ"},
+    {"㋪", RuleKind::Parenthesized, "ヒ"},
+    {"㋫", RuleKind::Parenthesized, "フ"},
+    {"㋬", RuleKind::Parenthesized, "ヘ"},
+    {"㋭", RuleKind::Parenthesized, "ホ"},
+    {"㋮", RuleKind::Parenthesized, "マ"},
+    {"㋯", RuleKind::Parenthesized, "ミ"},
+    {"㋰", RuleKind::Parenthesized, "ム"},
+    {"㋱", RuleKind::Parenthesized, "メ"},
+    {"㋲", RuleKind::Parenthesized, "モ"},
+    {"㋳", RuleKind::Parenthesized, "ヤ"},
+    {"㋴", RuleKind::Parenthesized, "ユ"},
+    {"㋵", RuleKind::Parenthesized, "ヨ"},
+    {"㋶", RuleKind::Parenthesized, "ラ"},
+    {"㋷", RuleKind::Parenthesized, "リ"},
+    {"㋸", RuleKind::Parenthesized, "ル"},
+    {"㋹", RuleKind::Parenthesized, "レ"},
+    {"㋺", RuleKind::Parenthesized, "ロ"},
+    {"㋻", RuleKind::Parenthesized, "ワ"},
+    {"㋼", RuleKind::Parenthesized, "ヰ"},
+    {"㋽", RuleKind::Parenthesized, "ヱ"},
+    {"㋾", RuleKind::Parenthesized, "ヲ"},
+    {"㋿", RuleKind::Parenthesized, "令和"},
+    {"㌀", RuleKind::Parenthesized, "アパート"},
+    {"㌁", RuleKind::Parenthesized, "アルファ"},
+    {"㌂", RuleKind::Parenthesized, "アンペア"},
+    {"㌃", RuleKind::Parenthesized, "アール"},
+    {"㌄", RuleKind::Parenthesized, "イニング"},
+    {"㌅", RuleKind::Parenthesized, "インチ"},
+    {"㌆", RuleKind::Parenthesized, "ウォン"},
+    {"㌇", RuleKind::Parenthesized, "エスクード"},
+    {"㌈", RuleKind::Parenthesized, "エーカー"},
+    {"㌉", RuleKind::Parenthesized, "オンス"},
+    {"㌊", RuleKind::Parenthesized, "オーム"},
+    {"㌋", RuleKind::Parenthesized, "カイリ"},
+    {"㌌", RuleKind::Parenthesized, "カラット"},
+    {"㌍", RuleKind::Parenthesized, "カロリー"},
+    {"㌎", RuleKind::Parenthesized, "ガロン"},
+    {"㌏", RuleKind::Parenthesized, "ガンマ"},
+    {"㌐", RuleKind::Parenthesized, "ギガ"},
+    {"㌑", RuleKind::Parenthesized, "ギニー"},
+    {"㌒", RuleKind::Parenthesized, "キュリー"},
+    {"㌓", RuleKind::Parenthesized, "ギルダー"},
+    {"㌔", RuleKind::Parenthesized, "キロ"},
+    {"㌕", RuleKind::Parenthesized, "キログラム"},
+    {"㌖", RuleKind::Parenthesized, "キロメートル"},
+    {"㌗", RuleKind::Parenthesized, "キロワット"},
+    {"㌘", RuleKind::Parenthesized, "グラム"},
+    {"㌙", RuleKind::Parenthesized, "グラムトン"},
+    {"㌚", RuleKind::Parenthesized, "クルゼイロ"},
+    {"㌛", RuleKind::Parenthesized, "クローネ"},
+    {"㌜", RuleKind::Parenthesized, "ケース"},
+    {"㌝", RuleKind::Parenthesized, "コルナ"},
+    {"㌞", RuleKind::Parenthesized, "コーポ"},
+    {"㌟", RuleKind::Parenthesized, "サイクル"},
+    {"㌠", RuleKind::Parenthesized, "サンチーム"},
+    {"㌡", RuleKind::Parenthesized, "シリング"},
+    {"㌢", RuleKind::Parenthesized, "センチ"},
+    {"㌣", RuleKind::Parenthesized, "セント"},
+    {"㌤", RuleKind::Parenthesized, "ダース"},
+    {"㌥", RuleKind::Parenthesized, "デシ"},
+    {"㌦", RuleKind::Parenthesized, "ドル"},
+    {"㌧", RuleKind::Parenthesized, "トン"},
+    {"㌨", RuleKind::Parenthesized, "ナノ"},
+    {"㌩", RuleKind::Parenthesized, "ノット"},
+    {"㌪", RuleKind::Parenthesized, "ハイツ"},
+    {"㌫", RuleKind::Parenthesized, "パーセント"},
+    {"㌬", RuleKind::Parenthesized, "パーツ"},
+    {"㌭", RuleKind::Parenthesized, "バーレル"},
+    {"㌮", RuleKind::Parenthesized, "ピアストル"},
+    {"㌯", RuleKind::Parenthesized, "ピクル"},
+    {"㌰", RuleKind::Parenthesized, "ピコ"},
+    {"㌱", RuleKind::Parenthesized, "ビル"},
+    {"㌲", RuleKind::Parenthesized, "ファラッド"},
+    {"㌳", RuleKind::Parenthesized, "フィート"},
+    {"㌴", RuleKind::Parenthesized, "ブッシェル"},
+    {"㌵", RuleKind::Parenthesized, "フラン"},
+    {"㌶", RuleKind::Parenthesized, "ヘクタール"},
+    {"㌷", RuleKind::Parenthesized, "ペソ"},
+    {"㌸", RuleKind::Parenthesized, "ペニヒ"},
+    {"㌹", RuleKind::Parenthesized, "ヘルツ"},
+    {"㌺", RuleKind::Parenthesized, "ペンス"},
+    {"㌻", RuleKind::Parenthesized, "ページ"},
+    {"㌼", RuleKind::Parenthesized, "ベータ"},
+    {"㌽", RuleKind::Parenthesized, "ポイント"},
+    {"㌾", RuleKind::Parenthesized, "ボルト"},
+    {"㌿", RuleKind::Parenthesized, "ホン"},
+    {"㍀", RuleKind::Parenthesized, "ポンド"},
+    {"㍁", RuleKind::Parenthesized, "ホール"},
+    {"㍂", RuleKind::Parenthesized, "ホーン"},
+    {"㍃", RuleKind::Parenthesized, "マイクロ"},
+    {"㍄", RuleKind::Parenthesized, "マイル"},
+    {"㍅", RuleKind::Parenthesized, "マッハ"},
+    {"㍆", RuleKind::Parenthesized, "マルク"},
+    {"㍇", RuleKind::Parenthesized, "マンション"},
+    {"㍈", RuleKind::Parenthesized, "ミクロン"},
+    {"㍉", RuleKind::Parenthesized, "ミリ"},
+    {"㍊", RuleKind::Parenthesized, "ミリバール"},
+    {"㍋", RuleKind::Parenthesized, "メガ"},
+    {"㍌", RuleKind::Parenthesized, "メガトン"},
+    {"㍍", RuleKind::Parenthesized, "メートル"},
+    {"㍎", RuleKind::Parenthesized, "ヤード"},
+    {"㍏", RuleKind::Parenthesized, "ヤール"},
+    {"㍐", RuleKind::Parenthesized, "ユアン"},
+    {"㍑", RuleKind::Parenthesized, "リットル"},
+    {"㍒", RuleKind::Parenthesized, "リラ"},
+    {"㍓", RuleKind::Parenthesized, "ルピー"},
+    {"㍔", RuleKind::Parenthesized, "ルーブル"},
+    {"㍕", RuleKind::Parenthesized, "レム"},
+    {"㍖", RuleKind::Parenthesized, "レントゲン"},
+    {"㍗", RuleKind::Parenthesized, "ワット"},
+    {"㍘", RuleKind::Parenthesized, "0点"},
+    {"㍙", RuleKind::Parenthesized, "1点"},
+    {"㍚", RuleKind::Parenthesized, "2点"},
+    {"㍛", RuleKind::Parenthesized, "3点"},
+    {"㍜", RuleKind::Parenthesized, "4点"},
+    {"㍝", RuleKind::Parenthesized, "5点"},
+    {"㍞", RuleKind::Parenthesized, "6点"},
+    {"㍟", RuleKind::Parenthesized, "7点"},
+    {"㍠", RuleKind::Parenthesized, "8点"},
+    {"㍡", RuleKind::Parenthesized, "9点"},
+    {"㍢", RuleKind::Parenthesized, "10点"},
+    {"㍣", RuleKind::Parenthesized, "11点"},
+    {"㍤", RuleKind::Parenthesized, "12点"},
+    {"㍥", RuleKind::Parenthesized, "13点"},
+    {"㍦", RuleKind::Parenthesized, "14点"},
+    {"㍧", RuleKind::Parenthesized, "15点"},
+    {"㍨", RuleKind::Parenthesized, "16点"},
+    {"㍩", RuleKind::Parenthesized, "17点"},
+    {"㍪", RuleKind::Parenthesized, "18点"},
+    {"㍫", RuleKind::Parenthesized, "19点"},
+    {"㍬", RuleKind::Parenthesized, "20点"},
+    {"㍭", RuleKind::Parenthesized, "21点"},
+    {"㍮", RuleKind::Parenthesized, "22点"},
+    {"㍯", RuleKind::Parenthesized, "23点"},
+    {"㍰", RuleKind::Parenthesized, "24点"},
+    {"㍱", RuleKind::Parenthesized, "hPa"},
+    {"㍲", RuleKind::Parenthesized, "da"},
+    {"㍳", RuleKind::Parenthesized, "AU"},
+    {"㍴", RuleKind::Parenthesized, "bar"},
+    {"㍵", RuleKind::Parenthesized, "oV"},
+    {"㍶", RuleKind::Parenthesized, "pc"},
+    {"㍷", RuleKind::Parenthesized, "dm"},
+    {"㍸", RuleKind::Parenthesized, "dm2"},
+    {"㍹", RuleKind::Parenthesized, "dm3"},
+    {"㍺", RuleKind::Parenthesized, "IU"},
+    {"㍻", RuleKind::Parenthesized, "平成"},
+    {"㍼", RuleKind::Parenthesized, "昭和"},
+    {"㍽", RuleKind::Parenthesized, "大正"},
+    {"㍾", RuleKind::Parenthesized, "明治"},
+    {"㍿", RuleKind::Parenthesized, "株式会社"},
+    {"㎀", RuleKind::Parenthesized, "pA"},
+    {"㎁", RuleKind::Parenthesized, "nA"},
+    {"㎂", RuleKind::Parenthesized, "μA"},
+    {"㎃", RuleKind::Parenthesized, "mA"},
+    {"㎄", RuleKind::Parenthesized, "kA"},
+    {"㎅", RuleKind::Parenthesized, "KB"},
+    {"㎆", RuleKind::Parenthesized, "MB"},
+    {"㎇", RuleKind::Parenthesized, "GB"},
+    {"㎈", RuleKind::Parenthesized, "cal"},
+    {"㎉", RuleKind::Parenthesized, "kcal"},
+    {"㎊", RuleKind::Parenthesized, "pF"},
+    {"㎋", RuleKind::Parenthesized, "nF"},
+    {"㎌", RuleKind::Parenthesized, "μF"},
+    {"㎍", RuleKind::Parenthesized, "μg"},
+    {"㎎", RuleKind::Parenthesized, "mg"},
+    {"㎏", RuleKind::Parenthesized, "kg"},
+    {"㎐", RuleKind::Parenthesized, "Hz"},
+    {"㎑", RuleKind::Parenthesized, "kHz"},
+    {"㎒", RuleKind::Parenthesized, "MHz"},
+    {"㎓", RuleKind::Parenthesized, "GHz"},
+    {"㎔", RuleKind::Parenthesized, "THz"},
+    {"㎕", RuleKind::Parenthesized, "μl"},
+    {"㎖", RuleKind::Parenthesized, "ml"},
+    {"㎗", RuleKind::Parenthesized, "dl"},
+    {"㎘", RuleKind::Parenthesized, "kl"},
+    {"㎙", RuleKind::Parenthesized, "fm"},
+    {"㎚", RuleKind::Parenthesized, "nm"},
+    {"㎛", RuleKind::Parenthesized, "μm"},
+    {"㎜", RuleKind::Parenthesized, "mm"},
+    {"㎝", RuleKind::Parenthesized, "cm"},
+    {"㎞", RuleKind::Parenthesized, "km"},
+    {"㎟", RuleKind::Parenthesized, "mm2"},
+    {"㎠", RuleKind::Parenthesized, "cm2"},
+    {"㎡", RuleKind::Parenthesized, "m2"},
+    {"㎢", RuleKind::Parenthesized, "km2"},
+    {"㎣", RuleKind::Parenthesized, "mm3"},
+    {"㎤", RuleKind::Parenthesized, "cm3"},
+    {"㎥", RuleKind::Parenthesized, "m3"},
+    {"㎦", RuleKind::Parenthesized, "km3"},
+    {"㎧", RuleKind::Parenthesized, "m∕s"},
+    {"㎨", RuleKind::Parenthesized, "m∕s2"},
+    {"㎩", RuleKind::Parenthesized, "Pa"},
+    {"㎪", RuleKind::Parenthesized, "kPa"},
+    {"㎫", RuleKind::Parenthesized, "MPa"},
+    {"㎬", RuleKind::Parenthesized, "GPa"},
+    {"㎭", RuleKind::Parenthesized, "rad"},
+    {"㎮", RuleKind::Parenthesized, "rad∕s"},
+    {"㎯", RuleKind::Parenthesized, "rad∕s2"},
+    {"㎰", RuleKind::Parenthesized, "ps"},
+    {"㎱", RuleKind::Parenthesized, "ns"},
+    {"㎲", RuleKind::Parenthesized, "μs"},
+    {"㎳", RuleKind::Parenthesized, "ms"},
+    {"㎴", RuleKind::Parenthesized, "pV"},
+    {"㎵", RuleKind::Parenthesized, "nV"},
+    {"㎶", RuleKind::Parenthesized, "μV"},
+    {"㎷", RuleKind::Parenthesized, "mV"},
+    {"㎸", RuleKind::Parenthesized, "kV"},
+    {"㎹", RuleKind::Parenthesized, "MV"},
+    {"㎺", RuleKind::Parenthesized, "pW"},
+    {"㎻", RuleKind::Parenthesized, "nW"},
+    {"㎼", RuleKind::Parenthesized, "μW"},
+    {"㎽", RuleKind::Parenthesized, "mW"},
+    {"㎾", RuleKind::Parenthesized, "kW"},
+    {"㎿", RuleKind::Parenthesized, "MW"},
+    {"㏀", RuleKind::Parenthesized, "kΩ"},
+    {"㏁", RuleKind::Parenthesized, "MΩ"},
+    {"㏂", RuleKind::Parenthesized, "a.m."},
+    {"㏃", RuleKind::Parenthesized, "Bq"},
+    {"㏄", RuleKind::Parenthesized, "cc"},
+    {"㏅", RuleKind::Parenthesized, "cd"},
+    {"㏆", RuleKind::Parenthesized, "C∕kg"},
+    {"㏇", RuleKind::Parenthesized, "Co."},
+    {"㏈", RuleKind::Parenthesized, "dB"},
+    {"㏉", RuleKind::Parenthesized, "Gy"},
+    {"㏊", RuleKind::Parenthesized, "ha"},
+    {"㏋", RuleKind::Parenthesized, "HP"},
+    {"㏌", RuleKind::Parenthesized, "in"},
+    {"㏍", RuleKind::Parenthesized, "KK"},
+    {"㏎", RuleKind::Parenthesized, "KM"},
+    {"㏏", RuleKind::Parenthesized, "kt"},
+    {"㏐", RuleKind::Parenthesized, "lm"},
+    {"㏑", RuleKind::Parenthesized, "ln"},
+    {"㏒", RuleKind::Parenthesized, "log"},
+    {"㏓", RuleKind::Parenthesized, "lx"},
+    {"㏔", RuleKind::Parenthesized, "mb"},
+    {"㏕", RuleKind::Parenthesized, "mil"},
+    {"㏖", RuleKind::Parenthesized, "mol"},
+    {"㏗", RuleKind::Parenthesized, "PH"},
+    {"㏘", RuleKind::Parenthesized, "p.m."},
+    {"㏙", RuleKind::Parenthesized, "PPM"},
+    {"㏚", RuleKind::Parenthesized, "PR"},
+    {"㏛", RuleKind::Parenthesized, "sr"},
+    {"㏜", RuleKind::Parenthesized, "Sv"},
+    {"㏝", RuleKind::Parenthesized, "Wb"},
+    {"㏞", RuleKind::Parenthesized, "V∕m"},
+    {"㏟", RuleKind::Parenthesized, "A∕m"},
+    {"㏠", RuleKind::Parenthesized, "1日"},
+    {"㏡", RuleKind::Parenthesized, "2日"},
+    {"㏢", RuleKind::Parenthesized, "3日"},
+    {"㏣", RuleKind::Parenthesized, "4日"},
+    {"㏤", RuleKind::Parenthesized, "5日"},
+    {"㏥", RuleKind::Parenthesized, "6日"},
+    {"㏦", RuleKind::Parenthesized, "7日"},
+    {"㏧", RuleKind::Parenthesized, "8日"},
+    {"㏨", RuleKind::Parenthesized, "9日"},
+    {"㏩", RuleKind::Parenthesized, "10日"},
+    {"㏪", RuleKind::Parenthesized, "11日"},
+    {"㏫", RuleKind::Parenthesized, "12日"},
+    {"㏬", RuleKind::Parenthesized, "13日"},
+    {"㏭", RuleKind::Parenthesized, "14日"},
+    {"㏮", RuleKind::Parenthesized, "15日"},
+    {"㏯", RuleKind::Parenthesized, "16日"},
+    {"㏰", RuleKind::Parenthesized, "17日"},
+    {"㏱", RuleKind::Parenthesized, "18日"},
+    {"㏲", RuleKind::Parenthesized, "19日"},
+    {"㏳", RuleKind::Parenthesized, "20日"},
+    {"㏴", RuleKind::Parenthesized, "21日"},
+    {"㏵", RuleKind::Parenthesized, "22日"},
+    {"㏶", RuleKind::Parenthesized, "23日"},
+    {"㏷", RuleKind::Parenthesized, "24日"},
+    {"㏸", RuleKind::Parenthesized, "25日"},
+    {"㏹", RuleKind::Parenthesized, "26日"},
+    {"㏺", RuleKind::Parenthesized, "27日"},
+    {"㏻", RuleKind::Parenthesized, "28日"},
+    {"㏼", RuleKind::Parenthesized, "29日"},
+    {"㏽", RuleKind::Parenthesized, "30日"},
+    {"㏾", RuleKind::Parenthesized, "31日"},
+    {"㏿", RuleKind::Parenthesized, "gal"}, {"﹣", RuleKind::Choonpu, ""},
+    {"！", RuleKind::Replace, "!"}, {"＃", RuleKind::Replace, "#"},
+    {"＄", RuleKind::Replace, "$"}, {"％", RuleKind::Replace, "%"},
+    {"＆", RuleKind::Replace, "&"}, {"（", RuleKind::Replace, "{"},
+    {"）", RuleKind::Replace, "}"}, {"＊", RuleKind::Replace, "*"},
+    {"＋", RuleKind::Replace, "+"}, {"，", RuleKind::Replace, ","},
+    {"－", RuleKind::Choonpu, ""}, {"．", RuleKind::Replace, "."},
+    {"／", RuleKind::Replace, "/"}, {"０", RuleKind::Replace, "0"},
+    {"１", RuleKind::Replace, "1"}, {"２", RuleKind::Replace, "2"},
+    {"３", RuleKind::Replace, "3"}, {"４", RuleKind::Replace, "4"},
+    {"５", RuleKind::Replace, "5"}, {"６", RuleKind::Replace, "6"},
+    {"７", RuleKind::Replace, "7"}, {"８", RuleKind::Replace, "8"},
+    {"９", RuleKind::Replace, "9"}, {"：", RuleKind::Replace, ":"},
+    {"；", RuleKind::Replace, ";"}, {"＜", RuleKind::Replace, "<"},
+    {"＝", RuleKind::Replace, "="}, {"＞", RuleKind::Replace, ">"},
+    {"？", RuleKind::Replace, "?"}, {"＠", RuleKind::Replace, "@"},
+    {"Ａ", RuleKind::Replace, "A"}, {"Ｂ", RuleKind::Replace, "B"},
+    {"Ｃ", RuleKind::Replace, "C"}, {"Ｄ", RuleKind::Replace, "D"},
+    {"Ｅ", RuleKind::Replace, "E"}, {"Ｆ", RuleKind::Replace, "F"},
+    {"Ｇ", RuleKind::Replace, "G"}, {"Ｈ", RuleKind::Replace, "H"},
+    {"Ｉ", RuleKind::Replace, "I"}, {"Ｊ", RuleKind::Replace, "J"},
+    {"Ｋ", RuleKind::Replace, "K"}, {"Ｌ", RuleKind::Replace, "L"},
+    {"Ｍ", RuleKind::Replace, "M"}, {"Ｎ", RuleKind::Replace, "N"},
+    {"Ｏ", RuleKind::Replace, "O"}, {"Ｐ", RuleKind::Replace, "P"},
+    {"Ｑ", RuleKind::Replace, "Q"}, {"Ｒ", RuleKind::Replace, "R"},
+    {"Ｓ", RuleKind::Replace, "S"}, {"Ｔ", RuleKind::Replace, "T"},
+    {"Ｕ", RuleKind::Replace, "U"}, {"Ｖ", RuleKind::Replace, "V"},
+    {"Ｗ", RuleKind::Replace, "W"}, {"Ｘ", RuleKind::Replace, "X"},
+    {"Ｙ", RuleKind::Replace, "Y"}, {"Ｚ", RuleKind::Replace, "Z"},
+    {"［", RuleKind::Replace, "["}, {"］", RuleKind::Replace, "]"},
+    {"＾", RuleKind::Replace, "^"}, {"＿", RuleKind::Replace, "_"},
+    {"ａ", RuleKind::Replace, "a"}, {"ｂ", RuleKind::Replace, "b"},
+    {"ｃ", RuleKind::Replace, "c"}, {"ｄ", RuleKind::Replace, "d"},
+    {"ｅ", RuleKind::Replace, "e"}, {"ｆ", RuleKind::Replace, "f"},
+    {"ｇ", RuleKind::Replace, "g"}, {"ｈ", RuleKind::Replace, "h"},
+    {"ｉ", RuleKind::Replace, "i"}, {"ｊ", RuleKind::Replace, "j"},
+    {"ｋ", RuleKind::Replace, "k"}, {"ｌ", RuleKind::Replace, "l"},
+    {"ｍ", RuleKind::Replace, "m"}, {"ｎ", RuleKind::Replace, "n"},
+    {"ｏ", RuleKind::Replace, "o"}, {"ｐ", RuleKind::Replace, "p"},
+    {"ｑ", RuleKind::Replace, "q"}, {"ｒ", RuleKind::Replace, "r"},
+    {"ｓ", RuleKind::Replace, "s"}, {"ｔ", RuleKind::Replace, "t"},
+    {"ｕ", RuleKind::Replace, "u"}, {"ｖ", RuleKind::Replace, "v"},
+    {"ｗ", RuleKind::Replace, "w"}, {"ｘ", RuleKind::Replace, "x"},
+    {"ｙ", RuleKind::Replace, "y"}, {"ｚ", RuleKind::Replace, "z"},
+    {"｛", RuleKind::Replace, "{"}, {"｜", RuleKind::Replace, "|"},
+    {"｝", RuleKind::Replace, "}"}, {"～", RuleKind::Tilde, ""},
+    {"｡", RuleKind::Replace, "。"}, {"｢", RuleKind::Replace, "「"},
+    {"｣", RuleKind::Replace, "」"}, {"､", RuleKind::Replace, "、"},
+    {"･", RuleKind::Replace, "・"}, {"ｦ", RuleKind::Replace, "ヲ"},
+    {"ｧ", RuleKind::Replace, "ァ"}, {"ｨ", RuleKind::Replace, "ィ"},
+    {"ｩ", RuleKind::Replace, "ゥ"}, {"ｪ", RuleKind::Replace, "ェ"},
+    {"ｫ", RuleKind::Replace, "ォ"}, {"ｬ", RuleKind::Replace, "ャ"},
+    {"ｭ", RuleKind::Replace, "ュ"}, {"ｮ", RuleKind::Replace, "ョ"},
+    {"ｯ", RuleKind::Replace, "ッ"}, {"ｰ", RuleKind::Choonpu, ""},
+    {"ｱ", RuleKind::Replace, "ア"}, {"ｲ", RuleKind::Replace, "イ"},
+    {"ｳ", RuleKind::Replace, "ウ"}, {"ｴ", RuleKind::Replace, "エ"},
+    {"ｵ", RuleKind::Replace, "オ"}, {"ｶ", RuleKind::Replace, "カ"},
+    {"ｷ", RuleKind::Replace, "キ"}, {"ｸ", RuleKind::Replace, "ク"},
+    {"ｹ", RuleKind::Replace, "ケ"}, {"ｺ", RuleKind::Replace, "コ"},
+    {"ｻ", RuleKind::Replace, "サ"}, {"ｼ", RuleKind::Replace, "シ"},
+    {"ｽ", RuleKind::Replace, "ス"}, {"ｾ", RuleKind::Replace, "セ"},
+    {"ｿ", RuleKind::Replace, "ソ"}, {"ﾀ", RuleKind::Replace, "タ"},
+    {"ﾁ", RuleKind::Replace, "チ"}, {"ﾂ", RuleKind::Replace, "ツ"},
+    {"ﾃ", RuleKind::Replace, "テ"}, {"ﾄ", RuleKind::Replace, "ト"},
+    {"ﾅ", RuleKind::Replace, "ナ"}, {"ﾆ", RuleKind::Replace, "ニ"},
+    {"ﾇ", RuleKind::Replace, "ヌ"}, {"ﾈ", RuleKind::Replace, "ネ"},
+    {"ﾉ", RuleKind::Replace, "ノ"}, {"ﾊ", RuleKind::Replace, "ハ"},
+    {"ﾋ", RuleKind::Replace, "ヒ"}, {"ﾌ", RuleKind::Replace, "フ"},
+    {"ﾍ", RuleKind::Replace, "ヘ"}, {"ﾎ", RuleKind::Replace, "ホ"},
+    {"ﾏ", RuleKind::Replace, "マ"}, {"ﾐ", RuleKind::Replace, "ミ"},
+    {"ﾑ", RuleKind::Replace, "ム"}, {"ﾒ", RuleKind::Replace, "メ"},
+    {"ﾓ", RuleKind::Replace, "モ"}, {"ﾔ", RuleKind::Replace, "ヤ"},
+    {"ﾕ", RuleKind::Replace, "ユ"}, {"ﾖ", RuleKind::Replace, "ヨ"},
+    {"ﾗ", RuleKind::Replace, "ラ"}, {"ﾘ", RuleKind::Replace, "リ"},
+    {"ﾙ", RuleKind::Replace, "ル"}, {"ﾚ", RuleKind::Replace, "レ"},
+    {"ﾛ", RuleKind::Replace, "ロ"}, {"ﾜ", RuleKind::Replace, "ワ"},
+    {"ﾝ", RuleKind::Replace, "ン"},
+};
 
-  std::vector<std::string> dst_buf;
-  // normalized text should not exceed input length.
-  dst_buf.resize(utf8_chars.size());
+// Voiced(dakuten) forms of kana.
+static constexpr KanaPair kKanaTen[] = {
+    {"う", "ゔ"}, {"ウ", "ヴ"}, {"カ", "ガ"}, {"キ", "ギ"}, {"ク", "グ"},
+    {"ケ", "ゲ"}, {"コ", "ゴ"}, {"サ", "ザ"}, {"シ", "ジ"}, {"ス", "ズ"},
+    {"セ", "ゼ"}, {"ソ", "ゾ"}, {"タ", "ダ"}, {"チ", "ヂ"}, {"ツ", "ヅ"},
+    {"テ", "デ"}, {"ト", "ド"}, {"ハ", "バ"}, {"ヒ", "ビ"}, {"フ", "ブ"},
+    {"ヘ", "ベ"}, {"ホ", "ボ"},
+};
 
-  std::string prev_c = "\0";
-  bool latin_space = false;
-  uint64_t loc = 0;
+// Semi-voiced(handakuten) forms of kana.
+static constexpr KanaPair kKanaMaru[] = {
+    {"は", "ぱ"}, {"ひ", "ぴ"}, {"ふ", "ぷ"}, {"へ", "ぺ"}, {"ほ", "ぽ"},
+    {"ハ", "パ"}, {"ヒ", "ピ"}, {"フ", "プ"}, {"ヘ", "ペ"}, {"ホ", "ポ"},
+};
 
-  for (size_t i = 0 ; i  < utf8_chars.size(); i++) {
-    std::string c = utf8_chars[i];
+// END GENERATED RULES
 
-    if (sSPACE.count(c)) {
-      c = " ";
-      //std::cout << "c is space: prev_c = " << prev_c << ", utf8 code " << detail::utf8_code(prev_c) << "\n";
-      if (((prev_c == " ") || detail::is_cjk_char(prev_c)) && option.remove_space) {
-        continue;
-      } else if ((prev_c != "*") && (loc > 0) && (detail::utf8_code(prev_c) < 128)) {
-        //std::cout << "latin space\n";
-        latin_space = true;
-        if (loc >= dst_buf.size()) {
-          // ???
-          return std::string();
-        }
-        dst_buf[loc] = c;
-      } else if (option.remove_space) {
-        if (loc == 0) {
-          prev_c = c;
-          continue;
-        } else {
-          loc--;
-        }
-      } else {
-        if (loc >= dst_buf.size()) {
-          // ???
-          return std::string();
-        }
-        dst_buf[loc] = c;
-      }
-    } else {
-      if (sHYPHENS.count(c)) {
-        if (prev_c == "-") {
-          continue;
-        } else {
-          c = "-";
-          dst_buf[loc] = c;
-        }
-      } else if (sCHOONPUS.count(c)) {
-        if (prev_c == "ー") { // zenkaku
-          continue;
-        } else {
-          c = "ー";
-          dst_buf[loc] = c;
-        }
-      } else if (sTILDES.count(c)) {
-        if (option.tilde == NormalizationOption::TildeMode::Ignore) {
-          // pass
-        } else if (option.tilde == NormalizationOption::TildeMode::Normalize) {
-          c = "~";
-        } else if (option.tilde == NormalizationOption::TildeMode::Zenkaku) {
-          c = "〜";
-        } else {
-          continue;
+// C++11 constexpr helpers to build `RuleTable` at compile time. They are
+// single-return recursive functions, so keep the recursion depth small.
+
+template <size_t... I>
+struct IndexSeq {};
+
+template <size_t N, size_t... I>
+struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeIndexSeq<0, I...> {
+  using type = IndexSeq<I...>;
+};
+
+// Codepoint of the first UTF-8 char of a literal.
+constexpr uint32_t literal_code(const char *s) {
+  return (uint8_t(s[0]) < 0x80)   ? uint8_t(s[0])
+         : (uint8_t(s[0]) < 0xe0) ? ((uint32_t(uint8_t(s[0])) & 0x1f) << 6) |
+                                        (uint8_t(s[1]) & 0x3f)
+         : (uint8_t(s[0]) < 0xf0) ? ((uint32_t(uint8_t(s[0])) & 0x0f) << 12) |
+                                        ((uint32_t(uint8_t(s[1])) & 0x3f) << 6) |
+                                        (uint8_t(s[2]) & 0x3f)
+                                  : ((uint32_t(uint8_t(s[0])) & 0x07) << 18) |
+                                        ((uint32_t(uint8_t(s[1])) & 0x3f) << 12) |
+                                        ((uint32_t(uint8_t(s[2])) & 0x3f) << 6) |
+                                        (uint8_t(s[3]) & 0x3f);
+}
+
+constexpr size_t literal_len(const char *s) {
+  return (s[0] == '\0') ? 0 : 1 + literal_len(s + 1);
+}
+
+constexpr char literal_at(const char *s, size_t i) {
+  return (i < literal_len(s)) ? s[i] : '\0';
+}
+
+constexpr size_t kNumRules = sizeof(kRules) / sizeof(kRules[0]);
+
+constexpr uint32_t rule_code(size_t i) { return literal_code(kRules[i].from); }
+
+// Recursion over kRules[lo, hi) splits the range in half(log depth).
+constexpr bool is_valid_rules(size_t lo, size_t hi) {
+  return (hi - lo == 1)
+             ? ((rule_code(lo) <= 0xffff) && (literal_len(kRules[lo].to) <= 0xff) &&
+                ((hi >= kNumRules) || (rule_code(lo) < rule_code(hi))))
+             : (is_valid_rules(lo, lo + (hi - lo) / 2) &&
+                is_valid_rules(lo + (hi - lo) / 2, hi));
+}
+
+static_assert(is_valid_rules(0, kNumRules),
+              "kRules must be BMP chars sorted by codepoint, with at most "
+              "255 bytes of replacement");
+
+// Index of the first rule in kRules[lo, hi) whose codepoint is >= `code`.
+constexpr size_t rule_lower_bound(uint32_t code, size_t lo, size_t hi) {
+  return (lo >= hi) ? lo
+         : (rule_code(lo + (hi - lo) / 2) < code)
+             ? rule_lower_bound(code, lo + (hi - lo) / 2 + 1, hi)
+             : rule_lower_bound(code, lo, lo + (hi - lo) / 2);
+}
+
+constexpr uint32_t rule_page(size_t i) { return rule_code(i) >> 8; }
+
+constexpr bool has_rule_page(uint32_t page) {
+  return (rule_lower_bound(page << 8, 0, kNumRules) < kNumRules) &&
+         (rule_page(rule_lower_bound(page << 8, 0, kNumRules)) == page);
+}
+
+// Number of pages below `page` with any rule.
+constexpr size_t count_rule_pages(uint32_t page) {
+  return (page == 0) ? 0 : count_rule_pages(page - 1) + (has_rule_page(page - 1) ? 1 : 0);
+}
+
+constexpr size_t kNumRulePages = count_rule_pages(256);
+
+static_assert(kNumRulePages < 256, "too many rule pages");
+
+// `k`-th page(from `page`) with any rule.
+constexpr uint32_t nth_rule_page(size_t k, uint32_t page) {
+  return has_rule_page(page) ? ((k == 0) ? page : nth_rule_page(k - 1, page + 1))
+                             : nth_rule_page(k, page + 1);
+}
+
+// Max of ceil(replacement bytes / char bytes) in kRules[lo, hi).
+constexpr size_t max_rule_growth(size_t lo, size_t hi) {
+  return (hi - lo == 1)
+             ? (literal_len(kRules[lo].to) + literal_len(kRules[lo].from) - 1) /
+                   literal_len(kRules[lo].from)
+             : (max_rule_growth(lo, lo + (hi - lo) / 2) >
+                max_rule_growth(lo + (hi - lo) / 2, hi))
+                   ? max_rule_growth(lo, lo + (hi - lo) / 2)
+                   : max_rule_growth(lo + (hi - lo) / 2, hi);
+}
+
+///
+/// Max UTF-8 bytes of the normalized text per input byte('㌖' to
+/// 'キロメートル'). At least 3 for '~' to '〜' and an invalid byte to U+FFFD.
+///
+constexpr size_t kMaxUtf8Growth =
+    (max_rule_growth(0, kNumRules) > 3) ? max_rule_growth(0, kNumRules) : 3;
+
+struct RuleEntry {
+  RuleKind kind;
+  uint8_t len;   // byte length of the replacement
+  char repl[6];  // replacement UTF-8 bytes(not null-terminated), or the index
+                 // of its rule in `kRules` when it is longer than 6 bytes.
+
+  const char *text() const {
+    if (len <= sizeof(repl)) {
+      return repl;
+    }
+    return kRules[size_t(uint8_t(repl[0])) | (size_t(uint8_t(repl[1])) << 8)].to;
+  }
+};
+
+struct RulePage {
+  RuleEntry entries[256];
+};
+
+static_assert(kNumRules <= 0x10000, "rule index must fit in `RuleEntry::repl`");
+
+constexpr RuleEntry make_rule_entry(size_t i) {
+  return (literal_len(kRules[i].to) <= 6)
+             ? RuleEntry{kRules[i].kind,
+                         uint8_t(literal_len(kRules[i].to)),
+                         {literal_at(kRules[i].to, 0), literal_at(kRules[i].to, 1),
+                          literal_at(kRules[i].to, 2), literal_at(kRules[i].to, 3),
+                          literal_at(kRules[i].to, 4), literal_at(kRules[i].to, 5)}}
+             : RuleEntry{kRules[i].kind,
+                         uint8_t(literal_len(kRules[i].to)),
+                         {char(i & 0xff), char(i >> 8), 0, 0, 0, 0}};
+}
+
+constexpr RuleEntry rule_entry_at(uint32_t code, size_t i) {
+  return ((i < kNumRules) && (rule_code(i) == code))
+             ? make_rule_entry(i)
+             : RuleEntry{RuleKind::None, 0, {0, 0, 0, 0, 0, 0}};
+}
+
+// Rules of `page` are kRules[lo, hi).
+template <size_t... I>
+constexpr RulePage make_rule_page(uint32_t page, size_t lo, size_t hi, IndexSeq<I...>) {
+  return RulePage{{rule_entry_at((page << 8) | I, rule_lower_bound((page << 8) | I, lo, hi))...}};
+}
+
+template <size_t... I>
+constexpr RulePage make_rule_page(uint32_t page, IndexSeq<I...> seq) {
+  return make_rule_page(page, rule_lower_bound(page << 8, 0, kNumRules),
+                        rule_lower_bound((page + 1) << 8, 0, kNumRules), seq);
+}
+
+// Index of `page` in `RuleTable::pages`. 0(the empty page) when no rule.
+constexpr uint8_t rule_page_index(uint32_t page) {
+  return has_rule_page(page) ? uint8_t(count_rule_pages(page) + 1) : 0;
+}
+
+constexpr uint16_t kana_pair_code(const KanaPair *pairs, size_t n, uint32_t code) {
+  return (n == 0) ? 0
+         : (literal_code(pairs[0].from) == code) ? uint16_t(literal_code(pairs[0].to))
+                                                 : kana_pair_code(pairs + 1, n - 1, code);
+}
+
+///
+/// Dense codepoint-indexed rule table, built at compile time from `kRules`.
+/// Two-level page table over the BMP: the upper 8 bits select a 256-entry page,
+/// pages without any rule share the empty page 0.
+///
+struct RuleTable {
+  static constexpr uint32_t kKanaBegin = 0x3040;  // HIRAGANA
+  static constexpr uint32_t kKanaEnd = 0x3100;    // end of KATAKANA
+
+  const RuleEntry &lookup(uint32_t code) const {
+    if (code > 0xffff) {
+      return pages[0].entries[0];
+    }
+    return pages[page_index[code >> 8]].entries[code & 0xff];
+  }
+
+  // Voiced(dakuten) form of kana `code`. 0 when no such form.
+  uint32_t kana_ten(uint32_t code) const {
+    if ((code < kKanaBegin) || (code >= kKanaEnd)) {
+      return 0;
+    }
+    return ten[code - kKanaBegin];
+  }
+
+  // Semi-voiced(handakuten) form of kana `code`. 0 when no such form.
+  uint32_t kana_maru(uint32_t code) const {
+    if ((code < kKanaBegin) || (code >= kKanaEnd)) {
+      return 0;
+    }
+    return maru[code - kKanaBegin];
+  }
+
+  uint8_t page_index[256];
+  RulePage pages[kNumRulePages + 1];  // page 0 is the empty page.
+  uint16_t ten[kKanaEnd - kKanaBegin];
+  uint16_t maru[kKanaEnd - kKanaBegin];
+};
+
+template <size_t... P, size_t... K, size_t... C>
+constexpr RuleTable make_rule_table(IndexSeq<P...>, IndexSeq<K...>, IndexSeq<C...>) {
+  return RuleTable{
+      {rule_page_index(P)...},
+      {RulePage{}, make_rule_page(nth_rule_page(K, 0), MakeIndexSeq<256>::type())...},
+      {kana_pair_code(kKanaTen, sizeof(kKanaTen) / sizeof(kKanaTen[0]),
+                      RuleTable::kKanaBegin + C)...},
+      {kana_pair_code(kKanaMaru, sizeof(kKanaMaru) / sizeof(kKanaMaru[0]),
+                      RuleTable::kKanaBegin + C)...}};
+}
+
+// In .rodata: no static initializer, heap or destructor.
+static constexpr RuleTable kRuleTable = make_rule_table(
+    MakeIndexSeq<256>::type(), MakeIndexSeq<kNumRulePages>::type(),
+    MakeIndexSeq<RuleTable::kKanaEnd - RuleTable::kKanaBegin>::type());
+
+inline const RuleTable &get_rule_table() { return kRuleTable; }
+
+inline bool is_equal(const std::vector<uint32_t> &in,
+  size_t s_pos0, size_t s_pos1, size_t len) {
+
+  // return false when pos is out-of-range.
+  if ((s_pos0 >= in.size()) ||
+      (s_pos1 >= in.size()) ||
+      ((s_pos0 + len) > in.size()) ||
+      ((s_pos1 + len) > in.size())) {
+    return false;
+  }
+
+  return std::equal(std::begin(in) + int64_t(s_pos0), std::begin(in) + int64_t(s_pos0 + len),
+      std::begin(in) + int64_t(s_pos1));
+}
+
+///
+/// Shortens repeated substrings(e.g. "ｗｗｗｗｗ", "無駄無駄無駄") in one
+/// forward pass.
+///
+/// Equivalent to the classic algorithm: at each position `i`, for each repeat
+/// length `l` in increasing order, count the consecutive copies of
+/// text[i, i + l) and cut the copies beyond `repeat_threshold`.
+///
+/// Rather than erasing in the middle of the text, the codepoints are
+/// compacted in place: text[0, i) is the output written so far and the
+/// pending text starts at `head`. For each `l` we cache the length of the run
+/// where text[p] == text[p - l], so each codepoint is compared O(1) times per
+/// `l` (O(n * max_repeat_substr_len) comparisons in total).
+/// A cut only moves the kept copies(at most l * repeat_threshold codepoints).
+///
+class RepeatShortener {
+ public:
+  // `runs` is a scratch buffer(its capacity is reused).
+  RepeatShortener(uint32_t repeat_threshold, uint32_t max_repeat_substr_len,
+                  std::vector<RepeatRun> &runs)
+      : threshold_(repeat_threshold),
+        max_len_(max_repeat_substr_len),
+        runs_(runs) {}
+
+  bool enabled() const { return (threshold_ > 0) && (max_len_ > 0); }
+
+  void reset() {
+    runs_.assign(size_t(max_len_) + 1, RepeatRun());
+    head_ = 0;
+    out_ = 0;
+    l_ = 0;
+    max_l_ = 0;
+  }
+
+  ///
+  /// Shorten `text` in place.
+  ///
+  void run(std::vector<uint32_t> &text) {
+    text.resize(run(text.data(), text.size()));
+  }
+
+  ///
+  /// Shorten text[0, len) in place. Returns the length of the result.
+  ///
+  size_t run(uint32_t *text, size_t len) {
+    return run(text, nullptr, len);
+  }
+
+  ///
+  /// Shorten text[0, len) in place, and move `offsets[i]`(any value
+  /// attached to text[i], e.g. its input offset) along with text[i].
+  /// `offsets` can be nullptr.
+  ///
+  size_t run(uint32_t *text, uint32_t *offsets, size_t len) {
+    if (!enabled()) {
+      return len;
+    }
+
+    reset();
+    offsets_ = offsets;
+    process(text, len, /* eof */true);
+    offsets_ = nullptr;
+    return out_;
+  }
+
+  ///
+  /// Process text[head(), end). Codepoints whose result is decided are moved
+  /// to text[0, out()).
+  /// When `eof` is false, text[end, ...) is not known yet and processing
+  /// stops where it is needed. Verified copies of a repeat which continues
+  /// beyond `end` are cut early, so the pending text stays bounded.
+  ///
+  void process(uint32_t *text, size_t end, bool eof) {
+    while (head_ < end) {
+      if (l_ == 0) {
+        // upper bound of repeat size = 1/2 of input text.
+        size_t remain = end - head_;
+        if (!eof && (remain < (2 * size_t(max_len_) + 2))) {
+          // the bound may still grow.
+          return;
+        }
+        size_t half = remain / 2;
+        max_l_ = (max_len_ < half) ? size_t(max_len_) : ((half > 0) ? half - 1 : 0);
+        l_ = 1;
+      }
+
+      for (; l_ <= max_l_; l_++) {
+        RepeatRun &r = runs_[l_];
+        while (!r.closed) {
+          size_t p = head_ + l_ + r.len;
+          if (p >= end) {
+            if (!eof) {
+              size_t num_verified = 1 + r.len / l_;
+              if (num_verified > (size_t(threshold_) + 1)) {
+                // keep the last verified copy to continue the comparison.
+                cut(text, l_, num_verified - 1);
+              }
+              return;
+            }
+            r.closed = true;
+          } else if (text[p] == text[p - l_]) {
+            r.len++;
+          } else {
+            r.closed = true;
+          }
+        }
+
+        size_t num_repeat = 1 + r.len / l_;
+        if (num_repeat > threshold_) {
+          cut(text, l_, num_repeat);
+        }
+      }
+
+      l_ = 0;
+      if (offsets_) {
+        offsets_[out_] = offsets_[head_];
+      }
+      text[out_++] = text[head_++];
+
+      for (size_t l = 1; l < runs_.size(); l++) {
+        RepeatRun &r = runs_[l];
+        if (r.len > 0) {
+          r.len--;
+        } else {
+          r.closed = false;
+        }
+      }
+    }
+  }
+
+  size_t head() const { return head_; }
+  size_t out() const { return out_; }
+
+  // The caller removed text[0, head()). Used in streaming mode.
+  void rebase() {
+    head_ = 0;
+    out_ = 0;
+  }
+
+ private:
+  // Cut copies [threshold, num_repeat) of text[head, head + l).
+  void cut(uint32_t *text, size_t l, size_t num_repeat) {
+    size_t keep = l * threshold_;
+    size_t removed = l * (num_repeat - threshold_);
+
+    std::copy_backward(text + head_, text + head_ + keep,
+                       text + head_ + keep + removed);
+    if (offsets_) {
+      std::copy_backward(offsets_ + head_, offsets_ + head_ + keep,
+                         offsets_ + head_ + keep + removed);
+    }
+    head_ += removed;
+
+    // Runs which reached the cut position must be rescanned from there.
+    for (size_t k = 1; k < runs_.size(); k++) {
+      RepeatRun &r = runs_[k];
+      if ((k + r.len) >= keep) {
+        r.len = (keep > k) ? (keep - k) : 0;
+        r.closed = false;
+      }
+    }
+  }
+
+  uint32_t threshold_;
+  uint32_t max_len_;
+  std::vector<RepeatRun> &runs_;
+
+  uint32_t *offsets_{nullptr};  // moved along with the text(optional).
+
+  size_t head_{0};   // start of the pending text.
+  size_t out_{0};    // end of the output.
+  size_t l_{0};      // next repeat length to check at `head_`(0: not started).
+  size_t max_l_{0};  // max repeat length at `head_`.
+};
+
+inline std::vector<uint32_t> shorten_repeat_codepoints(const std::vector<uint32_t> &u8_codepoints, uint32_t repeat_threshold, uint32_t max_repeat_substr_len=8) {
+
+  std::vector<uint32_t> text = u8_codepoints;
+  std::vector<RepeatRun> runs;
+  RepeatShortener(repeat_threshold, max_repeat_substr_len, runs).run(text);
+
+  return text;
+}
+
+inline std::string shorten_repeat(const std::string &text, uint32_t repeat_threshold, uint32_t max_repeat_substr_len=8) {
+
+  std::vector<uint32_t> codepoints = to_codepoints(text);
+
+  std::vector<RepeatRun> runs;
+  RepeatShortener(repeat_threshold, max_repeat_substr_len, runs).run(codepoints);
+
+  return codepoints_to_string(codepoints);
+}
+
+///
+/// Tells whether `RepeatShortener` would cut anything from a text, without
+/// keeping the text. Codepoints are pushed one by one; only the last
+/// `max_repeat_substr_len` of them are kept in a ring. The ring is inline up
+/// to `kInlineLen`, and in the caller's scratch buffers beyond it.
+///
+/// The first cut happens at `i` with length `l` when text[i, i + l *
+/// (threshold + 1)) has period `l` and at least 2 * l + 2 codepoints are
+/// left from `i`(the bound of `RepeatShortener::process()`).
+///
+class RepeatChecker {
+ public:
+  static constexpr uint32_t kInlineLen = 32;
+
+  // `ring` and `runs` are scratch buffers(their capacity is reused).
+  RepeatChecker(uint32_t repeat_threshold, uint32_t max_repeat_substr_len,
+                std::vector<uint32_t> &ring, std::vector<size_t> &runs)
+      : threshold_(repeat_threshold), max_len_(max_repeat_substr_len) {
+    if (enabled() && (max_len_ > kInlineLen)) {
+      size_t size = kInlineLen;
+      while (size < max_len_) {
+        size <<= 1;
+      }
+      ring.assign(size, 0);
+      runs.assign(size_t(max_len_) + 1, 0);
+      ring_ = ring.data();
+      run_ = runs.data();
+      mask_ = size - 1;
+    }
+  }
+
+  RepeatChecker(const RepeatChecker &) = delete;
+  RepeatChecker &operator=(const RepeatChecker &) = delete;
+
+  bool enabled() const { return (threshold_ > 0) && (max_len_ > 0); }
+
+  // Push the next codepoint. Returns true once a cut is certain.
+  bool push(uint32_t c) {
+    size_t max_l = (max_len_ < n_) ? size_t(max_len_) : n_;
+    for (size_t l = 1; l <= max_l; l++) {
+      if (ring_[(n_ - l) & mask_] != c) {
+        run_[l] = 0;
+      } else if (++run_[l] >= l * threshold_) {
+        size_t start = n_ + 1 - l * (size_t(threshold_) + 1);
+        need_ = (std::min)(need_, start + 2 * l + 2);
+      }
+    }
+    ring_[n_ & mask_] = c;
+    n_++;
+    return n_ >= need_;
+  }
+
+ private:
+  uint32_t threshold_;
+  uint32_t max_len_;
+  uint32_t inline_ring_[kInlineLen] = {};
+  size_t inline_run_[kInlineLen + 1] = {};
+  uint32_t *ring_{inline_ring_};
+  size_t *run_{inline_run_};  // text[p] == text[p - l] run ending at the last push.
+  size_t mask_{kInlineLen - 1};
+  size_t n_{0};
+  size_t need_{~size_t(0)};  // text length which confirms a cut.
+};
+
+
+inline uint32_t count_trailing_zeros(uint32_t x) {
+#if defined(_MSC_VER)
+  unsigned long idx;
+  _BitScanForward(&idx, x);
+  return uint32_t(idx);
+#else
+  return uint32_t(__builtin_ctz(x));
+#endif
+}
+
+// ASCII char which needs the per-char rules(space and tilde).
+// Other ASCII chars are passed through as is.
+inline bool is_ascii_stop(const uint8_t c) {
+  return (c >= 0x80) || (c == ' ') || (c == '~');
+}
+
+///
+/// Returns the first position in [s, end) which is not a plain ASCII char,
+/// i.e. a non-ASCII byte, ' ' or '~'.
+///
+inline const char *skip_ascii_run(const char *s, const char *end) {
+#if defined(JP_NORMALIZER_USE_AVX2)
+  {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tilde = _mm256_set1_epi8('~');
+    while ((end - s) >= 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+      // MSB of `v` is set for non-ASCII bytes.
+      __m256i m = _mm256_or_si256(v, _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                                     _mm256_cmpeq_epi8(v, tilde)));
+      uint32_t mask = uint32_t(_mm256_movemask_epi8(m));
+      if (mask) {
+        return s + count_trailing_zeros(mask);
+      }
+      s += 32;
+    }
+  }
+#endif
+#if defined(JP_NORMALIZER_USE_SSE2)
+  {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tilde = _mm_set1_epi8('~');
+    while ((end - s) >= 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      __m128i m = _mm_or_si128(v, _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                               _mm_cmpeq_epi8(v, tilde)));
+      uint32_t mask = uint32_t(_mm_movemask_epi8(m));
+      if (mask) {
+        return s + count_trailing_zeros(mask);
+      }
+      s += 16;
+    }
+  }
+#elif defined(JP_NORMALIZER_USE_NEON)
+  {
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tilde = vdupq_n_u8('~');
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    while ((end - s) >= 16) {
+      uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(s));
+      uint8x16_t m = vorrq_u8(vcgeq_u8(v, high),
+                              vorrq_u8(vceqq_u8(v, space), vceqq_u8(v, tilde)));
+      if (vmaxvq_u8(m)) {
+        break;  // find the exact position in the scalar loop below.
+      }
+      s += 16;
+    }
+  }
+#else
+  {
+    // SWAR: 8 bytes at a time.
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    while ((end - s) >= 8) {
+      uint64_t v;
+      memcpy(&v, s, 8);
+      uint64_t sp = v ^ (ones * uint64_t(' '));
+      uint64_t tl = v ^ (ones * uint64_t('~'));
+      // Nonzero when any byte is zero(i.e. equal to ' ' or '~') or has MSB.
+      uint64_t m = ((sp - ones) & ~sp) | ((tl - ones) & ~tl) | v;
+      if (m & highs) {
+        break;
+      }
+      s += 8;
+    }
+  }
+#endif
+
+  while ((s < end) && !is_ascii_stop(uint8_t(*s))) {
+    s++;
+  }
+
+  return s;
+}
+
+inline bool is_ascii_stop_unit(const uint32_t c) {
+  return (c >= 0x80) || (c == ' ') || (c == '~');
+}
+
+///
+/// `skip_ascii_run()` for UTF-16.
+///
+inline const char16_t *skip_ascii_run(const char16_t *s, const char16_t *end) {
+#if defined(JP_NORMALIZER_USE_SSE2)
+  {
+    const __m128i non_ascii = _mm_set1_epi16(short(0xff80));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i space = _mm_set1_epi16(' ');
+    const __m128i tilde = _mm_set1_epi16('~');
+    while ((end - s) >= 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, non_ascii), zero);
+      __m128i stop = _mm_or_si128(_mm_cmpeq_epi16(v, space),
+                                  _mm_cmpeq_epi16(v, tilde));
+      // 2 bits per unit.
+      uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_andnot_si128(stop, ascii))) ^ 0xffffu;
+      if (mask) {
+        return s + count_trailing_zeros(mask) / 2;
+      }
+      s += 8;
+    }
+  }
+#endif
+
+  while ((s < end) && !is_ascii_stop_unit(*s)) {
+    s++;
+  }
+
+  return s;
+}
+
+///
+/// `skip_ascii_run()` for UTF-32.
+///
+inline const char32_t *skip_ascii_run(const char32_t *s, const char32_t *end) {
+#if defined(JP_NORMALIZER_USE_SSE2)
+  {
+    const __m128i non_ascii = _mm_set1_epi32(int(0xffffff80u));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i space = _mm_set1_epi32(' ');
+    const __m128i tilde = _mm_set1_epi32('~');
+    while ((end - s) >= 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      __m128i ascii = _mm_cmpeq_epi32(_mm_and_si128(v, non_ascii), zero);
+      __m128i stop = _mm_or_si128(_mm_cmpeq_epi32(v, space),
+                                  _mm_cmpeq_epi32(v, tilde));
+      // 4 bits per unit.
+      uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_andnot_si128(stop, ascii))) ^ 0xffffu;
+      if (mask) {
+        return s + count_trailing_zeros(mask) / 4;
+      }
+      s += 4;
+    }
+  }
+#endif
+
+  while ((s < end) && !is_ascii_stop_unit(*s)) {
+    s++;
+  }
+
+  return s;
+}
+
+///
+/// Length of the well-formed UTF-8 char at `p`(`n` > 0 bytes available), or
+/// 0 when it is ill-formed. Then `bad_len` is the length of its maximal
+/// subpart(1 to 3 bytes, see Unicode 3.9 "U+FFFD Substitution of Maximal
+/// Subparts") and `truncated` is true when it is only cut by the end of the
+/// buffer. Overlongs, surrogates and codepoints over U+10FFFF are ill-formed.
+///
+inline uint32_t check_utf8_char(const uint8_t *p, size_t n, uint32_t &bad_len,
+                                bool &truncated) {
+  uint8_t c = p[0];
+  uint32_t len;
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xbf;
+  if (c < 0x80) {
+    return 1;
+  } else if ((c >= 0xc2) && (c <= 0xdf)) {
+    len = 2;
+  } else if ((c >= 0xe0) && (c <= 0xef)) {
+    len = 3;
+    if (c == 0xe0) {
+      lo = 0xa0;  // overlong
+    } else if (c == 0xed) {
+      hi = 0x9f;  // surrogate
+    }
+  } else if ((c >= 0xf0) && (c <= 0xf4)) {
+    len = 4;
+    if (c == 0xf0) {
+      lo = 0x90;  // overlong
+    } else if (c == 0xf4) {
+      hi = 0x8f;  // over U+10FFFF
+    }
+  } else {
+    bad_len = 1;
+    truncated = false;
+    return 0;
+  }
+
+  for (uint32_t k = 1; k < len; k++) {
+    if (k >= n) {
+      bad_len = k;
+      truncated = true;
+      return 0;
+    }
+    if ((p[k] < lo) || (p[k] > hi)) {
+      bad_len = k;
+      truncated = false;
+      return 0;
+    }
+    lo = 0x80;
+    hi = 0xbf;
+  }
+
+  return len;
+}
+
+// Returns the offset of the first ill-formed char in s[pos, len).
+inline size_t validate_utf8_scalar(const uint8_t *s, size_t pos, size_t len) {
+  while (pos < len) {
+    if ((len - pos) >= 8) {
+      uint64_t v;
+      memcpy(&v, s + pos, 8);
+      if ((v & 0x8080808080808080ull) == 0) {
+        pos += 8;
+        continue;
+      }
+    }
+
+    if (s[pos] < 0x80) {
+      pos++;
+      continue;
+    }
+
+    uint32_t bad_len;
+    bool truncated;
+    uint32_t n = check_utf8_char(s + pos, len - pos, bad_len, truncated);
+    if (n == 0) {
+      return pos;
+    }
+    pos += n;
+  }
+
+  return pos;
+}
+
+#if defined(JP_NORMALIZER_USE_SSSE3) || defined(JP_NORMALIZER_USE_NEON) || \
+    defined(JP_NORMALIZER_USE_AVX2_DISPATCH)
+//
+// Vectorized validation by the lookup algorithm of simdjson/simdutf
+// (J. Keiser, D. Lemire, "Validating UTF-8 In Less Than One Instruction Per
+// Byte", 2021).
+// Each byte is checked with the previous byte by 3 nibble lookups(the AND of
+// the error bits below), and the continuation bytes required by 3/4-byte
+// leads 2/3 bytes before are checked with saturated subtractions.
+//
+enum : uint8_t {
+  kUtf8TooShort = 1 << 0,   // 11______ 0_______ or 11______ 11______
+  kUtf8TooLong = 1 << 1,    // 0_______ 10______
+  kUtf8Overlong3 = 1 << 2,  // 11100000 100_____
+  kUtf8TooLarge = 1 << 3,   // 11110100 1001____ etc.
+  kUtf8Surrogate = 1 << 4,  // 11101101 101_____
+  kUtf8Overlong2 = 1 << 5,  // 1100000_ 10______
+  kUtf8TooLarge1000 = 1 << 6,  // 11110101 1000____ etc.
+  kUtf8Overlong4 = 1 << 6,  // 11110000 1000____
+  kUtf8TwoConts = 1 << 7,   // 10______ 10______
+  kUtf8Carry = kUtf8TooShort | kUtf8TooLong | kUtf8TwoConts,
+};
+
+// Indexed by the high nibble of the previous byte.
+static const uint8_t kUtf8Byte1High[16] = {
+    kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong,
+    kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong,
+    kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts,
+    kUtf8TooShort | kUtf8Overlong2,
+    kUtf8TooShort,
+    kUtf8TooShort | kUtf8Overlong3 | kUtf8Surrogate,
+    kUtf8TooShort | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Overlong4};
+
+// Indexed by the low nibble of the previous byte.
+static const uint8_t kUtf8Byte1Low[16] = {
+    kUtf8Carry | kUtf8Overlong3 | kUtf8Overlong2 | kUtf8Overlong4,
+    kUtf8Carry | kUtf8Overlong2,
+    kUtf8Carry,
+    kUtf8Carry,
+    kUtf8Carry | kUtf8TooLarge,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Surrogate,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000};
+
+// Indexed by the high nibble of the current byte.
+static const uint8_t kUtf8Byte2High[16] = {
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 |
+        kUtf8TooLarge1000 | kUtf8Overlong4,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 |
+        kUtf8TooLarge,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate |
+        kUtf8TooLarge,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate |
+        kUtf8TooLarge,
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort};
+
+// A block is incomplete when a char starting in its last 3 bytes continues
+// to the next block(bytes greater than these).
+static const uint8_t kUtf8IncompleteMax[16] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1};
+#endif
+
+#if defined(JP_NORMALIZER_USE_AVX2_DISPATCH)
+#define JP_NORMALIZER_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define JP_NORMALIZER_AVX2_TARGET
+#endif
+
+#if defined(JP_NORMALIZER_USE_AVX2) || defined(JP_NORMALIZER_USE_AVX2_DISPATCH)
+JP_NORMALIZER_AVX2_TARGET
+inline __m256i utf8_errors(__m256i input, __m256i prev_input) {
+  const __m256i byte_1_high_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte1High)));
+  const __m256i byte_1_low_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte1Low)));
+  const __m256i byte_2_high_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte2High)));
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+
+  // input shifted by 1/2/3 bytes, with the last bytes of `prev_input`.
+  __m256i prev = _mm256_permute2x128_si256(prev_input, input, 0x21);
+  __m256i prev1 = _mm256_alignr_epi8(input, prev, 15);
+  __m256i prev2 = _mm256_alignr_epi8(input, prev, 14);
+  __m256i prev3 = _mm256_alignr_epi8(input, prev, 13);
+
+  __m256i byte_1_high = _mm256_shuffle_epi8(
+      byte_1_high_table,
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+  __m256i byte_1_low = _mm256_shuffle_epi8(
+      byte_1_low_table, _mm256_and_si256(prev1, low_nibble));
+  __m256i byte_2_high = _mm256_shuffle_epi8(
+      byte_2_high_table,
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low),
+                                     byte_2_high);
+
+  // MSB is set where a continuation byte is required by a 3/4-byte lead.
+  __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xe0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xf0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                    _mm256_set1_epi8(char(0x80)));
+  return _mm256_xor_si256(must23, special);
+}
+
+// Returns the offset up to which s[0, len) is known to be valid(a multiple
+// of the block size, except for a char which may continue over it).
+JP_NORMALIZER_AVX2_TARGET
+inline size_t validate_utf8_avx2(const uint8_t *s, size_t len) {
+  const __m256i incomplete_max = _mm256_inserti128_si256(
+      _mm256_set1_epi8(char(0xff)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8IncompleteMax)),
+      1);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i prev = zero;
+  bool prev_incomplete = false;
+  size_t pos = 0;
+  while ((len - pos) >= 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + pos));
+    if (_mm256_movemask_epi8(v) == 0) {
+      // ASCII block. Only a char cut at the end of the previous block can
+      // be an error.
+      if (prev_incomplete) {
+        break;
+      }
+    } else {
+      __m256i err = utf8_errors(v, prev);
+      if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(err, zero)) != -1) {
+        break;
+      }
+      prev_incomplete =
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+              _mm256_subs_epu8(v, incomplete_max), zero)) != -1;
+    }
+    prev = v;
+    pos += 32;
+  }
+
+  return pos;
+}
+#endif
+
+#if defined(JP_NORMALIZER_USE_SSSE3)
+inline __m128i utf8_errors(__m128i input, __m128i prev_input) {
+  const __m128i byte_1_high_table =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte1High));
+  const __m128i byte_1_low_table =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte1Low));
+  const __m128i byte_2_high_table =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8Byte2High));
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+  __m128i byte_1_high = _mm_shuffle_epi8(
+      byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+  __m128i byte_1_low =
+      _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, low_nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(
+      byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+  __m128i special =
+      _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xe0 - 0x80)));
+  __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xf0 - 0x80)));
+  __m128i must23 =
+      _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(char(0x80)));
+  return _mm_xor_si128(must23, special);
+}
+
+inline size_t validate_utf8_ssse3(const uint8_t *s, size_t len) {
+  const __m128i incomplete_max =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8IncompleteMax));
+  const __m128i zero = _mm_setzero_si128();
+
+  __m128i prev = zero;
+  bool prev_incomplete = false;
+  size_t pos = 0;
+  while ((len - pos) >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + pos));
+    if (_mm_movemask_epi8(v) == 0) {
+      if (prev_incomplete) {
+        break;
+      }
+    } else {
+      __m128i err = utf8_errors(v, prev);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, zero)) != 0xffff) {
+        break;
+      }
+      prev_incomplete = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                            _mm_subs_epu8(v, incomplete_max), zero)) != 0xffff;
+    }
+    prev = v;
+    pos += 16;
+  }
+
+  return pos;
+}
+#elif defined(JP_NORMALIZER_USE_NEON)
+inline uint8x16_t utf8_errors(uint8x16_t input, uint8x16_t prev_input) {
+  const uint8x16_t byte_1_high_table = vld1q_u8(kUtf8Byte1High);
+  const uint8x16_t byte_1_low_table = vld1q_u8(kUtf8Byte1Low);
+  const uint8x16_t byte_2_high_table = vld1q_u8(kUtf8Byte2High);
+  const uint8x16_t low_nibble = vdupq_n_u8(0x0f);
+
+  uint8x16_t prev1 = vextq_u8(prev_input, input, 15);
+  uint8x16_t prev2 = vextq_u8(prev_input, input, 14);
+  uint8x16_t prev3 = vextq_u8(prev_input, input, 13);
+
+  uint8x16_t byte_1_high = vqtbl1q_u8(byte_1_high_table, vshrq_n_u8(prev1, 4));
+  uint8x16_t byte_1_low =
+      vqtbl1q_u8(byte_1_low_table, vandq_u8(prev1, low_nibble));
+  uint8x16_t byte_2_high = vqtbl1q_u8(byte_2_high_table, vshrq_n_u8(input, 4));
+  uint8x16_t special = vandq_u8(vandq_u8(byte_1_high, byte_1_low), byte_2_high);
+
+  uint8x16_t third = vqsubq_u8(prev2, vdupq_n_u8(0xe0 - 0x80));
+  uint8x16_t fourth = vqsubq_u8(prev3, vdupq_n_u8(0xf0 - 0x80));
+  uint8x16_t must23 = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+  return veorq_u8(must23, special);
+}
+
+inline size_t validate_utf8_neon(const uint8_t *s, size_t len) {
+  const uint8x16_t incomplete_max = vld1q_u8(kUtf8IncompleteMax);
+
+  uint8x16_t prev = vdupq_n_u8(0);
+  bool prev_incomplete = false;
+  size_t pos = 0;
+  while ((len - pos) >= 16) {
+    uint8x16_t v = vld1q_u8(s + pos);
+    if (vmaxvq_u8(v) < 0x80) {
+      if (prev_incomplete) {
+        break;
+      }
+    } else {
+      if (vmaxvq_u8(utf8_errors(v, prev))) {
+        break;
+      }
+      prev_incomplete = vmaxvq_u8(vqsubq_u8(v, incomplete_max)) != 0;
+    }
+    prev = v;
+    pos += 16;
+  }
+
+  return pos;
+}
+#endif
+
+///
+/// Length of the longest prefix of str[0, len) which is well-formed UTF-8
+/// (complete chars only), i.e. the offset of the first ill-formed char.
+/// Blocks are validated with SIMD, and the exact position of an error is
+/// found by the scalar loop from the char before the failing block.
+///
+inline size_t validate_utf8(const char *str, size_t len) {
+  const uint8_t *s = reinterpret_cast<const uint8_t *>(str);
+  size_t pos = 0;
+#if defined(JP_NORMALIZER_USE_AVX2)
+  pos = validate_utf8_avx2(s, len);
+#elif defined(JP_NORMALIZER_USE_AVX2_DISPATCH)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    pos = validate_utf8_avx2(s, len);
+  } else {
+#if defined(JP_NORMALIZER_USE_SSSE3)
+    pos = validate_utf8_ssse3(s, len);
+#endif
+  }
+#elif defined(JP_NORMALIZER_USE_SSSE3)
+  pos = validate_utf8_ssse3(s, len);
+#elif defined(JP_NORMALIZER_USE_NEON)
+  pos = validate_utf8_neon(s, len);
+#endif
+
+  // Restart from the lead of a char which may continue over `pos`.
+  for (size_t k = 1; (k <= 3) && (k <= pos); k++) {
+    uint8_t c = s[pos - k];
+    if ((c & 0xc0) != 0x80) {
+      if (c >= 0xc0) {
+        pos -= k;
+      }
+      break;
+    }
+  }
+
+  return validate_utf8_scalar(s, pos, len);
+}
+
+///
+/// `validate_utf8()` for UTF-16: the offset of the first lone surrogate(a
+/// high surrogate at the end of `s` is also counted).
+///
+inline size_t validate_utf16(const char16_t *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+#if defined(JP_NORMALIZER_USE_SSE2)
+    if ((len - i) >= 8) {
+      const __m128i mask = _mm_set1_epi16(short(0xf800));
+      const __m128i surrogate = _mm_set1_epi16(short(0xd800));
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask),
+                                            surrogate)) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+#endif
+    uint32_t c = s[i];
+    if ((c & 0xf800) != 0xd800) {
+      i++;
+    } else if ((c <= 0xdbff) && ((i + 1) < len) &&
+               ((s[i + 1] & 0xfc00) == 0xdc00)) {
+      i += 2;
+    } else {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+///
+/// `validate_utf8()` for UTF-32: the offset of the first surrogate or value
+/// over U+10FFFF.
+///
+inline size_t validate_utf32(const char32_t *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if ((s[i] > 0x10ffff) || ((s[i] & 0xfffff800) == 0xd800)) {
+      return i;
+    }
+  }
+  return len;
+}
+
+///
+/// Input encoding of the normalization core, selected by the code unit type:
+/// `char`(UTF-8), `char16_t`(UTF-16) or `char32_t`(UTF-32).
+///
+/// `valid_prefix()` returns the number of units of well-formed chars at the
+/// start of the text. Within it, `char_len()` returns the number of units of
+/// the char starting with the unit and `decode()` returns its codepoint
+/// without checks. At the end of it, `invalid_len()` returns the number of
+/// units of the ill-formed char(`truncated` when it is cut by the end of the
+/// text).
+///
+template <class Unit>
+struct InputTraits;
+
+template <>
+struct InputTraits<char> {
+  static constexpr bool kUtf8 = true;
+
+  static bool is_stop(char c) { return is_ascii_stop(uint8_t(c)); }
+  static size_t valid_prefix(const char *s, size_t n) {
+    return validate_utf8(s, n);
+  }
+  static uint32_t char_len(char c) { return utf8_len(uint8_t(c)); }
+  static uint32_t decode(const char *s, uint32_t len) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(s);
+    if (len == 2) {
+      return (uint32_t(p[0] & 0x1f) << 6) | uint32_t(p[1] & 0x3f);
+    } else if (len == 3) {
+      return (uint32_t(p[0] & 0xf) << 12) | (uint32_t(p[1] & 0x3f) << 6) |
+             uint32_t(p[2] & 0x3f);
+    } else if (len == 4) {
+      return (uint32_t(p[0] & 0x7) << 18) | (uint32_t(p[1] & 0x3f) << 12) |
+             (uint32_t(p[2] & 0x3f) << 6) | uint32_t(p[3] & 0x3f);
+    }
+    return uint32_t(p[0]);
+  }
+  static uint32_t invalid_len(const char *s, size_t n, bool &truncated) {
+    uint32_t bad_len = 1;
+    truncated = false;
+    check_utf8_char(reinterpret_cast<const uint8_t *>(s), n, bad_len,
+                    truncated);
+    return bad_len;
+  }
+};
+
+template <>
+struct InputTraits<char16_t> {
+  static constexpr bool kUtf8 = false;
+
+  static bool is_stop(char16_t c) { return is_ascii_stop_unit(c); }
+  static size_t valid_prefix(const char16_t *s, size_t n) {
+    return validate_utf16(s, n);
+  }
+  static uint32_t char_len(char16_t c) {
+    return ((c & 0xfc00) == 0xd800) ? 2 : 1;
+  }
+  static uint32_t decode(const char16_t *s, uint32_t len) {
+    if (len == 2) {
+      return 0x10000 + ((uint32_t(s[0]) - 0xd800) << 10) +
+             (uint32_t(s[1]) - 0xdc00);
+    }
+    return uint32_t(s[0]);
+  }
+  // Lone surrogate.
+  static uint32_t invalid_len(const char16_t *s, size_t n, bool &truncated) {
+    truncated = (n == 1) && ((s[0] & 0xfc00) == 0xd800);
+    return 1;
+  }
+};
+
+template <>
+struct InputTraits<char32_t> {
+  static constexpr bool kUtf8 = false;
+
+  static bool is_stop(char32_t c) { return is_ascii_stop_unit(c); }
+  static size_t valid_prefix(const char32_t *s, size_t n) {
+    return validate_utf32(s, n);
+  }
+  static uint32_t char_len(char32_t c) {
+    (void)c;
+    return 1;
+  }
+  static uint32_t decode(const char32_t *s, uint32_t len) {
+    (void)len;
+    return uint32_t(s[0]);
+  }
+  static uint32_t invalid_len(const char32_t *s, size_t n, bool &truncated) {
+    (void)s;
+    (void)n;
+    truncated = false;
+    return 1;
+  }
+};
+
+///
+/// UTF-8 output buffer of `normalize_core()`.
+/// Normalized text is written through a raw pointer; the string is grown
+/// geometrically only when an expanding rule(e.g. parenthesized ideographs)
+/// runs out of the reserved room.
+///
+class Utf8Writer {
+ public:
+  explicit Utf8Writer(std::string &dst) : dst_(dst) {}
+
+  // Append to dst[0, base) instead of overwriting `dst`.
+  // Not for the streaming mode(`flush()`).
+  Utf8Writer(std::string &dst, size_t base) : dst_(dst), base_(base) {}
+
+  void reset(size_t reserve_bytes) {
+    dst_.resize(base_ + reserve_bytes + kMaxSlot);
+    buf_ = &dst_[base_];
+    cap_ = dst_.size() - base_;
+    pos_ = 0;
+    last_ = 0;
+    flushed_ = 0;
+  }
+
+  // Total bytes written(including flushed ones).
+  size_t size() const { return flushed_ + pos_; }
+
+  // Append a slot(normalized output of one input char).
+  // `code` is the codepoint of `s` when it is a single well-formed char.
+  void put(const char *s, size_t len, uint32_t code) {
+    (void)code;
+    if ((pos_ + len + kMaxSlot) > cap_) {
+      grow(len);
+    }
+    last_ = pos_;
+    for (size_t i = 0; i < len; i++) {
+      buf_[pos_ + i] = s[i];
+    }
+    pos_ += len;
+  }
+
+  void put(char c) {
+    if ((pos_ + 1 + kMaxSlot) > cap_) {
+      grow(1);
+    }
+    last_ = pos_;
+    buf_[pos_++] = c;
+  }
+
+  // Append a run of ASCII chars. Each byte is a slot, so the last slot is
+  // the last byte of the run.
+  void put_ascii_run(const char *s, size_t len) {
+    if ((pos_ + len + kMaxSlot) > cap_) {
+      grow(len);
+    }
+    memcpy(buf_ + pos_, s, len);
+    pos_ += len;
+    last_ = pos_ - 1;
+  }
+
+  // Remove the last slot.
+  void rewind() { pos_ = last_; }
+
+  // Input offset of the next slot. Only used by `OffsetMapWriter`.
+  void map_input(size_t) {}
+
+  bool last_is_space() const {
+    return (pos_ == last_ + 1) && (buf_[last_] == ' ');
+  }
+
+  void finish() { dst_.resize(base_ + pos_); }
+
+  void clear() { dst_.resize(base_); }
+
+  // Append the final part(everything but the last slot) to `out` and drop it
+  // from the buffer. Used in streaming mode.
+  void flush(std::string &out) {
+    out.append(buf_, last_);
+    memmove(buf_, buf_ + last_, pos_ - last_);
+    flushed_ += last_;
+    pos_ -= last_;
+    last_ = 0;
+  }
+
+  // Append everything to `out`.
+  void flush_all(std::string &out) {
+    out.append(buf_, pos_);
+    flushed_ += pos_;
+    pos_ = 0;
+    last_ = 0;
+  }
+
+ private:
+  static constexpr size_t kMaxSlot = 8;
+
+  void grow(size_t len) {
+    dst_.resize((std::max)(dst_.size() * 2, base_ + pos_ + len + kMaxSlot));
+    buf_ = &dst_[base_];
+    cap_ = dst_.size() - base_;
+  }
+
+  std::string &dst_;
+  size_t base_{0};
+  char *buf_{nullptr};
+  size_t cap_{0};
+  size_t pos_{0};
+  size_t last_{0};  // start of the last slot.
+  size_t flushed_{0};
+};
+
+///
+/// UTF-8 output buffer of `normalize_core()` over caller memory. It never
+/// grows: the buffer must hold `normalize_bound()` of the input. A slot is at
+/// most `kMaxUtf8Growth` bytes per input byte and `rewind()` only shrinks the
+/// output, so no intermediate state exceeds that.
+///
+class BufferWriter {
+ public:
+  explicit BufferWriter(char *buf) : buf_(buf) {}
+
+  void reset(size_t) {
+    pos_ = 0;
+    last_ = 0;
+  }
+
+  size_t size() const { return pos_; }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    (void)code;
+    last_ = pos_;
+    for (size_t i = 0; i < len; i++) {
+      buf_[pos_ + i] = s[i];
+    }
+    pos_ += len;
+  }
+
+  void put(char c) {
+    last_ = pos_;
+    buf_[pos_++] = c;
+  }
+
+  void put_ascii_run(const char *s, size_t len) {
+    memcpy(buf_ + pos_, s, len);
+    pos_ += len;
+    last_ = pos_ - 1;
+  }
+
+  void rewind() { pos_ = last_; }
+
+  void map_input(size_t) {}
+
+  bool last_is_space() const {
+    return (pos_ == last_ + 1) && (buf_[last_] == ' ');
+  }
+
+  void finish() {}
+
+  void clear() { reset(0); }
+
+ private:
+  char *buf_;
+  size_t pos_{0};
+  size_t last_{0};  // start of the last slot.
+};
+
+///
+/// Codepoint output buffer of `normalize_core()`.
+/// Used when the result is fed to `RepeatShortener`, so that the normalized
+/// text does not need to be decoded again.
+///
+class CodepointWriter {
+ public:
+  explicit CodepointWriter(std::vector<uint32_t> &dst) : dst_(dst) {}
+
+  void reset(size_t reserve_codes) {
+    dst_.clear();
+    dst_.reserve(reserve_codes);
+    last_ = 0;
+    shifted_ = 0;
+  }
+
+  // Total codepoints written(including shifted out ones).
+  size_t size() const { return shifted_ + dst_.size(); }
+
+  // Start of the last slot. Codepoints before it are final.
+  size_t last_start() const { return last_; }
+
+  // The caller removed the first `n`(<= `last_start()`) codepoints of the
+  // buffer. Used in streaming mode.
+  void shift(size_t n) {
+    last_ -= n;
+    shifted_ += n;
+  }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    last_ = dst_.size();
+    if (code != ~0u) {
+      dst_.push_back(code);
+    } else {
+      // multi-char replacement or malformed char.
+      append_codepoints(s, len, dst_);
+    }
+  }
+
+  void put(char c) {
+    last_ = dst_.size();
+    dst_.push_back(uint8_t(c));
+  }
+
+  template <class Unit>
+  void put_ascii_run(const Unit *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      dst_.push_back(uint32_t(s[i]));
+    }
+    last_ = dst_.size() - 1;
+  }
+
+  void rewind() { dst_.resize(last_); }
+
+  void map_input(size_t) {}
+
+  bool last_is_space() const {
+    return (dst_.size() == last_ + 1) && (dst_[last_] == ' ');
+  }
+
+  void finish() {}
+
+  void clear() { dst_.clear(); }
+
+ private:
+  std::vector<uint32_t> &dst_;
+  size_t last_{0};  // start of the last slot.
+  size_t shifted_{0};
+};
+
+///
+/// UTF-16/UTF-32 output buffer of `normalize_core()`.
+/// Same as `Utf8Writer`, but each slot is encoded from its codepoint.
+///
+template <class Unit>
+class UnitWriter {
+ public:
+  explicit UnitWriter(std::basic_string<Unit> &dst) : dst_(dst) {}
+
+  void reset(size_t reserve_units) {
+    dst_.resize(reserve_units + kMaxSlot);
+    buf_ = &dst_[0];
+    cap_ = dst_.size();
+    pos_ = 0;
+    last_ = 0;
+  }
+
+  size_t size() const { return pos_; }
+
+  // `s` is only used for a multi-char replacement(`code` is ~0u), which is
+  // well-formed UTF-8.
+  void put(const char *s, size_t len, uint32_t code) {
+    if ((pos_ + len + kMaxSlot) > cap_) {
+      grow(len);
+    }
+    last_ = pos_;
+    if (code != ~0u) {
+      pos_ += encode_units(code, buf_ + pos_);
+      return;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+      uint32_t n = utf8_len(uint8_t(s[i]));
+      if ((n == 0) || ((i + n) > len)) {
+        break;
+      }
+      pos_ += encode_units(decode_utf8(s + i, n), buf_ + pos_);
+      i += n;
+    }
+  }
+
+  void put(char c) {
+    if ((pos_ + 1 + kMaxSlot) > cap_) {
+      grow(1);
+    }
+    last_ = pos_;
+    buf_[pos_++] = Unit(c);
+  }
+
+  void put_ascii_run(const Unit *s, size_t len) {
+    if ((pos_ + len + kMaxSlot) > cap_) {
+      grow(len);
+    }
+    memcpy(buf_ + pos_, s, len * sizeof(Unit));
+    pos_ += len;
+    last_ = pos_ - 1;
+  }
+
+  void rewind() { pos_ = last_; }
+
+  void map_input(size_t) {}
+
+  bool last_is_space() const {
+    return (pos_ == last_ + 1) && (buf_[last_] == Unit(' '));
+  }
+
+  void finish() { dst_.resize(pos_); }
+
+  void clear() { dst_.clear(); }
+
+ private:
+  static constexpr size_t kMaxSlot = 8;
+
+  void grow(size_t len) {
+    dst_.resize((std::max)(dst_.size() * 2, pos_ + len + kMaxSlot));
+    buf_ = &dst_[0];
+    cap_ = dst_.size();
+  }
+
+  std::basic_string<Unit> &dst_;
+  Unit *buf_{nullptr};
+  size_t cap_{0};
+  size_t pos_{0};
+  size_t last_{0};  // start of the last slot.
+};
+
+// Output buffer of `normalize_core()` for each code unit type.
+template <class Unit>
+struct WriterOf {
+  typedef UnitWriter<Unit> type;
+};
+
+template <>
+struct WriterOf<char> {
+  typedef Utf8Writer type;
+};
+
+///
+/// `Writer`(`Utf8Writer` or `UnitWriter`) which also builds the
+/// output-to-input offset map. The core tells the input offset of each slot
+/// with `map_input()` before writing it. A new entry is added only when the
+/// slot does not continue the last segment one to one.
+///
+template <class Writer>
+class OffsetMapWriter {
+ public:
+  OffsetMapWriter(Writer &out, OffsetMap &map) : out_(out), map_(map) {}
+
+  void reset(size_t reserve) {
+    out_.reset(reserve);
+    map_.clear();
+  }
+
+  size_t size() const { return out_.size(); }
+
+  void map_input(size_t pos) { in_ = pos; }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    add();
+    out_.put(s, len, code);
+  }
+
+  void put(char c) {
+    add();
+    out_.put(c);
+  }
+
+  template <class Unit>
+  void put_ascii_run(const Unit *s, size_t len) {
+    add();
+    out_.put_ascii_run(s, len);
+  }
+
+  void rewind() {
+    out_.rewind();
+    while (!map_.empty() && (map_.back().output >= out_.size())) {
+      map_.pop_back();
+    }
+  }
+
+  bool last_is_space() const { return out_.last_is_space(); }
+
+  void finish() { out_.finish(); }
+
+  void clear() {
+    out_.clear();
+    map_.clear();
+  }
+
+ private:
+  void add() {
+    size_t pos = out_.size();
+    if (!map_.empty() &&
+        ((pos - map_.back().output) == (in_ - map_.back().input))) {
+      return;
+    }
+    map_.push_back({uint32_t(pos), uint32_t(in_)});
+  }
+
+  Writer &out_;
+  OffsetMap &map_;
+  size_t in_{0};
+};
+
+// Marks a codepoint which belongs to the same slot as the previous one
+// (e.g. "株)" of "(株)") in the offsets of `CodepointOffsetWriter`.
+static constexpr uint32_t kSameSlot = ~0u;
+
+///
+/// `CodepointWriter` which also records the input offset of each codepoint,
+/// so that the offsets can be moved along by `RepeatShortener`.
+///
+class CodepointOffsetWriter {
+ public:
+  CodepointOffsetWriter(CodepointWriter &out, std::vector<uint32_t> &offsets)
+      : out_(out), offsets_(offsets) {}
+
+  void reset(size_t reserve_codes) {
+    out_.reset(reserve_codes);
+    offsets_.clear();
+    offsets_.reserve(reserve_codes);
+  }
+
+  size_t size() const { return out_.size(); }
+
+  void map_input(size_t pos) { in_ = pos; }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    out_.put(s, len, code);
+    offsets_.push_back(uint32_t(in_));
+    offsets_.resize(out_.size(), kSameSlot);
+  }
+
+  void put(char c) {
+    out_.put(c);
+    offsets_.push_back(uint32_t(in_));
+  }
+
+  template <class Unit>
+  void put_ascii_run(const Unit *s, size_t len) {
+    out_.put_ascii_run(s, len);
+    for (size_t i = 0; i < len; i++) {
+      offsets_.push_back(uint32_t(in_ + i));
+    }
+  }
+
+  void rewind() {
+    out_.rewind();
+    offsets_.resize(out_.size());
+  }
+
+  bool last_is_space() const { return out_.last_is_space(); }
+
+  void finish() { out_.finish(); }
+
+  void clear() {
+    out_.clear();
+    offsets_.clear();
+  }
+
+ private:
+  CodepointWriter &out_;
+  std::vector<uint32_t> &offsets_;
+  size_t in_{0};
+};
+
+///
+/// Output "buffer" of `is_normalized()`. Nothing is written: each slot is
+/// compared with the input at the same offset, and only whether the output
+/// has diverged from the input is kept. While it has not, the codepoints are
+/// also fed to `RepeatChecker`.
+///
+template <class Unit>
+class CheckWriter {
+ public:
+  CheckWriter(const Unit *in, size_t len, RepeatChecker &repeat)
+      : in_(in), len_(len), repeat_(repeat), check_repeat_(repeat.enabled()) {}
+
+  bool changed() const { return changed_; }
+
+  size_t size() const { return pos_; }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    if (changed_) {
+      return;
+    }
+    if (code == ~0u) {
+      // a multi-char replacement never equals the char it replaces.
+      changed_ = true;
+      return;
+    }
+    if (InputTraits<Unit>::kUtf8 &&
+        (s == reinterpret_cast<const char *>(in_ + pos_))) {
+      // the input char itself.
+      pos_ += len;
+    } else {
+      Unit buf[4];
+      size_t n = encode_units(code, buf);
+      match(buf, n);
+    }
+    push(code);
+    last_space_ = false;
+  }
+
+  void put(char c) {
+    if (changed_) {
+      return;
+    }
+    Unit u = Unit(c);
+    match(&u, 1);
+    push(uint8_t(c));
+    last_space_ = (c == ' ');
+  }
+
+  void put_ascii_run(const Unit *s, size_t len) {
+    if (changed_) {
+      return;
+    }
+    // The run is copied from the input, so it matches when it is at the
+    // same offset.
+    if (s != (in_ + pos_)) {
+      match(s, len);
+    } else {
+      pos_ += len;
+    }
+    for (size_t i = 0; check_repeat_ && (i < len); i++) {
+      push(uint32_t(s[i]));
+    }
+    last_space_ = (s[len - 1] == Unit(' '));
+  }
+
+  // A rewind removes or replaces a slot which matched the input.
+  void rewind() { changed_ = true; }
+
+  void map_input(size_t) {}
+
+  bool last_is_space() const { return !changed_ && last_space_; }
+
+ private:
+  void match(const Unit *u, size_t n) {
+    if (((pos_ + n) > len_) || (memcmp(in_ + pos_, u, n * sizeof(Unit)) != 0)) {
+      changed_ = true;
+      return;
+    }
+    pos_ += n;
+  }
+
+  void push(uint32_t c) {
+    if (check_repeat_ && repeat_.push(c)) {
+      changed_ = true;
+    }
+  }
+
+  const Unit *in_;
+  size_t len_;
+  RepeatChecker &repeat_;
+  bool check_repeat_;
+  size_t pos_{0};
+  bool changed_{false};
+  bool last_space_{false};
+};
+
+///
+/// UTF-8 output buffer of `normalize_core()` which writes the result over
+/// its own input. The write position trails the read position: a slot is
+/// written in place when it ends before the unread input, otherwise it goes
+/// to `spill`(only after an expanding rule). Spilled bytes are moved back
+/// into the text as more input is consumed.
+///
+class InplaceWriter {
+ public:
+  // `valid_end` is `find_invalid_utf8()` of buf[0, len).
+  InplaceWriter(char *buf, size_t len, size_t valid_end, std::string &spill)
+      : buf_(buf), len_(len), valid_end_(valid_end), spill_(spill) {}
+
+  void reset(size_t) {
+    pos_ = 0;
+    last_ = 0;
+    written_ = 0;
+    consumed_ = 0;
+    cur_ = 0;
+    spill_.clear();
+    head_ = 0;
+  }
+
+  // Bytes written in place and spilled.
+  size_t size() const { return pos_ + (spill_.size() - head_); }
+
+  // Bytes written in place. The rest are in `spill()`.
+  size_t inplace_size() const { return pos_; }
+  const char *spill() const { return spill_.data() + head_; }
+
+  // Called before each slot with the input offset of its char, so
+  // input[0, pos) is consumed.
+  void map_input(size_t pos) {
+    cur_ = pos;
+    if (pos > consumed_) {
+      consumed_ = pos;
+      if (head_ < spill_.size()) {
+        drain(consumed_);
+      }
+    }
+  }
+
+  void put(const char *s, size_t len, uint32_t code) {
+    (void)code;
+    last_ = size();
+    if ((head_ < spill_.size()) ||
+        (!in_input(s) && ((pos_ + len) > safe_end()))) {
+      spill_.append(s, len);
+      return;
+    }
+    // A slot copied from the input starts at or after `pos_`.
+    memmove(buf_ + pos_, s, len);
+    pos_ += len;
+    written_ = (std::max)(written_, pos_);
+  }
+
+  void put(char c) { put(&c, 1, uint8_t(c)); }
+
+  void put_ascii_run(const char *s, size_t len) {
+    put(s, len, ~0u);
+    last_ = size() - 1;
+  }
+
+  void rewind() {
+    if (last_ >= pos_) {
+      spill_.resize(head_ + (last_ - pos_));
+    } else {
+      pos_ = last_;
+      spill_.resize(head_);
+    }
+  }
+
+  bool last_is_space() const {
+    if (size() != (last_ + 1)) {
+      return false;
+    }
+    return ((last_ < pos_) ? buf_[last_] : spill_[head_ + (last_ - pos_)]) == ' ';
+  }
+
+  // All input is consumed: move spilled bytes into buf[0, capacity).
+  void finish(size_t capacity) { drain(capacity); }
+
+  void finish() {}
+
+  void clear() { reset(0); }
+
+ private:
+  bool in_input(const char *s) const {
+    return (uintptr_t(s) >= uintptr_t(buf_)) && (uintptr_t(s) < uintptr_t(buf_ + len_));
+  }
+
+  // End of the char at `cur_`, which is consumed when its slot is put.
+  size_t safe_end() const {
+    if (cur_ < written_) {
+      // The previous slot is replaced(e.g. merged kana). It was written
+      // before the input consumed at that time.
+      return written_;
+    }
+    if (cur_ < valid_end_) {
+      return cur_ + utf8_len(uint8_t(buf_[cur_]));
+    }
+    return cur_ + 1;  // an ill-formed subpart is at least 1 byte.
+  }
+
+  void drain(size_t limit) {
+    if (limit <= pos_) {
+      return;
+    }
+    size_t n = (std::min)(spill_.size() - head_, limit - pos_);
+    memcpy(buf_ + pos_, spill_.data() + head_, n);
+    pos_ += n;
+    head_ += n;
+    written_ = (std::max)(written_, pos_);
+    if (head_ == spill_.size()) {
+      spill_.clear();
+      head_ = 0;
+    }
+  }
+
+  char *buf_;
+  size_t len_;
+  size_t valid_end_;
+  std::string &spill_;
+  size_t head_{0};      // start of the spilled bytes not moved yet.
+  size_t pos_{0};       // end of the output written in place.
+  size_t last_{0};      // start of the last slot.
+  size_t written_{0};   // max end of the output written in place.
+  size_t consumed_{0};  // input[0, consumed_) is consumed.
+  size_t cur_{0};       // input offset of the current slot.
+};
+
+///
+/// Shorten repeats of the UTF-8 text buf[0, len) in place. Returns the length
+/// of the result. Codepoints are decoded block by block into `codes`, so
+/// the scratch memory does not grow with the text.
+///
+inline size_t shorten_repeat_inplace(char *buf, size_t len,
+                                     RepeatShortener &shortener,
+                                     std::vector<uint32_t> &codes) {
+  const size_t kBlockSize = 4096;
+
+  shortener.reset();
+  codes.clear();
+  size_t read = 0;
+  size_t write = 0;
+  for (;;) {
+    for (size_t n = 0; (n < kBlockSize) && (read < len); n++) {
+      uint32_t char_len = 0;
+      codes.push_back(to_codepoint(buf + read, char_len));
+      read += (std::max)(char_len, 1u);
+    }
+    bool eof = (read >= len);
+    shortener.process(codes.data(), codes.size(), eof);
+
+    // Shortening only removes chars, so the output stays behind `read`.
+    for (size_t i = 0; i < shortener.out(); i++) {
+      write += encode_utf8(codes[i], buf + write);
+    }
+    codes.erase(codes.begin(), codes.begin() + std::ptrdiff_t(shortener.head()));
+    shortener.rebase();
+    if (eof) {
+      return write;
+    }
+  }
+}
+
+///
+/// Encode `codes` into `dst` and build the offset map from the input offset
+/// of each codepoint(see `CodepointOffsetWriter`).
+///
+template <class Unit>
+inline void codepoints_to_units(const uint32_t *codes, const uint32_t *offsets,
+                                size_t n, size_t input_len,
+                                std::basic_string<Unit> &dst, OffsetMap &map) {
+  map.clear();
+  dst.resize(n * (4 / sizeof(Unit)));
+  Unit *buf = &dst[0];
+  size_t pos = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (map.empty()) {
+      // A cut may leave a `kSameSlot` codepoint at the beginning.
+      map.push_back({0, (offsets[i] != kSameSlot) ? offsets[i] : 0});
+    } else if ((offsets[i] != kSameSlot) &&
+               ((pos - map.back().output) != (offsets[i] - map.back().input))) {
+      map.push_back({uint32_t(pos), offsets[i]});
+    }
+    pos += encode_units(codes[i], buf + pos);
+  }
+  dst.resize(pos);
+  map.push_back({uint32_t(pos), uint32_t(input_len)});
+}
+
+///
+/// Counter sinks of the normalization core. `NoStats` compiles the counting
+/// out, `StatsSink` adds to a `NormalizationStats`.
+///
+struct NoStats {
+  void count(uint64_t NormalizationStats::*counter, uint64_t n = 1) {
+    (void)counter;
+    (void)n;
+  }
+};
+
+struct StatsSink {
+  explicit StatsSink(NormalizationStats &stats) : stats_(&stats) {}
+
+  void count(uint64_t NormalizationStats::*counter, uint64_t n = 1) {
+    stats_->*counter += n;
+  }
+
+ private:
+  NormalizationStats *stats_;
+};
+
+///
+/// State of the normalization core carried from char to char
+/// (and from chunk to chunk in `StreamNormalizer`).
+///
+struct CoreState {
+  // The previous output char(`prev_c` in neologdn).
+  // `prev_code` is the `utf8_code()` of it(~0u for multi-char or empty output)
+  // and `prev_exact` is true only when it is a well-formed single char.
+  uint32_t prev_code{~0u};
+  bool prev_exact{false};
+  bool latin_space{false};
+
+  // An invalid char was seen(`InvalidCharMode::Stop`). The rest of the text
+  // is ignored.
+  bool stopped{false};
+  // Internal error. The result must be discarded.
+  bool failed{false};
+};
+
+///
+/// Single-pass normalization core.
+/// Scans chars in `str` once and writes the result through `out`
+/// (`Utf8Writer`, `UnitWriter` or `CodepointWriter`). Only the last slot of
+/// `out` is modified afterwards(rewind), so anything before it is final.
+///
+/// `str` is UTF-8, UTF-16 or UTF-32 depending on `Unit`(see `InputTraits`).
+/// Returns the number of units consumed. When `eof` is false, an incomplete
+/// char at the end of `str` is left unconsumed. Ill-formed chars are handled
+/// by `invalid`.
+///
+/// Options are given as a `StaticNormalizationOption`, so the rules they
+/// disable are compiled out. See `normalize_chars()` for runtime options.
+/// Fired rules are counted through `stats`(`NoStats` or `StatsSink`).
+///
+template <class Opts, class Unit, class Writer, class Stats = NoStats>
+inline size_t normalize_chars_fixed(const Unit *str, size_t str_len, bool eof,
+                                    NormalizationOption::InvalidCharMode invalid,
+                                    CoreState &state, Writer &out,
+                                    Stats stats = Stats()) {
+  typedef InputTraits<Unit> Input;
+
+  if (state.stopped) {
+    return str_len;
+  }
+
+  const RuleTable &table = get_rule_table();
+
+  uint32_t prev_code = state.prev_code;
+  bool prev_exact = state.prev_exact;
+  bool latin_space = state.latin_space;
+
+  // Input offset of the last slot(for `out.map_input()`).
+  size_t slot_in = 0;
+
+  // Chars before this are well-formed.
+  size_t valid_end = Input::valid_prefix(str, str_len);
+
+  char buf[4];
+
+  size_t i = 0;
+  while (i < str_len) {
+    if (!Input::is_stop(str[i])) {
+      // Fast path: plain ASCII chars have no rule.
+      // Only `latin_space` and the previous char need to be updated.
+      const Unit *run_end = skip_ascii_run(str + i, str + str_len);
+      size_t run_len = size_t(run_end - (str + i));
+      out.map_input(i);
+      out.put_ascii_run(str + i, run_len);
+      i += run_len;
+      slot_in = i - 1;
+      stats.count(&NormalizationStats::chars, run_len);
+      stats.count(&NormalizationStats::ascii_fast_path, run_len);
+
+      latin_space = false;
+      prev_code = uint32_t(str[i - 1]);
+      prev_exact = true;
+      continue;
+    }
+
+    const size_t c_pos = i;
+    // Output of this char. UTF-16/UTF-32 input is output by `s_code`
+    // (never ~0u).
+    const char *s;
+    size_t s_len;
+    uint32_t code;
+    if (i < valid_end) {
+      uint32_t len = Input::char_len(str[i]);
+      code = Input::decode(str + i, len);
+      s = Input::kUtf8 ? reinterpret_cast<const char *>(str + i) : nullptr;
+      s_len = Input::kUtf8 ? len : 0;
+      i += len;
+      stats.count(&NormalizationStats::chars);
+    } else {
+      bool truncated;
+      uint32_t bad_len = Input::invalid_len(str + i, str_len - i, truncated);
+      if (truncated && !eof) {
+        // incomplete char. wait for the next chunk.
+        break;
+      }
+      stats.count(&NormalizationStats::invalid_sequences);
+      stats.count(&NormalizationStats::invalid_units, bad_len);
+
+      if (invalid == NormalizationOption::InvalidCharMode::Stop) {
+        state.stopped = true;
+        i = str_len;
+        break;
+      }
+
+      i += bad_len;
+      valid_end = i + Input::valid_prefix(str + i, str_len - i);
+      if (invalid == NormalizationOption::InvalidCharMode::Skip) {
+        continue;
+      }
+
+      // U+FFFD has no rule.
+      code = 0xfffd;
+      s = "\xef\xbf\xbd";
+      s_len = 3;
+    }
+
+    const RuleEntry &rule = table.lookup(code);
+
+    if (rule.kind == RuleKind::Space) {
+      if (((prev_exact && (prev_code == ' ')) || is_cjk_code(prev_code)) &&
+          Opts::remove_space) {
+        stats.count(&NormalizationStats::spaces_removed);
+        continue;
+      } else if (!(prev_exact && (prev_code == '*')) && (out.size() > 0) &&
+                 (prev_code < 128)) {
+        latin_space = true;
+        out.map_input(c_pos);
+        out.put(' ');
+        slot_in = c_pos;
+      } else if (Opts::remove_space) {
+        // drop
+        stats.count(&NormalizationStats::spaces_removed);
+      } else {
+        out.map_input(c_pos);
+        out.put(' ');
+        slot_in = c_pos;
+      }
+
+      prev_code = ' ';
+      prev_exact = true;
+      continue;
+    }
+
+    uint32_t s_code = code;
+
+    if (rule.kind == RuleKind::Hyphen) {
+      if (prev_exact && (prev_code == '-')) {
+        stats.count(&NormalizationStats::hyphens_collapsed);
+        continue;
+      }
+      stats.count(&NormalizationStats::hyphens);
+      s = "-";
+      s_len = 1;
+      s_code = '-';
+    } else if (rule.kind == RuleKind::Choonpu) {
+      if (prev_exact && (prev_code == 0x30fc)) {  // 'ー'(zenkaku)
+        stats.count(&NormalizationStats::choonpu_collapsed);
+        continue;
+      }
+      stats.count(&NormalizationStats::choonpu);
+      s = "\xe3\x83\xbc";  // 'ー'
+      s_len = 3;
+      s_code = 0x30fc;
+    } else if (rule.kind == RuleKind::Tilde) {
+      if (Opts::tilde == NormalizationOption::TildeMode::Ignore) {
+        // pass
+      } else if (Opts::tilde == NormalizationOption::TildeMode::Normalize) {
+        stats.count(&NormalizationStats::tildes_replaced);
+        s = "~";
+        s_len = 1;
+        s_code = '~';
+      } else if (Opts::tilde == NormalizationOption::TildeMode::Zenkaku) {
+        stats.count(&NormalizationStats::tildes_replaced);
+        s = "\xe3\x80\x9c";  // '〜'
+        s_len = 3;
+        s_code = 0x301c;
+      } else {
+        stats.count(&NormalizationStats::tildes_removed);
+        continue;
+      }
+    } else {
+      if ((rule.kind == RuleKind::Replace) ||
+          ((rule.kind == RuleKind::Parenthesized) &&
+           Opts::parenthesized_ideographs)) {
+        s = rule.text();
+        s_len = rule.len;
+        // ~0u for multi-char replacement(e.g. "(株)")
+        s_code = decode_utf8(s, s_len);
+
+        if (rule.kind == RuleKind::Parenthesized) {
+          stats.count(&NormalizationStats::parenthesized);
+        } else if ((code >= 0xff61) && (code <= 0xff9f)) {
+          stats.count(&NormalizationStats::halfwidth_kana);
+        } else if ((code >= 0xff01) && (code <= 0xff5e)) {
+          stats.count(&NormalizationStats::fullwidth_ascii);
+        } else {
+          stats.count(&NormalizationStats::other_replaced);
+        }
+      }
+
+      uint32_t merged = 0;
+      if (prev_exact) {
+        if (s_code == 0xff9e) {  // 'ﾞ'
+          merged = table.kana_ten(prev_code);
+        } else if (s_code == 0xff9f) {  // 'ﾟ'
+          merged = table.kana_maru(prev_code);
+        }
+      }
+
+      if (merged) {
+        if (out.size() == 0) {
+          state.failed = state.stopped = true;
+          return str_len;
+        }
+        // The merged char replaces the previous slot.
+        out.map_input(slot_in);
+        out.rewind();
+        // kana is always 3 bytes in UTF-8.
+        buf[0] = char(0xe0 | (merged >> 12));
+        buf[1] = char(0x80 | ((merged >> 6) & 0x3f));
+        buf[2] = char(0x80 | (merged & 0x3f));
+        s = buf;
+        s_len = 3;
+        s_code = merged;
+        stats.count(&NormalizationStats::kana_merged);
+      }
+
+      uint32_t s_lax = (s_code != ~0u) ? s_code : utf8_code(s, s_len);
+
+      // TODO: allow all non-latin char?
+      if (latin_space && is_cjk_code(s_lax) && Opts::remove_space) {
+        if (out.size() == 0) {
+          state.failed = state.stopped = true;
+          return str_len;
+        }
+        out.rewind();
+        stats.count(&NormalizationStats::spaces_removed);
+      }
+
+      if (!merged) {
+        out.map_input(c_pos);
+        slot_in = c_pos;
+      }
+
+      latin_space = false;
+      out.put(s, s_len, s_code);
+
+      prev_code = s_lax;
+      prev_exact = (s_code != ~0u);
+      continue;
+    }
+
+    out.map_input(c_pos);
+    out.put(s, s_len, s_code);
+    slot_in = c_pos;
+    prev_code = (s_code != ~0u) ? s_code : utf8_code(s, s_len);
+    prev_exact = (s_code != ~0u);
+  }
+
+  state.prev_code = prev_code;
+  state.prev_exact = prev_exact;
+  state.latin_space = latin_space;
+
+  return i;
+}
+
+// Apply the rule for the end of text: remove the trailing space.
+template <class Writer, class Stats = NoStats>
+inline void finish_chars(Writer &out, Stats stats = Stats()) {
+  if ((out.size() > 0) && out.last_is_space()) {
+    out.rewind();
+    stats.count(&NormalizationStats::spaces_removed);
+  }
+}
+
+///
+/// `normalize_chars_fixed()` for the runtime `option`.
+/// Dispatches once per call to the instantiation for `option`.
+///
+template <class Unit, class Writer, class Stats = NoStats>
+inline size_t normalize_chars(const Unit *str, size_t str_len, bool eof,
+                              const NormalizationOption &option,
+                              CoreState &state, Writer &out,
+                              Stats stats = Stats()) {
+#define JP_NORMALIZER_CASE(rs, td, paren)                             \
+  if ((option.remove_space == rs) &&                                   \
+      (option.tilde == NormalizationOption::TildeMode::td) &&          \
+      (option.parenthesized_ideographs == paren)) {                    \
+    return normalize_chars_fixed<JP_NORMALIZER_FIXED_OPTION(rs, td, paren)>( \
+        str, str_len, eof, option.invalid_char, state, out, stats);    \
+  }
+  JP_NORMALIZER_FOR_EACH_FIXED_OPTION(JP_NORMALIZER_CASE)
+#undef JP_NORMALIZER_CASE
+
+  return 0;  // unreachable
+}
+
+///
+/// Normalize the whole `str` through `out`.
+/// Returns false when the result is empty.
+///
+template <class Opts, class Unit, class Writer, class Stats = NoStats>
+inline bool normalize_core(const Unit *str, size_t str_len,
+                           NormalizationOption::InvalidCharMode invalid,
+                           Writer &out, Stats stats = Stats()) {
+  // normalized text should not exceed input length in most case.
+  out.reset(str_len);
+
+  CoreState state;
+  normalize_chars_fixed<Opts>(str, str_len, /* eof */true, invalid, state, out,
+                              stats);
+
+  if (state.failed || (out.size() == 0)) {
+    out.clear();
+    return false;
+  }
+
+  finish_chars(out, stats);
+
+  out.finish();
+  return out.size() > 0;
+}
+
+template <class Unit, class Writer, class Stats = NoStats>
+inline bool normalize_core(const Unit *str, size_t str_len,
+                           const NormalizationOption &option,
+                           Writer &out, Stats stats = Stats()) {
+#define JP_NORMALIZER_CASE(rs, td, paren)                             \
+  if ((option.remove_space == rs) &&                                   \
+      (option.tilde == NormalizationOption::TildeMode::td) &&          \
+      (option.parenthesized_ideographs == paren)) {                    \
+    return normalize_core<JP_NORMALIZER_FIXED_OPTION(rs, td, paren)>(  \
+        str, str_len, option.invalid_char, out, stats);                \
+  }
+  JP_NORMALIZER_FOR_EACH_FIXED_OPTION(JP_NORMALIZER_CASE)
+#undef JP_NORMALIZER_CASE
+
+  return false;  // unreachable
+}
+
+///
+/// Range of indices [begin, end) owned by a worker of `parallel_for()`.
+/// Packed into 64bit so that the owner(pop from the front) and thieves(steal
+/// the back half) can update it with a single CAS.
+///
+class StealRange {
+ public:
+  void set(uint32_t begin, uint32_t end) {
+    range_.store(pack(begin, end), std::memory_order_release);
+  }
+
+  // Take the front index. Called by the owner.
+  bool pop(uint32_t &idx) {
+    uint64_t cur = range_.load(std::memory_order_acquire);
+    for (;;) {
+      uint32_t begin = uint32_t(cur >> 32);
+      uint32_t end = uint32_t(cur);
+      if (begin >= end) {
+        return false;
+      }
+      if (range_.compare_exchange_weak(cur, pack(begin + 1, end),
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        idx = begin;
+        return true;
+      }
+    }
+  }
+
+  // Take the back half. Called by other workers.
+  bool steal(uint32_t &begin_out, uint32_t &end_out) {
+    uint64_t cur = range_.load(std::memory_order_acquire);
+    for (;;) {
+      uint32_t begin = uint32_t(cur >> 32);
+      uint32_t end = uint32_t(cur);
+      if (begin >= end) {
+        return false;
+      }
+      uint32_t mid = begin + (end - begin) / 2;
+      if (range_.compare_exchange_weak(cur, pack(begin, mid),
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        begin_out = mid;
+        end_out = end;
+        return true;
+      }
+    }
+  }
+
+ private:
+  static uint64_t pack(uint32_t begin, uint32_t end) {
+    return (uint64_t(begin) << 32) | end;
+  }
+
+  std::atomic<uint64_t> range_{0};
+};
+
+inline size_t resolve_num_threads(size_t num_threads, size_t n) {
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  return (std::max)(size_t(1), (std::min)(num_threads, n));
+}
+
+///
+/// Call `func(worker_id, i)` for i in [0, n) on `num_threads` threads
+/// (including the calling thread) with work-stealing.
+/// `num_threads` must be resolved(> 0) by the caller.
+///
+template <class Func>
+inline void parallel_for(size_t n, size_t num_threads, Func &&func) {
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      func(size_t(0), i);
+    }
+    return;
+  }
+
+  // One cache line per worker to avoid false sharing.
+  const size_t kStride = (std::max)(size_t(1), 64 / sizeof(StealRange));
+  std::unique_ptr<StealRange[]> range_buf(new StealRange[num_threads * kStride]);
+  auto range = [&](size_t w) -> StealRange & { return range_buf[w * kStride]; };
+
+  // Indices are 32bit in `StealRange`. Process in slices for larger `n`.
+  const size_t kMaxSlice = 0xffffffffu;
+  for (size_t base = 0; base < n; base += kMaxSlice) {
+    uint32_t count = uint32_t((std::min)(n - base, kMaxSlice));
+
+    for (size_t w = 0; w < num_threads; w++) {
+      range(w).set(uint32_t(uint64_t(count) * w / num_threads),
+                    uint32_t(uint64_t(count) * (w + 1) / num_threads));
+    }
+
+    auto worker = [&](size_t w) {
+      for (;;) {
+        uint32_t idx;
+        while (range(w).pop(idx)) {
+          func(w, base + idx);
+        }
+
+        bool stolen = false;
+        for (size_t k = 1; k < num_threads; k++) {
+          uint32_t begin, end;
+          if (range((w + k) % num_threads).steal(begin, end)) {
+            range(w).set(begin, end);
+            stolen = true;
+            break;
+          }
+        }
+
+        if (!stolen) {
+          return;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t w = 1; w < num_threads; w++) {
+      threads.emplace_back(worker, w);
+    }
+    worker(0);
+    for (auto &th : threads) {
+      th.join();
+    }
+  }
+}
+
+template <class Doc>
+inline std::vector<std::string> normalize_batch(const std::vector<Doc> &docs,
+                                                const NormalizationOption &option,
+                                                size_t num_threads,
+                                                NormalizationStats *stats) {
+  std::vector<std::string> results(docs.size());
+
+  num_threads = resolve_num_threads(num_threads, docs.size());
+
+  // per-thread scratch buffers and counters.
+  std::vector<Normalizer> normalizers(num_threads, Normalizer(option));
+  std::vector<NormalizationStats> thread_stats(stats ? num_threads : 0);
+  for (size_t w = 0; w < thread_stats.size(); w++) {
+    normalizers[w].set_stats(&thread_stats[w]);
+  }
+
+  parallel_for(docs.size(), num_threads, [&](size_t w, size_t i) {
+    normalizers[w].normalize_into(docs[i].data(), docs[i].size(), results[i]);
+  });
+
+  for (const NormalizationStats &ts : thread_stats) {
+    *stats += ts;
+  }
+
+  return results;
+}
+
+// Shards smaller than this are not worth a thread.
+static constexpr size_t kMinParallelShardSize = 64 * 1024;
+
+///
+/// True when the normalization core can be restarted at str[p] with a fresh
+/// state and produce the same output as the whole text.
+/// str[p - 1] must be a plain ASCII char(not a space/tilde/hyphen, which
+/// affect the next char) that the whole scan sees as a char, and str[p] must
+/// not be a space or tilde(their rules depend on the previous char).
+/// Then the previous char can neither be merged with(ﾞ/ﾟ) nor be rewound
+/// (latin space) by the next char, so no rule looks across `p`.
+///
+inline bool is_core_split_point(const char *str, size_t len, size_t p) {
+  uint8_t c = uint8_t(str[p - 1]);
+  if ((c >= 0x80) || (c == ' ') || (c == '~') || (c == '-')) {
+    return false;
+  }
+
+  // An ASCII byte is never a part of a multibyte char or of an ill-formed
+  // sequence, so the whole scan sees str[p - 1] as a char.
+
+  uint8_t d = uint8_t(str[p]);
+  if (d < 0x80) {
+    return (d != ' ') && (d != '~');
+  }
+
+  uint32_t bad_len;
+  bool truncated;
+  uint32_t d_len = check_utf8_char(reinterpret_cast<const uint8_t *>(str + p),
+                                   len - p, bad_len, truncated);
+  if (d_len == 0) {
+    // invalid char. skipped or replaced chars do not reset the previous char.
+    return false;
+  }
+
+  RuleKind kind =
+      get_rule_table().lookup(InputTraits<char>::decode(str + p, d_len)).kind;
+  return (kind != RuleKind::Space) && (kind != RuleKind::Tilde);
+}
+
+///
+/// True when repeat shortening of text[0, b) and text[b, n) gives the same
+/// result as shortening text[0, n).
+/// The shortener only moves forward, and a cut at a position replaces the
+/// rest of the text with a suffix of itself, so its state at a position is
+/// determined by the position in the original text. It must not cut over `b`
+/// and must not see a different repeat near the end of text[0, b). Both hold
+/// when text[b - 1] does not appear within `max_len` chars around it(a repeat
+/// over `b` would contain another copy of it) and no repeat of length
+/// <= `max_len` ends at b - 1(the shard end limits repeat length to half).
+///
+inline bool is_repeat_split_point(const uint32_t *text, size_t n, size_t b,
+                                  size_t max_len) {
+  uint32_t x = text[b - 1];
+
+  size_t begin = (b > max_len + 1) ? (b - 1 - max_len) : 0;
+  size_t end = (std::min)(n, b + max_len);
+  for (size_t j = begin; j < end; j++) {
+    if ((text[j] == x) && (j != (b - 1))) {
+      return false;
+    }
+  }
+
+  for (size_t l = 1; (l <= max_len) && ((2 * l) <= (b - 1)); l++) {
+    if (std::equal(text + b - 1 - 2 * l, text + b - 1 - l, text + b - 1 - l)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+///
+/// Split [0, n) into at most `num_shards` shards. A boundary is the first
+/// point at or after n * k / num_shards where `is_split_point(p)` holds.
+/// Returns the boundaries including 0 and n.
+///
+template <class Pred>
+inline std::vector<size_t> find_split_points(size_t n, size_t num_shards,
+                                             Pred &&is_split_point) {
+  std::vector<size_t> points(1, 0);
+  for (size_t k = 1; k < num_shards; k++) {
+    size_t p = (std::max)(n / num_shards * k, points.back() + 1);
+    size_t limit = (k + 1 < num_shards) ? (n / num_shards * (k + 1)) : n;
+    for (; p < limit; p++) {
+      if (is_split_point(p)) {
+        points.push_back(p);
+        break;
+      }
+    }
+  }
+  points.push_back(n);
+  return points;
+}
+
+// Normalize a shard of the text. `last` is true for the shard at the end of
+// the text.
+template <class Writer>
+inline void normalize_shard(const char *str, size_t len, bool last,
+                            const NormalizationOption &option,
+                            CoreState &state, Writer &out) {
+  out.reset(len);
+  normalize_chars(str, len, /* eof */true, option, state, out);
+  if (last || state.stopped) {
+    finish_chars(out);
+  }
+  out.finish();
+}
+
+// Number of leading shards which contribute to the result(shards after an
+// invalid char are ignored). Returns 0 when the result must be discarded.
+inline size_t count_valid_shards(const std::vector<CoreState> &states) {
+  for (size_t k = 0; k < states.size(); k++) {
+    if (states[k].failed) {
+      return 0;
+    }
+    if (states[k].stopped) {
+      return k + 1;
+    }
+  }
+  return states.size();
+}
+
+inline void normalize_parallel(const char *str, size_t len,
+                               const NormalizationOption &option,
+                               size_t num_threads, size_t num_shards,
+                               std::string &dst) {
+  std::vector<size_t> splits =
+      find_split_points(len, num_shards, [&](size_t p) {
+        return is_core_split_point(str, len, p);
+      });
+  size_t n = splits.size() - 1;
+  std::vector<CoreState> states(n);
+
+  if ((option.repeat == 0) || (option.max_repeat_substr_len == 0)) {
+    std::vector<std::string> parts(n);
+    parallel_for(n, num_threads, [&](size_t, size_t k) {
+      Utf8Writer out(parts[k]);
+      normalize_shard(str + splits[k], splits[k + 1] - splits[k], (k + 1) == n,
+                      option, states[k], out);
+    });
+
+    n = count_valid_shards(states);
+    for (size_t k = 0; k < n; k++) {
+      dst.append(parts[k]);
+    }
+    return;
+  }
+
+  std::vector<std::vector<uint32_t>> parts(n);
+  parallel_for(n, num_threads, [&](size_t, size_t k) {
+    CodepointWriter out(parts[k]);
+    normalize_shard(str + splits[k], splits[k + 1] - splits[k], (k + 1) == n,
+                    option, states[k], out);
+  });
+
+  // Repeats are shortened on the concatenated text, which is split again at
+  // its own safe points.
+  std::vector<uint32_t> text;
+  {
+    n = count_valid_shards(states);
+    size_t total = 0;
+    for (size_t k = 0; k < n; k++) {
+      total += parts[k].size();
+    }
+    text.reserve(total);
+    for (size_t k = 0; k < n; k++) {
+      text.insert(text.end(), parts[k].begin(), parts[k].end());
+      std::vector<uint32_t>().swap(parts[k]);
+    }
+  }
+
+  const size_t max_len = option.max_repeat_substr_len;
+  std::vector<size_t> bounds =
+      find_split_points(text.size(), num_shards, [&](size_t b) {
+        return is_repeat_split_point(text.data(), text.size(), b, max_len);
+      });
+  n = bounds.size() - 1;
+
+  std::vector<std::vector<RepeatRun>> runs(num_threads);
+  std::vector<std::string> outs(n);
+  parallel_for(n, num_threads, [&](size_t w, size_t k) {
+    uint32_t *shard = text.data() + bounds[k];
+    size_t shard_len = RepeatShortener(option.repeat, uint32_t(max_len), runs[w])
+                           .run(shard, bounds[k + 1] - bounds[k]);
+    codepoints_to_utf8(shard, shard_len, outs[k]);
+  });
+
+  for (size_t k = 0; k < n; k++) {
+    dst.append(outs[k]);
+  }
+}
+
+inline uint32_t popcount64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  return uint32_t(__popcnt64(x));
+#elif defined(_MSC_VER)
+  return uint32_t(__popcnt(uint32_t(x)) + __popcnt(uint32_t(x >> 32)));
+#else
+  return uint32_t(__builtin_popcountll(x));
+#endif
+}
+
+// splitmix64 finalizer.
+inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+// Hash of str[0, len)(8 bytes at a time, mixed with `mix64()`).
+inline uint64_t hash_bytes(const char *str, size_t len, uint64_t seed) {
+  uint64_t h = seed ^ (uint64_t(len) * 0x9e3779b97f4a7c15ull);
+  size_t i = 0;
+  for (; (i + 8) <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, str + i, 8);
+    h = mix64(h ^ w);
+  }
+  uint64_t w = 0;
+  memcpy(&w, str + i, len - i);
+  return mix64(h ^ w ^ 0xff51afd7ed558ccdull);
+}
+
+inline NormalizationOption dedup_normalization_option() {
+  NormalizationOption option;
+  option.tilde = NormalizationOption::TildeMode::Remove;
+  option.remove_space = true;
+  option.repeat = 8;
+  option.max_repeat_substr_len = 8;
+  option.parenthesized_ideographs = true;
+  return option;
+}
+
+///
+/// Normalize `str` for deduplication and pass the result to
+/// `sink(codes, n)` block by block: digits are replaced by the placeholder,
+/// then repeats are shortened(so numbers which differ only in their digits
+/// are shortened in the same way). The normalized text is never held as a
+/// whole; `codepoints` holds one input block plus the repeat window.
+/// Returns false when the result is empty or the input is rejected(the
+/// result of the blocks already passed must be dropped).
+///
+template <class Sink>
+inline bool normalize_for_dedup_blocks(
+    const char *str, size_t len, const DedupNormalizationOption &dedup_option,
+    std::vector<uint32_t> &codepoints, std::vector<RepeatRun> &runs,
+    Sink &&sink) {
+  // Input bytes normalized at once. Bounds `codepoints`.
+  const size_t kBlockSize = 64 * 1024;
+  const NormalizationOption option = dedup_normalization_option();
+
+  if (!str || (len == 0) || (len > option.max_tokens)) {
+    return false;
+  }
+
+  CodepointWriter out(codepoints);
+  out.reset(kBlockSize);
+  CoreState state;
+  RepeatShortener shortener(option.repeat, option.max_repeat_substr_len, runs);
+  shortener.reset();
+
+  // Digits are ASCII after the normalization.
+  const uint32_t placeholder = uint8_t(dedup_option.digit_placeholder);
+  size_t replaced = 0;  // codepoints[0, replaced) have no digit.
+  size_t emitted = 0;
+
+  size_t pos = 0;
+  bool eof = false;
+  while (!eof) {
+    size_t n = (std::min)(kBlockSize, len - pos);
+    eof = (pos + n) == len;
+    pos += normalize_chars(str + pos, n, eof, option, state, out);
+    if (state.failed) {
+      return false;
+    }
+    if (eof) {
+      finish_chars(out);
+    }
+
+    // Only the last slot can be rewound.
+    size_t decided = eof ? codepoints.size() : out.last_start();
+    for (; replaced < decided; replaced++) {
+      if ((codepoints[replaced] - '0') < 10u) {
+        codepoints[replaced] = placeholder;
+      }
+    }
+
+    shortener.process(codepoints.data(), decided, eof);
+    sink(codepoints.data(), shortener.out());
+    emitted += shortener.out();
+
+    size_t head = shortener.head();
+    codepoints.erase(codepoints.begin(), codepoints.begin() + std::ptrdiff_t(head));
+    out.shift(head);
+    shortener.rebase();
+    replaced -= head;
+  }
+  return emitted > 0;
+}
+
+///
+/// MinHash/SimHash of char n-grams of a text given in blocks(`push()`).
+/// Each n-gram is hashed with a rolling polynomial hash(then mixed), so the
+/// cost does not depend on n. MinHash is one permutation hashing: the hash
+/// selects a bin and only the minimum of the bin is kept. Empty bins are
+/// filled from the next non-empty bin(rotation densification).
+///
+class SignatureBuilder {
+ public:
+  // `window` is a scratch buffer(the last n-gram).
+  SignatureBuilder(const DedupSignatureOption &option, DedupSignature &signature,
+                   std::vector<uint32_t> &window)
+      : option_(option),
+        signature_(signature),
+        window_(window),
+        ngram_((std::max)(size_t(1), size_t(option.ngram))),
+        seed_(mix64(option.seed + 0x9e3779b97f4a7c15ull)) {
+    signature_.minhash.assign(option_.num_minhash, uint64_t(kEmpty));
+    signature_.simhash = 0;
+    window_.assign(ngram_, 0);
+    for (size_t i = 0; i < ngram_; i++) {
+      base_pow_ *= kBase;
+    }
+  }
+
+  void push(const uint32_t *text, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      uint32_t &oldest = window_[count_ % ngram_];
+      rolling_ = rolling_ * kBase + text[i];
+      if (count_ >= ngram_) {
+        rolling_ -= base_pow_ * oldest;
+      }
+      oldest = text[i];
+      count_++;
+      if (count_ >= ngram_) {
+        add_shingle(mix64(rolling_ ^ seed_));
+      }
+    }
+  }
+
+  void finish() {
+    if (count_ == 0) {
+      signature_.minhash.clear();
+      return;
+    }
+    if (count_ < ngram_) {
+      // A text shorter than the n-gram is a single shingle.
+      add_shingle(mix64(rolling_ ^ seed_));
+    }
+
+    if (option_.simhash) {
+      flush_lanes();
+      for (uint32_t b = 0; b < 64; b++) {
+        if ((2 * size_t(bit_counts_[b])) > num_shingles_) {
+          signature_.simhash |= (uint64_t(1) << b);
+        }
+      }
+    }
+
+    // Densification.
+    const size_t num_bins = signature_.minhash.size();
+    uint64_t *minhash = signature_.minhash.data();
+    size_t first = 0;
+    while ((first < num_bins) && (minhash[first] == kEmpty)) {
+      first++;
+    }
+    if (first < num_bins) {
+      uint64_t src = minhash[first];
+      uint64_t dist = 0;
+      for (size_t k = 1; k < num_bins; k++) {
+        size_t j = size_t((first + num_bins - k) % num_bins);
+        if (minhash[j] != kEmpty) {
+          src = minhash[j];
+          dist = 0;
+        } else {
+          dist++;
+          minhash[j] = mix64(src + dist);
         }
+      }
+    }
+  }
+
+ private:
+  static constexpr uint64_t kEmpty = ~uint64_t(0);
+  static constexpr uint64_t kBase = 0x100000001b3ull;
+  // Bit (8 * k + j) of the hashes is counted in byte k of `lane_counts_[j]`.
+  static constexpr uint64_t kLaneMask = 0x0101010101010101ull;
+
+  void add_shingle(uint64_t h) {
+    num_shingles_++;
+
+    const uint64_t num_bins = signature_.minhash.size();
+    if (num_bins > 0) {
+      uint64_t bin = ((h >> 32) * num_bins) >> 32;
+      if (h < signature_.minhash[bin]) {
+        signature_.minhash[bin] = h;
+      }
+    }
+
+    if (option_.simhash) {
+      for (uint32_t j = 0; j < 8; j++) {
+        lane_counts_[j] += (h >> j) & kLaneMask;
+      }
+      if (++lane_shingles_ == 255) {
+        flush_lanes();
+      }
+    }
+  }
+
+  // Move the SimHash lane counts to `bit_counts_` before a byte overflows.
+  void flush_lanes() {
+    for (uint32_t j = 0; j < 8; j++) {
+      for (uint32_t k = 0; k < 8; k++) {
+        bit_counts_[8 * k + j] += uint32_t((lane_counts_[j] >> (8 * k)) & 0xff);
+      }
+      lane_counts_[j] = 0;
+    }
+    lane_shingles_ = 0;
+  }
+
+  const DedupSignatureOption &option_;
+  DedupSignature &signature_;
+  std::vector<uint32_t> &window_;
+  const size_t ngram_;
+  const uint64_t seed_;
+  uint64_t base_pow_{1};  // kBase^ngram
+  uint64_t rolling_{0};
+  size_t count_{0};  // codepoints pushed.
+  size_t num_shingles_{0};
+  uint64_t lane_counts_[8] = {};
+  uint32_t bit_counts_[64] = {};
+  uint32_t lane_shingles_{0};
+};
+
+}  // namespace detail
+
+template <class Unit>
+bool Normalizer::normalize_units(const Unit *str, size_t len,
+                                 std::basic_string<Unit> &dst,
+                                 OffsetMap *offsets) {
+  if (stats_) {
+    return normalize_units(str, len, dst, offsets,
+                           detail::StatsSink(*stats_));
+  }
+  return normalize_units(str, len, dst, offsets, detail::NoStats());
+}
+
+template <class Unit, class Stats>
+bool Normalizer::normalize_units(const Unit *str, size_t len,
+                                 std::basic_string<Unit> &dst,
+                                 OffsetMap *offsets, Stats stats) {
+  dst.clear();
+  if (offsets) {
+    offsets->clear();
+  }
+
+  if (!str || (len == 0)) {
+    if (offsets) {
+      offsets->push_back({0, 0});
+    }
+    return true;
+  }
+
+  if (len > option_.max_tokens) {
+    return false;
+  }
+
+  stats.count(&NormalizationStats::texts);
+  stats.count(&NormalizationStats::bytes_in, len * sizeof(Unit));
+
+  typedef typename detail::WriterOf<Unit>::type Writer;
+
+  if (option_.repeat == 0) {
+    Writer out(dst);
+    if (!offsets) {
+      detail::normalize_core(str, len, option_, out, stats);
+    } else {
+      detail::OffsetMapWriter<Writer> mapped_out(out, *offsets);
+      detail::normalize_core(str, len, option_, mapped_out, stats);
+      offsets->push_back({uint32_t(dst.size()), uint32_t(len)});
+    }
+    stats.count(&NormalizationStats::bytes_out, dst.size() * sizeof(Unit));
+    return true;
+  }
+
+  detail::CodepointWriter out(codepoints_);
+  detail::RepeatShortener shortener(option_.repeat,
+                                    option_.max_repeat_substr_len,
+                                    repeat_runs_);
+  if (!offsets) {
+    if (detail::normalize_core(str, len, option_, out, stats)) {
+      size_t n = codepoints_.size();
+      shortener.run(codepoints_);
+      stats.count(&NormalizationStats::repeat_cut, n - codepoints_.size());
+      detail::codepoints_to_units(codepoints_.data(), codepoints_.size(), dst);
+    }
+    stats.count(&NormalizationStats::bytes_out, dst.size() * sizeof(Unit));
+    return true;
+  }
+
+  detail::CodepointOffsetWriter mapped_out(out, codepoint_offsets_);
+  if (!detail::normalize_core(str, len, option_, mapped_out, stats)) {
+    offsets->push_back({0, uint32_t(len)});
+    return true;
+  }
+
+  size_t n = shortener.run(codepoints_.data(), codepoint_offsets_.data(),
+                           codepoints_.size());
+  stats.count(&NormalizationStats::repeat_cut, codepoints_.size() - n);
+  detail::codepoints_to_units(codepoints_.data(), codepoint_offsets_.data(), n,
+                              len, dst, *offsets);
+  stats.count(&NormalizationStats::bytes_out, dst.size() * sizeof(Unit));
+  return true;
+}
+
+bool Normalizer::normalize_into(const char *str, size_t len,
+                                std::string &dst) {
+  return normalize_units(str, len, dst, nullptr);
+}
+
+bool Normalizer::normalize_append(const char *str, size_t len,
+                                  std::string &dst) {
+  if (stats_) {
+    return normalize_append(str, len, dst, detail::StatsSink(*stats_));
+  }
+  return normalize_append(str, len, dst, detail::NoStats());
+}
+
+template <class Stats>
+bool Normalizer::normalize_append(const char *str, size_t len,
+                                  std::string &dst, Stats stats) {
+  if (!str || (len == 0)) {
+    return true;
+  }
+
+  if (len > option_.max_tokens) {
+    return false;
+  }
+
+  stats.count(&NormalizationStats::texts);
+  stats.count(&NormalizationStats::bytes_in, len);
+
+  const size_t base = dst.size();
+  if (option_.repeat == 0) {
+    detail::Utf8Writer out(dst, base);
+    detail::normalize_core(str, len, option_, out, stats);
+  } else {
+    detail::CodepointWriter out(codepoints_);
+    if (detail::normalize_core(str, len, option_, out, stats)) {
+      size_t n = codepoints_.size();
+      detail::RepeatShortener(option_.repeat, option_.max_repeat_substr_len,
+                              repeat_runs_)
+          .run(codepoints_);
+      stats.count(&NormalizationStats::repeat_cut, n - codepoints_.size());
+      detail::append_utf8(codepoints_.data(), codepoints_.size(), dst);
+    }
+  }
+  stats.count(&NormalizationStats::bytes_out, dst.size() - base);
+  return true;
+}
+
+bool Normalizer::normalize_to(const char *str, size_t len, char *dst,
+                              size_t capacity, size_t &dst_len) {
+  dst_len = 0;
+  if (capacity < normalize_bound(len)) {
+    return false;
+  }
+  if (stats_) {
+    return normalize_to(str, len, dst, dst_len, detail::StatsSink(*stats_));
+  }
+  return normalize_to(str, len, dst, dst_len, detail::NoStats());
+}
+
+template <class Stats>
+bool Normalizer::normalize_to(const char *str, size_t len, char *dst,
+                              size_t &dst_len, Stats stats) {
+  if (!str || (len == 0)) {
+    return true;
+  }
+
+  if (len > option_.max_tokens) {
+    return false;
+  }
+
+  stats.count(&NormalizationStats::texts);
+  stats.count(&NormalizationStats::bytes_in, len);
+
+  if (option_.repeat == 0) {
+    detail::BufferWriter out(dst);
+    detail::normalize_core(str, len, option_, out, stats);
+    dst_len = out.size();
+  } else {
+    detail::CodepointWriter out(codepoints_);
+    if (detail::normalize_core(str, len, option_, out, stats)) {
+      size_t n = codepoints_.size();
+      detail::RepeatShortener(option_.repeat, option_.max_repeat_substr_len,
+                              repeat_runs_)
+          .run(codepoints_);
+      stats.count(&NormalizationStats::repeat_cut, n - codepoints_.size());
+      // Shortening only removes chars, so the result fits as well.
+      for (size_t i = 0; i < codepoints_.size(); i++) {
+        dst_len += detail::encode_utf8(codepoints_[i], dst + dst_len);
+      }
+    }
+  }
+  stats.count(&NormalizationStats::bytes_out, dst_len);
+  return true;
+}
+
+bool Normalizer::normalize_into(const char16_t *str, size_t len,
+                                std::u16string &dst) {
+  return normalize_units(str, len, dst, nullptr);
+}
+
+bool Normalizer::normalize_into(const char32_t *str, size_t len,
+                                std::u32string &dst) {
+  return normalize_units(str, len, dst, nullptr);
+}
+
+bool Normalizer::normalize_into(const char *str, size_t len, std::string &dst,
+                                OffsetMap &offsets) {
+  return normalize_units(str, len, dst, &offsets);
+}
+
+bool Normalizer::normalize_into(const char16_t *str, size_t len,
+                                std::u16string &dst, OffsetMap &offsets) {
+  return normalize_units(str, len, dst, &offsets);
+}
+
+bool Normalizer::normalize_into(const char32_t *str, size_t len,
+                                std::u32string &dst, OffsetMap &offsets) {
+  return normalize_units(str, len, dst, &offsets);
+}
+
+template <class Unit>
+bool Normalizer::is_normalized_units(const Unit *str, size_t len) {
+  if (!str || (len == 0)) {
+    return true;
+  }
+
+  if (len > option_.max_tokens) {
+    return false;
+  }
+
+  detail::RepeatChecker repeat(option_.repeat, option_.max_repeat_substr_len,
+                               repeat_ring_, repeat_check_runs_);
+
+  // The core is run on blocks, so that it returns soon after the first
+  // change.
+  const size_t kBlockSize = 4096;
+
+  detail::CheckWriter<Unit> out(str, len, repeat);
+  detail::CoreState state;
+  size_t pos = 0;
+  while ((pos < len) && !out.changed() && !state.stopped) {
+    size_t n = (std::min)(kBlockSize, len - pos);
+    bool eof = (pos + n) == len;
+    pos += detail::normalize_chars(str + pos, n, eof, option_, state, out);
+  }
+
+  if (out.changed() || state.stopped) {
+    // `stopped` drops the rest of the text(or the result on failure).
+    return false;
+  }
+
+  detail::finish_chars(out);
+  return !out.changed() && (out.size() == len);
+}
+
+bool Normalizer::is_normalized(const char *str, size_t len) {
+  return is_normalized_units(str, len);
+}
+
+bool Normalizer::is_normalized(const char16_t *str, size_t len) {
+  return is_normalized_units(str, len);
+}
+
+bool Normalizer::is_normalized(const char32_t *str, size_t len) {
+  return is_normalized_units(str, len);
+}
+
+bool Normalizer::normalize_into(const char *str, size_t len, std::string &dst,
+                                bool &unchanged) {
+  dst.clear();
+  unchanged = is_normalized_units(str, len);
+  return unchanged || normalize_units(str, len, dst, nullptr);
+}
+
+bool Normalizer::normalize_into(const char16_t *str, size_t len,
+                                std::u16string &dst, bool &unchanged) {
+  dst.clear();
+  unchanged = is_normalized_units(str, len);
+  return unchanged || normalize_units(str, len, dst, nullptr);
+}
 
-        dst_buf[loc] = c;
+bool Normalizer::normalize_into(const char32_t *str, size_t len,
+                                std::u32string &dst, bool &unchanged) {
+  dst.clear();
+  unchanged = is_normalized_units(str, len);
+  return unchanged || normalize_units(str, len, dst, nullptr);
+}
 
-      } else {
+std::string normalize(const std::string& str,
+                      const NormalizationOption option) {
+  Normalizer normalizer(option);
+  return normalizer.normalize(str);
+}
 
-        if (sASCII.count(c)) {
-          c = sASCII.at(c);
-        } else if (sDIGIT.count(c)) {
-          c = sDIGIT.at(c);
-        } else if (sKANA.count(c)) {
-          c = sKANA.at(c);
-        } else {
-          // Additional unicode normalizations
-          if (option.parenthesized_ideographs && sParenthesizedIdeographs.count(c)) {
-            c = sParenthesizedIdeographs.at(c);
-          }
-        }
+std::u16string normalize(const std::u16string& str,
+                         const NormalizationOption option) {
+  Normalizer normalizer(option);
+  return normalizer.normalize(str);
+}
 
+std::u32string normalize(const std::u32string& str,
+                         const NormalizationOption option) {
+  Normalizer normalizer(option);
+  return normalizer.normalize(str);
+}
 
-        if ((c == "ﾞ") && (sKANA_TEN.count(prev_c))) {
-          if (loc == 0) {
-            //std::cerr << "b loc = 0\n";
-            return std::string();
-          }
-          loc--;
-          c = sKANA_TEN.at(prev_c);
-        } else if ((c == "ﾟ") && (sKANA_MARU.count(prev_c))) {
-          if (loc == 0) {
-            //std::cerr << "c loc = 0\n";
-            return std::string();
-          }
-          loc--;
-          c = sKANA_MARU.at(prev_c);
-        }
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      OffsetMap &offsets) {
+  std::string dst;
+  Normalizer(option).normalize_into(str.data(), str.size(), dst, offsets);
+  return dst;
+}
+
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      NormalizationStats &stats) {
+  std::string dst;
+  Normalizer normalizer(option);
+  normalizer.set_stats(&stats);
+  normalizer.normalize_into(str.data(), str.size(), dst);
+  return dst;
+}
 
-        //std::cout << "latin_space " << latin_space << "\n";
-        //std::cout << "is_cjk_char " << detail::is_cjk_char(c) << "\n";
+std::string normalize(const std::string& str, const NormalizationOption &option,
+                      bool &unchanged) {
+  std::string dst;
+  Normalizer(option).normalize_into(str.data(), str.size(), dst, unchanged);
+  return dst;
+}
 
-        // TODO: allow all non-latin char?
-        if (latin_space && detail::is_cjk_char(c) && option.remove_space) {
-          //std::cout << "latin space: c = " << c << "\n";
-          if (loc == 0) {
-            return std::string();
-          }
-          loc--;
-        }
+size_t normalize_bound(size_t len) {
+  // e.g. '㌖'(3 bytes) to 'キロメートル'(18 bytes).
+  if (len > (SIZE_MAX / detail::kMaxUtf8Growth)) {
+    return SIZE_MAX;
+  }
+  return len * detail::kMaxUtf8Growth;
+}
 
-        latin_space = false;
-        dst_buf[loc] = c;
-      }
-    }
+namespace detail {
 
-    prev_c = c;
-    loc++;
+// Normalize buf[0, len) in place without the repeat shortening. The result
+// is buf[0, returned length) followed by `spill`(the bytes which did not fit
+// in buf[0, capacity)).
+inline size_t normalize_inplace_core(char *buf, size_t len, size_t capacity,
+                                     const NormalizationOption &option,
+                                     std::string &spill) {
+  InplaceWriter out(buf, len, find_invalid_utf8(buf, len), spill);
+  if (!normalize_core(buf, len, option, out)) {
+    spill.clear();
+    return 0;
   }
+  out.finish(capacity);
+  spill.erase(0, size_t(out.spill() - spill.data()));
+  return out.inplace_size();
+}
 
-  if (loc == 0) {
-    // This should not happen though.
-    //std::cerr << "e loc = 0\n";
-    return std::string();
+// Shorten repeats of buf[0, len) in place. Returns the length of the result.
+inline size_t shorten_repeat_inplace(char *buf, size_t len,
+                                     const NormalizationOption &option) {
+  std::vector<RepeatRun> runs;
+  RepeatShortener shortener(option.repeat, option.max_repeat_substr_len, runs);
+  if (!shortener.enabled() || (len == 0)) {
+    return len;
+  }
+  std::vector<uint32_t> codes;
+  return shorten_repeat_inplace(buf, len, shortener, codes);
+}
+
+}  // namespace detail
+
+bool normalize_inplace(std::string &str, const NormalizationOption &option) {
+  if (str.size() > option.max_tokens) {
+    str.clear();
+    return false;
+  }
+  if (str.empty()) {
+    return true;
   }
 
-  if (dst_buf[loc-1] == " ") {
-    loc--;
+  std::string spill;
+  str.resize(detail::normalize_inplace_core(&str[0], str.size(), str.size(),
+                                            option, spill));
+  str.append(spill);
+  str.resize(detail::shorten_repeat_inplace(&str[0], str.size(), option));
+  return true;
+}
+
+bool normalize_inplace(char *buf, size_t &len, size_t capacity,
+                       const NormalizationOption &option) {
+  if (len > option.max_tokens) {
+    len = 0;
+    return false;
   }
+  if (len == 0) {
+    return true;
+  }
+  capacity = (std::max)(capacity, len);
 
-  std::string dst_str;
-  // simply concat chars.
-  for (size_t i = 0; i < loc; i++) {
-    dst_str += dst_buf[i];
+  std::string spill;
+  size_t n = detail::normalize_inplace_core(buf, len, capacity, option, spill);
+  if (spill.empty()) {
+    len = detail::shorten_repeat_inplace(buf, n, option);
+    return true;
   }
 
-  if (option.repeat > 0) {
-    return detail::shorten_repeat(dst_str, option.repeat, option.max_repeat_substr_len);
+  // Expanded beyond `capacity`. The repeat shortening may still make it fit.
+  std::string result(buf, n);
+  result.append(spill);
+  len = detail::shorten_repeat_inplace(&result[0], result.size(), option);
+  if (len > capacity) {
+    return false;
   }
+  memcpy(buf, result.data(), len);
+  return true;
+}
 
-  return dst_str;
+bool is_normalized(const char *str, size_t len,
+                   const NormalizationOption &option) {
+  return Normalizer(option).is_normalized(str, len);
 }
 
-#if 0 // TODO
-// replace all digits to a placeholder character
-std::string normalize_for_dedup(const std::string& str,
-                      const DedupNormalizationOption dedup_option) {
+bool is_normalized(const char16_t *str, size_t len,
+                   const NormalizationOption &option) {
+  return Normalizer(option).is_normalized(str, len);
+}
 
-  NormalizationOption option;
-  option.tilde = NormalizationOption::TildeMode::Remove;
-  option.remove_space = true;
-  option.repeat = 8;
-  option.max_repeat = 8;
-  option.parenthesized_ideographs = true;
+bool is_normalized(const char32_t *str, size_t len,
+                   const NormalizationOption &option) {
+  return Normalizer(option).is_normalized(str, len);
+}
 
+NormalizationStats &NormalizationStats::operator+=(
+    const NormalizationStats &rhs) {
+  texts += rhs.texts;
+  bytes_in += rhs.bytes_in;
+  bytes_out += rhs.bytes_out;
+  chars += rhs.chars;
+  ascii_fast_path += rhs.ascii_fast_path;
+  halfwidth_kana += rhs.halfwidth_kana;
+  fullwidth_ascii += rhs.fullwidth_ascii;
+  other_replaced += rhs.other_replaced;
+  kana_merged += rhs.kana_merged;
+  hyphens += rhs.hyphens;
+  hyphens_collapsed += rhs.hyphens_collapsed;
+  choonpu += rhs.choonpu;
+  choonpu_collapsed += rhs.choonpu_collapsed;
+  tildes_removed += rhs.tildes_removed;
+  tildes_replaced += rhs.tildes_replaced;
+  spaces_removed += rhs.spaces_removed;
+  parenthesized += rhs.parenthesized;
+  repeat_cut += rhs.repeat_cut;
+  invalid_sequences += rhs.invalid_sequences;
+  invalid_units += rhs.invalid_units;
+  return *this;
+}
 
-  if (str.empty()) {
-    return std::string();
+size_t map_to_input(const OffsetMap &map, size_t output_offset) {
+  if (map.empty()) {
+    return 0;
   }
 
-  if (str.size() > option.max_tokens) {
-    return std::string();
+  // last entry whose output <= output_offset.
+  auto it = std::upper_bound(map.begin(), map.end(), output_offset,
+                             [](size_t pos, const OffsetMapEntry &e) {
+                               return pos < e.output;
+                             });
+  if (it == map.begin()) {
+    return map.front().input;
+  }
+  --it;
+  if ((it + 1) == map.end()) {
+    return it->input;
   }
 
-  ///
-  /// Decompose input string into UTF8 char list.
-  ///
-  uint64_t sz = str.size();
-  std::vector<std::string> utf8_chars;
+  size_t delta = output_offset - it->output;
+  size_t input_len = size_t((it + 1)->input - it->input);
+  return it->input + (std::min)(delta, input_len);
+}
 
-  for (size_t i = 0; i <= sz;) {
-    int len=0;
-    std::string s = detail::extract_utf8_char(str, uint32_t(i), len);
-    if (len == 0) {
-      // invalid char
-      break;
+size_t find_invalid_utf8(const char *str, size_t len) {
+  return detail::validate_utf8(str, len);
+}
+
+template <class Opts>
+std::string normalize(const std::string &str) {
+  std::string dst;
+  if (str.empty() || (str.size() > Opts::max_tokens)) {
+    return dst;
+  }
+
+  if ((Opts::repeat == 0) || (Opts::max_repeat_substr_len == 0)) {
+    detail::Utf8Writer out(dst);
+    detail::normalize_core<Opts>(str.data(), str.size(), Opts::invalid_char,
+                                 out);
+    return dst;
+  }
+
+  std::vector<uint32_t> codepoints;
+  detail::CodepointWriter out(codepoints);
+  if (!detail::normalize_core<Opts>(str.data(), str.size(),
+                                    Opts::invalid_char, out)) {
+    return dst;
+  }
+
+  std::vector<detail::RepeatRun> runs;
+  detail::RepeatShortener(Opts::repeat, Opts::max_repeat_substr_len, runs)
+      .run(codepoints);
+  detail::codepoints_to_utf8(codepoints.data(), codepoints.size(), dst);
+  return dst;
+}
+
+#define JP_NORMALIZER_INSTANTIATE(rs, td, paren)                        \
+  template std::string normalize<JP_NORMALIZER_FIXED_OPTION(rs, td, paren)>( \
+      const std::string &);
+JP_NORMALIZER_FOR_EACH_FIXED_OPTION(JP_NORMALIZER_INSTANTIATE)
+#undef JP_NORMALIZER_INSTANTIATE
+
+std::vector<std::string> normalize_batch(const std::vector<std::string> &docs,
+                                         const NormalizationOption &option,
+                                         size_t num_threads,
+                                         NormalizationStats *stats) {
+  return detail::normalize_batch(docs, option, num_threads, stats);
+}
+
+#if defined(JP_NORMALIZER_HAS_STRING_VIEW)
+std::vector<std::string> normalize_batch(const std::vector<std::string_view> &docs,
+                                         const NormalizationOption &option,
+                                         size_t num_threads,
+                                         NormalizationStats *stats) {
+  return detail::normalize_batch(docs, option, num_threads, stats);
+}
+#endif
+
+void normalize_column(const char *data, const uint64_t *offsets, size_t n,
+                      std::string &out_data, std::vector<uint64_t> &out_offsets,
+                      const NormalizationOption &option, size_t num_threads,
+                      NormalizationStats *stats) {
+  out_data.clear();
+  out_offsets.assign(n + 1, 0);
+  if (n == 0) {
+    return;
+  }
+
+  const uint64_t begin = offsets[0];
+  const uint64_t total = offsets[n] - begin;
+
+  size_t threads = detail::resolve_num_threads(num_threads, n);
+  // a few ranges per thread for load balancing.
+  size_t num_ranges = (threads <= 1) ? 1 : (std::min)(threads * 4, n);
+
+  // Range k is rows [row_begin[k], row_begin[k + 1]).
+  std::vector<size_t> row_begin(num_ranges + 1, n);
+  row_begin[0] = 0;
+  for (size_t k = 1; k < num_ranges; k++) {
+    uint64_t target = begin + total * k / num_ranges;
+    row_begin[k] = size_t(std::lower_bound(offsets + row_begin[k - 1],
+                                           offsets + n, target) - offsets);
+  }
+
+  std::vector<std::string> range_data(num_ranges);
+  std::vector<Normalizer> normalizers(threads, Normalizer(option));
+  std::vector<NormalizationStats> thread_stats(stats ? threads : 0);
+  for (size_t w = 0; w < thread_stats.size(); w++) {
+    normalizers[w].set_stats(&thread_stats[w]);
+  }
+
+  detail::parallel_for(num_ranges, threads, [&](size_t w, size_t k) {
+    std::string &buf = range_data[k];
+    buf.reserve(size_t(offsets[row_begin[k + 1]] - offsets[row_begin[k]]));
+    for (size_t i = row_begin[k]; i < row_begin[k + 1]; i++) {
+      normalizers[w].normalize_append(data + offsets[i],
+                                      size_t(offsets[i + 1] - offsets[i]), buf);
+      // relative to the range for now.
+      out_offsets[i + 1] = buf.size();
+    }
+  });
+
+  for (const NormalizationStats &ts : thread_stats) {
+    *stats += ts;
+  }
+
+  // The first range is moved, the others are copied into place once and
+  // released one by one.
+  size_t out_size = 0;
+  for (const std::string &buf : range_data) {
+    out_size += buf.size();
+  }
+  out_data.swap(range_data[0]);
+  size_t pos = out_data.size();
+  out_data.resize(out_size);
+  for (size_t k = 1; k < num_ranges; k++) {
+    for (size_t i = row_begin[k]; i < row_begin[k + 1]; i++) {
+      out_offsets[i + 1] += pos;
     }
+    memcpy(&out_data[pos], range_data[k].data(), range_data[k].size());
+    pos += range_data[k].size();
+    std::string().swap(range_data[k]);
+  }
+}
 
-    i += uint64_t(len);
-    utf8_chars.push_back(s);
+bool normalize_parallel(const char *str, size_t len, std::string &dst,
+                        const NormalizationOption &option,
+                        size_t num_threads) {
+  size_t threads = detail::resolve_num_threads(
+      num_threads, len / detail::kMinParallelShardSize);
+  if (threads <= 1) {
+    return Normalizer(option).normalize_into(str, len, dst);
   }
 
-  std::vector<std::string> dst_buf;
-  // normalized text should not exceed input length.
-  dst_buf.resize(utf8_chars.size());
+  dst.clear();
 
-  std::string prev_c = "\0";
-  bool latin_space = false;
-  uint64_t loc = 0;
+  if (len > option.max_tokens) {
+    return false;
+  }
 
-  for (size_t i = 0 ; i  < utf8_chars.size(); i++) {
-    std::string c = utf8_chars[i];
+  // a few shards per thread for load balancing.
+  size_t num_shards =
+      (std::min)(threads * 4, len / detail::kMinParallelShardSize);
 
-    if (sSPACE.count(c)) {
-      c = " ";
-      //std::cout << "c is space: prev_c = " << prev_c << ", utf8 code " << detail::utf8_code(prev_c) << "\n";
-      if (((prev_c == " ") || detail::is_cjk_char(prev_c)) && option.remove_space) {
-        continue;
-      } else if ((prev_c != "*") && (loc > 0) && (detail::utf8_code(prev_c) < 128)) {
-        //std::cout << "latin space\n";
-        latin_space = true;
-        if (loc >= dst_buf.size()) {
-          // ???
-          return std::string();
-        }
-        dst_buf[loc] = c;
-      } else if (option.remove_space) {
-        if (loc == 0) {
-          prev_c = c;
-          continue;
-        } else {
-          loc--;
-        }
+  detail::normalize_parallel(str, len, option, threads, num_shards, dst);
+  return true;
+}
+
+std::string normalize_parallel(const std::string &str,
+                               const NormalizationOption &option,
+                               size_t num_threads) {
+  std::string dst;
+  normalize_parallel(str.data(), str.size(), dst, option, num_threads);
+  return dst;
+}
+
+struct StreamNormalizer::Impl {
+  explicit Impl(const NormalizationOption &opt)
+      : option(opt),
+        utf8_out(pending),
+        cp_out(codepoints),
+        shortener(opt.repeat, opt.max_repeat_substr_len, repeat_runs) {
+    reset();
+  }
+
+  Impl(const Impl &) = delete;
+  Impl &operator=(const Impl &) = delete;
+
+  void reset() {
+    state = detail::CoreState();
+    carry.clear();
+    if (shortener.enabled()) {
+      cp_out.reset(kBlockSize);
+      shortener.reset();
+    } else {
+      utf8_out.reset(kBlockSize);
+    }
+  }
+
+  void normalize_block(const char *data, size_t len, bool eof,
+                       size_t &consumed) {
+    if (stats) {
+      normalize_block(data, len, eof, consumed, detail::StatsSink(*stats));
+    } else {
+      normalize_block(data, len, eof, consumed, detail::NoStats());
+    }
+  }
+
+  template <class Stats>
+  void normalize_block(const char *data, size_t len, bool eof,
+                       size_t &consumed, Stats s) {
+    if (shortener.enabled()) {
+      consumed =
+          detail::normalize_chars(data, len, eof, option, state, cp_out, s);
+    } else {
+      consumed =
+          detail::normalize_chars(data, len, eof, option, state, utf8_out, s);
+    }
+  }
+
+  // End of text: remove the trailing space.
+  void finish_chars() {
+    if (!stats) {
+      if (shortener.enabled()) {
+        detail::finish_chars(cp_out);
       } else {
-        if (loc >= dst_buf.size()) {
-          // ???
-          return std::string();
-        }
-        dst_buf[loc] = c;
+        detail::finish_chars(utf8_out);
       }
+      return;
+    }
+
+    if (shortener.enabled()) {
+      detail::finish_chars(cp_out, detail::StatsSink(*stats));
     } else {
-      if (sHYPHENS.count(c)) {
-        if (prev_c == "-") {
-          continue;
-        } else {
-          c = "-";
-          dst_buf[loc] = c;
+      detail::finish_chars(utf8_out, detail::StatsSink(*stats));
+    }
+  }
+
+  // Emit decided output to `out`.
+  void flush(std::string &out, bool eof) {
+    size_t n = out.size();
+    flush_decided(out, eof);
+    if (stats) {
+      stats->bytes_out += out.size() - n;
+    }
+  }
+
+  void flush_decided(std::string &out, bool eof) {
+    if (!shortener.enabled()) {
+      if (eof) {
+        utf8_out.flush_all(out);
+      } else {
+        utf8_out.flush(out);
+      }
+      return;
+    }
+
+    shortener.process(codepoints.data(), eof ? codepoints.size() : cp_out.last_start(),
+                      eof);
+
+    size_t n = out.size();
+    out.resize(n + shortener.out() * 4);
+    size_t pos = n;
+    for (size_t i = 0; i < shortener.out(); i++) {
+      pos += detail::encode_utf8(codepoints[i], &out[pos]);
+    }
+    out.resize(pos);
+
+    size_t head = shortener.head();
+    if (stats) {
+      stats->repeat_cut += head - shortener.out();
+    }
+    codepoints.erase(codepoints.begin(), codepoints.begin() + std::ptrdiff_t(head));
+    cp_out.shift(head);
+    shortener.rebase();
+  }
+
+  // Input bytes processed at once. Bounds the size of internal buffers.
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  NormalizationOption option;
+  detail::CoreState state;
+  NormalizationStats *stats{nullptr};
+
+  // Incomplete UTF-8 char at the end of the previous chunk.
+  std::string carry;
+
+  std::string pending;
+  detail::Utf8Writer utf8_out;
+
+  std::vector<uint32_t> codepoints;
+  std::vector<detail::RepeatRun> repeat_runs;
+  detail::CodepointWriter cp_out;
+  detail::RepeatShortener shortener;
+};
+
+StreamNormalizer::StreamNormalizer(const NormalizationOption &option)
+    : impl_(new Impl(option)) {}
+
+StreamNormalizer::~StreamNormalizer() = default;
+
+StreamNormalizer::StreamNormalizer(StreamNormalizer &&) noexcept = default;
+StreamNormalizer &StreamNormalizer::operator=(StreamNormalizer &&) noexcept = default;
+
+void StreamNormalizer::feed(const char *data, size_t len, std::string &out) {
+  Impl &impl = *impl_;
+
+  if (!data || (len == 0) || impl.state.stopped) {
+    return;
+  }
+
+  if (impl.stats) {
+    impl.stats->bytes_in += len;
+  }
+
+  while (!impl.carry.empty()) {
+    // Complete the char split by the chunk boundary.
+    uint32_t char_len = detail::utf8_len(uint8_t(impl.carry[0]));
+    size_t n = (std::min)(size_t(char_len) - impl.carry.size(), len);
+    impl.carry.append(data, n);
+    data += n;
+    len -= n;
+
+    if (impl.carry.size() < char_len) {
+      return;
+    }
+
+    // An ill-formed char may leave another incomplete char in `carry`.
+    size_t consumed;
+    impl.normalize_block(impl.carry.data(), impl.carry.size(),
+                         /* eof */false, consumed);
+    impl.carry.erase(0, consumed);
+    impl.flush(out, /* eof */false);
+  }
+
+  while (len > 0) {
+    size_t block_len = (len < Impl::kBlockSize) ? len : Impl::kBlockSize;
+    size_t consumed;
+    impl.normalize_block(data, block_len, /* eof */false, consumed);
+
+    if ((consumed == 0) && (block_len == len)) {
+      // incomplete char at the end of the chunk.
+      impl.carry.assign(data, len);
+      break;
+    }
+
+    data += consumed;
+    len -= consumed;
+
+    impl.flush(out, /* eof */false);
+  }
+}
+
+void StreamNormalizer::finish(std::string &out) {
+  Impl &impl = *impl_;
+
+  if (!impl.carry.empty()) {
+    // An incomplete char at the end of text is ill-formed.
+    size_t consumed;
+    impl.normalize_block(impl.carry.data(), impl.carry.size(), /* eof */true,
+                         consumed);
+  }
+
+  if (!impl.state.failed) {
+    impl.finish_chars();
+    impl.flush(out, /* eof */true);
+  }
+
+  if (impl.stats) {
+    impl.stats->texts++;
+  }
+
+  impl.reset();
+}
+
+void StreamNormalizer::set_stats(NormalizationStats *stats) {
+  impl_->stats = stats;
+}
+
+struct NormalizationCache::Impl {
+  struct Entry {
+    uint64_t hash{0};
+    // The option fields which affect the result of a short input.
+    uint64_t option_key{0};
+    uint32_t option_flags{0};
+    std::string input;
+    std::string output;
+    size_t cost{0};
+    bool used{false};
+    bool referenced{false};
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, uint32_t> index;  // hash -> entry
+    std::vector<Entry> entries;
+    std::vector<uint32_t> free_entries;
+    size_t hand{0};  // CLOCK hand
+    size_t bytes{0};
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+    void remove(uint32_t idx) {
+      Entry &e = entries[idx];
+      index.erase(e.hash);
+      bytes -= e.cost;
+      std::string().swap(e.input);
+      std::string().swap(e.output);
+      e.used = false;
+      free_entries.push_back(idx);
+    }
+
+    // Evict the first entry without the reference bit, clearing the bits on
+    // the way.
+    void evict_one() {
+      for (;;) {
+        if (hand >= entries.size()) {
+          hand = 0;
         }
-      } else if (sCHOONPUS.count(c)) {
-        if (prev_c == "ー") { // zenkaku
+        Entry &e = entries[hand];
+        uint32_t idx = uint32_t(hand++);
+        if (!e.used) {
           continue;
-        } else {
-          c = "ー";
-          dst_buf[loc] = c;
         }
-      } else if (sTILDES.count(c)) {
-        if (option.tilde == NormalizationOption::TildeMode::Ignore) {
-          // pass
-        } else if (option.tilde == NormalizationOption::TildeMode::Normalize) {
-          c = "~";
-        } else if (option.tilde == NormalizationOption::TildeMode::Zenkaku) {
-          c = "〜";
-        } else {
+        if (e.referenced) {
+          e.referenced = false;
           continue;
         }
+        remove(idx);
+        return;
+      }
+    }
+  };
 
-        dst_buf[loc] = c;
+  // Bytes counted for an entry in addition to its input and output.
+  static constexpr size_t kEntryOverhead = sizeof(Entry) + 32;
 
-      } else {
+  explicit Impl(const NormalizationCacheOption &cache_option)
+      : option(cache_option) {
+    uint32_t n = 1;
+    while (n < cache_option.num_shards) {
+      n *= 2;
+    }
+    num_shards = n;
+    shard_bytes = cache_option.max_bytes / n;
+    shards.reset(new Shard[n]);
+  }
 
-        if (sASCII.count(c)) {
-          c = sASCII.at(c);
-        } else if (sDIGIT.count(c)) {
-          c = sDIGIT.at(c);
-        } else if (sKANA.count(c)) {
-          c = sKANA.at(c);
-        } else {
-          // Additional unicode normalizations
-          if (option.parenthesized_ideographs && sParenthesizedIdeographs.count(c)) {
-            c = sParenthesizedIdeographs.at(c);
-          }
-        }
+  // `max_tokens` is not a part of the key: it only rejects long inputs,
+  // which are not cached.
+  static uint64_t option_key(const NormalizationOption &option) {
+    return (uint64_t(option.repeat) << 32) | option.max_repeat_substr_len;
+  }
 
+  static uint32_t option_flags(const NormalizationOption &option) {
+    return uint32_t(option.remove_space) | (uint32_t(option.tilde) << 1) |
+           (uint32_t(option.parenthesized_ideographs) << 3) |
+           (uint32_t(option.invalid_char) << 4);
+  }
 
-        if ((c == "ﾞ") && (sKANA_TEN.count(prev_c))) {
-          if (loc == 0) {
-            //std::cerr << "b loc = 0\n";
-            return std::string();
-          }
-          loc--;
-          c = sKANA_TEN.at(prev_c);
-        } else if ((c == "ﾟ") && (sKANA_MARU.count(prev_c))) {
-          if (loc == 0) {
-            //std::cerr << "c loc = 0\n";
-            return std::string();
-          }
-          loc--;
-          c = sKANA_MARU.at(prev_c);
-        }
+  Shard &shard_of(uint64_t hash) {
+    return shards[size_t(hash >> 32) & (num_shards - 1)];
+  }
 
-        //std::cout << "latin_space " << latin_space << "\n";
-        //std::cout << "is_cjk_char " << detail::is_cjk_char(c) << "\n";
+  NormalizationCacheOption option;
+  uint32_t num_shards{1};
+  size_t shard_bytes{0};
+  std::unique_ptr<Shard[]> shards;
+};
 
-        // TODO: allow all non-latin char?
-        if (latin_space && detail::is_cjk_char(c) && option.remove_space) {
-          //std::cout << "latin space: c = " << c << "\n";
-          if (loc == 0) {
-            return std::string();
-          }
-          loc--;
-        }
+NormalizationCache::NormalizationCache(const NormalizationCacheOption &cache_option)
+    : impl_(new Impl(cache_option)) {}
+
+NormalizationCache::~NormalizationCache() = default;
 
-        latin_space = false;
-        dst_buf[loc] = c;
+bool NormalizationCache::normalize_into(const char *str, size_t len,
+                                        const NormalizationOption &option,
+                                        std::string &dst) {
+  static thread_local Normalizer normalizer;
+
+  Impl &impl = *impl_;
+  if (!str || (len == 0) || (len > impl.option.max_input_len) ||
+      (len > option.max_tokens)) {
+    normalizer.set_option(option);
+    return normalizer.normalize_into(str, len, dst);
+  }
+
+  const uint64_t option_key = Impl::option_key(option);
+  const uint32_t option_flags = Impl::option_flags(option);
+  const uint64_t hash = detail::hash_bytes(
+      str, len, detail::mix64(option_key) ^ option_flags);
+  Impl::Shard &shard = impl.shard_of(hash);
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it != shard.index.end()) {
+      Impl::Entry &e = shard.entries[it->second];
+      if ((e.option_key == option_key) && (e.option_flags == option_flags) &&
+          (e.input.size() == len) &&
+          (memcmp(e.input.data(), str, len) == 0)) {
+        e.referenced = true;
+        dst.assign(e.output);
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
       }
     }
+  }
+  shard.misses.fetch_add(1, std::memory_order_relaxed);
 
-    prev_c = c;
-    loc++;
+  normalizer.set_option(option);
+  if (!normalizer.normalize_into(str, len, dst)) {
+    return false;
   }
 
-  if (loc == 0) {
-    // This should not happen though.
-    //std::cerr << "e loc = 0\n";
-    return std::string();
+  size_t cost = len + dst.size() + Impl::kEntryOverhead;
+  if (cost > impl.shard_bytes) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(hash);
+  if (it != shard.index.end()) {
+    // Inserted by another thread meanwhile(or a hash collision).
+    shard.remove(it->second);
+  }
+  while ((shard.bytes + cost) > impl.shard_bytes) {
+    shard.evict_one();
+  }
+
+  uint32_t idx;
+  if (!shard.free_entries.empty()) {
+    idx = shard.free_entries.back();
+    shard.free_entries.pop_back();
+  } else {
+    idx = uint32_t(shard.entries.size());
+    shard.entries.emplace_back();
   }
 
-  if (dst_buf[loc-1] == " ") {
-    loc--;
+  Impl::Entry &e = shard.entries[idx];
+  e.hash = hash;
+  e.option_key = option_key;
+  e.option_flags = option_flags;
+  e.input.assign(str, len);
+  e.output = dst;
+  e.cost = cost;
+  e.used = true;
+  e.referenced = false;
+  shard.index[hash] = idx;
+  shard.bytes += cost;
+
+  return true;
+}
+
+uint64_t NormalizationCache::hits() const {
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < impl_->num_shards; i++) {
+    n += impl_->shards[i].hits.load(std::memory_order_relaxed);
   }
+  return n;
+}
 
-  std::string dst_str;
-  // simply concat chars.
-  for (size_t i = 0; i < loc; i++) {
-    dst_str += dst_buf[i];
+uint64_t NormalizationCache::misses() const {
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < impl_->num_shards; i++) {
+    n += impl_->shards[i].misses.load(std::memory_order_relaxed);
   }
+  return n;
+}
 
-  if (option.repeat > 0) {
-    return detail::shorten_repeat(dst_str, option.repeat, option.max_repeat);
+size_t NormalizationCache::size() const {
+  size_t n = 0;
+  for (uint32_t i = 0; i < impl_->num_shards; i++) {
+    Impl::Shard &shard = impl_->shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    n += shard.index.size();
   }
+  return n;
+}
 
-  return dst_str;
+size_t NormalizationCache::bytes() const {
+  size_t n = 0;
+  for (uint32_t i = 0; i < impl_->num_shards; i++) {
+    Impl::Shard &shard = impl_->shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    n += shard.bytes;
+  }
+  return n;
+}
+
+void NormalizationCache::clear() {
+  for (uint32_t i = 0; i < impl_->num_shards; i++) {
+    Impl::Shard &shard = impl_->shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.index.clear();
+    shard.entries.clear();
+    shard.free_entries.clear();
+    shard.hand = 0;
+    shard.bytes = 0;
+    shard.hits.store(0, std::memory_order_relaxed);
+    shard.misses.store(0, std::memory_order_relaxed);
+  }
+}
+
+std::string normalize_for_dedup(const std::string& str,
+                      const DedupNormalizationOption dedup_option) {
+  std::vector<uint32_t> codepoints;
+  std::vector<detail::RepeatRun> runs;
+
+  std::string dst;
+  bool ok = detail::normalize_for_dedup_blocks(
+      str.data(), str.size(), dedup_option, codepoints, runs,
+      [&](const uint32_t *codes, size_t n) {
+        detail::append_utf8(codes, n, dst);
+      });
+  if (!ok) {
+    dst.clear();
+  }
+  return dst;
+}
+
+void DedupHasher::compute(const char *str, size_t len,
+                          DedupSignature &signature) {
+  detail::SignatureBuilder builder(signature_option_, signature, ngram_window_);
+  bool ok = detail::normalize_for_dedup_blocks(
+      str, len, option_, codepoints_, repeat_runs_,
+      [&](const uint32_t *codes, size_t n) { builder.push(codes, n); });
+  if (!ok) {
+    // empty result.
+    signature.minhash.clear();
+    signature.simhash = 0;
+    return;
+  }
+  builder.finish();
+}
+
+DedupSignature compute_dedup_signature(
+    const std::string &str, const DedupNormalizationOption &option,
+    const DedupSignatureOption &signature_option) {
+  DedupSignature signature;
+  DedupHasher(option, signature_option).compute(str.data(), str.size(),
+                                                signature);
+  return signature;
+}
+
+double estimate_jaccard(const DedupSignature &a, const DedupSignature &b) {
+  if (a.minhash.empty() || (a.minhash.size() != b.minhash.size())) {
+    return 0.0;
+  }
+
+  size_t num_equal = 0;
+  for (size_t i = 0; i < a.minhash.size(); i++) {
+    if (a.minhash[i] == b.minhash[i]) {
+      num_equal++;
+    }
+  }
+  return double(num_equal) / double(a.minhash.size());
+}
+
+uint32_t simhash_distance(uint64_t a, uint64_t b) {
+  return detail::popcount64(a ^ b);
 }
-#endif
 
 const std::unordered_set<std::string> &get_unicode_puncts() {
-  return sUNICODE_PUNCT;
+  // Built on first use and never destroyed.
+  static const std::unordered_set<std::string> *puncts =
+      new std::unordered_set<std::string>(std::begin(kUnicodePuncts),
+                                          std::end(kUnicodePuncts));
+  return *puncts;
 }
 
 std::unordered_set<std::string> get_digits() {
 
   std::unordered_set<std::string> dst;
 
-  for (const auto &it : sDIGIT) {
-    dst.insert(it.first);
-    dst.insert(it.second);
+  for (const auto &rule : detail::kRules) {
+    uint32_t code = detail::literal_code(rule.from);
+    if ((code >= 0xff10) && (code <= 0xff19)) {  // '０' - '９'
+      dst.insert(rule.from);
+      dst.insert(rule.to);
+    }
   }
 
   return dst;
@@ -909,9 +5879,12 @@ std::unordered_set<std::string> get_digits_and_parentized_ideographs() {
 
   std::unordered_set<std::string> dst = get_digits();
 
-  for (const auto &it : sParenthesizedIdeographs) {
-    dst.insert(it.first);
-    dst.insert(it.second);
+  for (const auto &rule : detail::kRules) {
+    uint32_t code = detail::literal_code(rule.from);
+    if ((code >= 0x3220) && (code <= 0x3243)) {  // '㈠' - '㉃'
+      dst.insert(rule.from);
+      dst.insert(rule.to);
+    }
   }
 
   return dst;
@@ -0,0 +1,216 @@
+// C API of jp_normalizer(see jp_normalizer_c.h).
+//
+// $ make libjpnormalizer.so
+//
+// Only the `jpn_*` functions are exported(-fvisibility=hidden). C++
+// exceptions(std::bad_alloc) never cross the API.
+//
+#include <cstring>
+#include <new>
+#include <string>
+
+#define JPN_BUILD_SHARED
+#include "jp_normalizer_c.h"
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+
+struct jpn_options {
+  jpnormalizer::NormalizationOption option;
+};
+
+struct jpn_normalizer {
+  explicit jpn_normalizer(const jpnormalizer::NormalizationOption &option)
+      : normalizer(option) {}
+
+  jpnormalizer::Normalizer normalizer;
+  // Only for a size query or an output buffer smaller than the bound.
+  std::string result;
+};
+
+namespace {
+
+// Normalize `in` into `normalizer->result`.
+jpn_status normalize_one(jpn_normalizer *normalizer, const char *in,
+                         size_t in_len) {
+  try {
+    if (!normalizer->normalizer.normalize_into(in, in_len, normalizer->result)) {
+      return JPN_REJECTED;
+    }
+  } catch (const std::bad_alloc &) {
+    return JPN_OUT_OF_MEMORY;
+  }
+  return JPN_OK;
+}
+
+// Normalize `in` straight into out[0, out_cap), which holds at least
+// `jpn_normalize_bound(in_len)` bytes.
+jpn_status normalize_to(jpn_normalizer *normalizer, const char *in,
+                        size_t in_len, char *out, size_t out_cap,
+                        size_t &out_len) {
+  try {
+    if (!normalizer->normalizer.normalize_to(in, in_len, out, out_cap, out_len)) {
+      return JPN_REJECTED;
+    }
+  } catch (const std::bad_alloc &) {
+    out_len = 0;
+    return JPN_OUT_OF_MEMORY;
+  }
+  return JPN_OK;
+}
+
+}  // namespace
+
+extern "C" {
+
+jpn_options *jpn_options_new(void) { return new (std::nothrow) jpn_options(); }
+
+void jpn_options_free(jpn_options *options) { delete options; }
+
+void jpn_options_set_remove_space(jpn_options *options, int enable) {
+  if (options) {
+    options->option.remove_space = (enable != 0);
+  }
+}
+
+void jpn_options_set_repeat(jpn_options *options, uint32_t repeat) {
+  if (options) {
+    options->option.repeat = repeat;
+  }
+}
+
+void jpn_options_set_max_repeat_substr_len(jpn_options *options, uint32_t len) {
+  if (options) {
+    options->option.max_repeat_substr_len = len;
+  }
+}
+
+void jpn_options_set_tilde(jpn_options *options, jpn_tilde_mode mode) {
+  if (options && (mode >= JPN_TILDE_REMOVE) && (mode <= JPN_TILDE_ZENKAKU)) {
+    options->option.tilde = jpnormalizer::NormalizationOption::TildeMode(mode);
+  }
+}
+
+void jpn_options_set_parenthesized_ideographs(jpn_options *options, int enable) {
+  if (options) {
+    options->option.parenthesized_ideographs = (enable != 0);
+  }
+}
+
+void jpn_options_set_invalid_char(jpn_options *options, jpn_invalid_char_mode mode) {
+  if (options && (mode >= JPN_INVALID_STOP) && (mode <= JPN_INVALID_REPLACE)) {
+    options->option.invalid_char =
+        jpnormalizer::NormalizationOption::InvalidCharMode(mode);
+  }
+}
+
+void jpn_options_set_max_tokens(jpn_options *options, uint32_t max_tokens) {
+  if (options) {
+    options->option.max_tokens = max_tokens;
+  }
+}
+
+jpn_normalizer *jpn_normalizer_new(const jpn_options *options) {
+  jpnormalizer::NormalizationOption option;
+  if (options) {
+    option = options->option;
+  }
+  return new (std::nothrow) jpn_normalizer(option);
+}
+
+void jpn_normalizer_free(jpn_normalizer *normalizer) { delete normalizer; }
+
+size_t jpn_normalize_bound(size_t in_len) {
+  return jpnormalizer::normalize_bound(in_len);
+}
+
+jpn_status jpn_normalize(jpn_normalizer *normalizer, const char *in,
+                         size_t in_len, char *out, size_t out_cap,
+                         size_t *out_len) {
+  if (!normalizer || !out_len || (!in && (in_len > 0))) {
+    return JPN_INVALID_ARGUMENT;
+  }
+  *out_len = 0;
+
+  if (out && (out_cap >= jpn_normalize_bound(in_len))) {
+    return normalize_to(normalizer, in, in_len, out, out_cap, *out_len);
+  }
+
+  jpn_status status = normalize_one(normalizer, in, in_len);
+  if (status != JPN_OK) {
+    return status;
+  }
+
+  const std::string &result = normalizer->result;
+  *out_len = result.size();
+  if (!out) {
+    return JPN_OK;
+  }
+  if (result.size() > out_cap) {
+    return JPN_BUFFER_TOO_SMALL;
+  }
+  if (!result.empty()) {
+    memcpy(out, result.data(), result.size());
+  }
+  return JPN_OK;
+}
+
+jpn_status jpn_normalize_batch(jpn_normalizer *normalizer,
+                               const jpn_str *inputs, size_t count, char *out,
+                               size_t out_cap, jpn_str *outputs,
+                               size_t *out_len) {
+  if (!normalizer || !out_len || (!inputs && (count > 0)) ||
+      (out && !outputs)) {
+    return JPN_INVALID_ARGUMENT;
+  }
+  *out_len = 0;
+
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!inputs[i].data && (inputs[i].len > 0)) {
+      return JPN_INVALID_ARGUMENT;
+    }
+
+    // A rejected input has an empty result.
+    size_t len = 0;
+    if (out && (total <= out_cap) &&
+        ((out_cap - total) >= jpn_normalize_bound(inputs[i].len))) {
+      jpn_status status = normalize_to(normalizer, inputs[i].data, inputs[i].len,
+                                       out + total, out_cap - total, len);
+      if (status == JPN_OUT_OF_MEMORY) {
+        return status;
+      }
+      outputs[i].data = out + total;
+    } else {
+      jpn_status status = normalize_one(normalizer, inputs[i].data, inputs[i].len);
+      if (status == JPN_OUT_OF_MEMORY) {
+        return status;
+      }
+
+      const std::string &result = normalizer->result;
+      len = result.size();
+      if (out) {
+        // Entries past `out_cap` have no data.
+        outputs[i].data = nullptr;
+        if ((total <= out_cap) && (len <= (out_cap - total))) {
+          if (!result.empty()) {
+            memcpy(out + total, result.data(), len);
+          }
+          outputs[i].data = out + total;
+        }
+      }
+    }
+    if (out) {
+      outputs[i].len = len;
+    }
+    total += len;
+  }
+
+  *out_len = total;
+  if (out && (total > out_cap)) {
+    return JPN_BUFFER_TOO_SMALL;
+  }
+  return JPN_OK;
+}
+
+}  // extern "C"
@@ -0,0 +1,123 @@
+/*
+ * C API of jp_normalizer(UTF-8 only).
+ * Built as `libjpnormalizer.so` from `jp_normalizer_c.cc`(`make libjpnormalizer.so`).
+ *
+ * Results are written into caller-provided memory. No function throws or
+ * aborts; errors are returned as `jpn_status`.
+ */
+#ifndef JP_NORMALIZER_C_H_
+#define JP_NORMALIZER_C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(JPN_BUILD_SHARED)
+#define JPN_API __declspec(dllexport)
+#else
+#define JPN_API __declspec(dllimport)
+#endif
+#else
+#define JPN_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum jpn_status {
+  JPN_OK = 0,
+  /* `out_cap` is too small. The required size is set to `*out_len`. */
+  JPN_BUFFER_TOO_SMALL = 1,
+  /* The input exceeds `max_tokens`. */
+  JPN_REJECTED = 2,
+  JPN_INVALID_ARGUMENT = 3,
+  JPN_OUT_OF_MEMORY = 4
+} jpn_status;
+
+/* Same as `NormalizationOption::TildeMode`. */
+typedef enum jpn_tilde_mode {
+  JPN_TILDE_REMOVE = 0,
+  JPN_TILDE_IGNORE = 1,
+  JPN_TILDE_NORMALIZE = 2,
+  JPN_TILDE_ZENKAKU = 3
+} jpn_tilde_mode;
+
+/* Same as `NormalizationOption::InvalidCharMode`. */
+typedef enum jpn_invalid_char_mode {
+  JPN_INVALID_STOP = 0,
+  JPN_INVALID_SKIP = 1,
+  JPN_INVALID_REPLACE = 2
+} jpn_invalid_char_mode;
+
+/* Input or output string of a batch. */
+typedef struct jpn_str {
+  const char *data;
+  size_t len;
+} jpn_str;
+
+/* Opaque `NormalizationOption`. */
+typedef struct jpn_options jpn_options;
+
+/* Opaque `Normalizer`. Not thread-safe: use one per thread. */
+typedef struct jpn_normalizer jpn_normalizer;
+
+/* Options with the default values. NULL when out of memory. */
+JPN_API jpn_options *jpn_options_new(void);
+JPN_API void jpn_options_free(jpn_options *options);
+
+JPN_API void jpn_options_set_remove_space(jpn_options *options, int enable);
+JPN_API void jpn_options_set_repeat(jpn_options *options, uint32_t repeat);
+JPN_API void jpn_options_set_max_repeat_substr_len(jpn_options *options, uint32_t len);
+JPN_API void jpn_options_set_tilde(jpn_options *options, jpn_tilde_mode mode);
+JPN_API void jpn_options_set_parenthesized_ideographs(jpn_options *options, int enable);
+JPN_API void jpn_options_set_invalid_char(jpn_options *options, jpn_invalid_char_mode mode);
+JPN_API void jpn_options_set_max_tokens(jpn_options *options, uint32_t max_tokens);
+
+/* `options` is copied(NULL: default options). NULL when out of memory. */
+JPN_API jpn_normalizer *jpn_normalizer_new(const jpn_options *options);
+JPN_API void jpn_normalizer_free(jpn_normalizer *normalizer);
+
+/*
+ * Max size of the normalized text of `in_len` bytes. An output buffer of
+ * this size never returns JPN_BUFFER_TOO_SMALL.
+ */
+JPN_API size_t jpn_normalize_bound(size_t in_len);
+
+/*
+ * Normalize in[0, in_len) into out[0, out_cap). The size of the result is
+ * set to `*out_len`(the result is not NUL terminated). With
+ * `out_cap >= jpn_normalize_bound(in_len)` the result is written straight
+ * into `out`; a smaller buffer goes through an internal copy.
+ *
+ * Size query: when `out` is NULL, only `*out_len` is set. The text is
+ * normalized to compute it, so prefer `jpn_normalize_bound()` to normalize
+ * in one call.
+ */
+JPN_API jpn_status jpn_normalize(jpn_normalizer *normalizer, const char *in,
+                                 size_t in_len, char *out, size_t out_cap,
+                                 size_t *out_len);
+
+/*
+ * Normalize `count` texts in one call. The results are written back to back
+ * into out[0, out_cap), and `outputs[i]` is set to the result of `inputs[i]`
+ * (pointing into `out`). Rejected inputs have an empty result. The total
+ * size is set to `*out_len`.
+ *
+ * Size query: when `out` is NULL, only `*out_len` is set(`outputs` can be
+ * NULL). `jpn_normalize_bound()` of the total input size is always enough,
+ * and a result is written straight into `out` while the rest of the buffer
+ * holds the bound of its input.
+ * On JPN_BUFFER_TOO_SMALL, `*out_len` is the required size. The entries
+ * which did not fit have `data` NULL(`len` is still set).
+ */
+JPN_API jpn_status jpn_normalize_batch(jpn_normalizer *normalizer,
+                                       const jpn_str *inputs, size_t count,
+                                       char *out, size_t out_cap,
+                                       jpn_str *outputs, size_t *out_len);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* JP_NORMALIZER_C_H_ */
@@ -0,0 +1,268 @@
+// Command-line Japanese text normalizer.
+//
+// $ ./jpnormalize [options] [input_file(default: stdin)]
+//
+// Input files are memory-mapped. Output is written with large buffered
+// writes. POSIX only.
+//
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+#include "jpnormalize_cli.hh"
+
+namespace {
+
+using cli::kBufferSize;
+using cli::Output;
+
+void usage() {
+  std::fprintf(stderr,
+      "Usage: jpnormalize [options] [input_file]\n"
+      "\n"
+      "Normalize UTF-8 Japanese text. Reads stdin when input_file is omitted or '-'.\n"
+      "\n"
+      "  -o FILE                  Write to FILE instead of stdout.\n"
+      "  --lines                  Normalize each line independently.\n"
+      "                           (Default: normalize the whole input as one text)\n"
+      "  --threads N              Threads for a whole input file(0: all cores, default 1).\n"
+      "%s"
+      "  --stats                  Report throughput to stderr.\n"
+      "  --rule-stats             Report how often each rule fired to stderr.\n"
+      "                           (a whole input file is normalized on 1 thread)\n"
+      "  -h, --help               Show this help.\n",
+      cli::kNormalizationOptionUsage);
+}
+
+void print_rule_stats(const jpnormalizer::NormalizationStats &s) {
+  std::fprintf(stderr,
+               "bytes_in: %" PRIu64 ", bytes_out: %" PRIu64 ", chars: %" PRIu64
+               ", ascii_fast_path: %" PRIu64 "\n"
+               "halfwidth_kana: %" PRIu64 ", fullwidth_ascii: %" PRIu64
+               ", other_replaced: %" PRIu64 ", kana_merged: %" PRIu64
+               ", parenthesized: %" PRIu64 "\n"
+               "hyphens: %" PRIu64 "(collapsed %" PRIu64 "), choonpu: %" PRIu64
+               "(collapsed %" PRIu64 "), tildes_removed: %" PRIu64
+               ", tildes_replaced: %" PRIu64 "\n"
+               "spaces_removed: %" PRIu64 ", repeat_cut: %" PRIu64
+               ", invalid_sequences: %" PRIu64 ", invalid_units: %" PRIu64 "\n",
+               s.bytes_in, s.bytes_out, s.chars, s.ascii_fast_path, s.halfwidth_kana,
+               s.fullwidth_ascii, s.other_replaced, s.kana_merged, s.parenthesized,
+               s.hyphens, s.hyphens_collapsed, s.choonpu, s.choonpu_collapsed,
+               s.tildes_removed, s.tildes_replaced, s.spaces_removed, s.repeat_cut,
+               s.invalid_sequences, s.invalid_units);
+}
+
+///
+/// Normalize each line of `data`. The last line may not have '\n'.
+/// Returns the number of bytes consumed: when `eof` is false, an incomplete
+/// last line is left for the next call.
+///
+size_t normalize_lines(jpnormalizer::Normalizer &normalizer, const char *data,
+                       size_t len, bool eof, std::string &line_out,
+                       Output &out) {
+  size_t pos = 0;
+  while (pos < len) {
+    const char *nl =
+        static_cast<const char *>(std::memchr(data + pos, '\n', len - pos));
+    if (!nl && !eof) {
+      break;
+    }
+
+    size_t end = nl ? size_t(nl - data) : len;
+    normalizer.normalize_into(data + pos, end - pos, line_out);
+    out.write(line_out);
+    if (nl) {
+      out.write("\n", 1);
+      end++;
+    }
+    pos = end;
+  }
+  return pos;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  jpnormalizer::NormalizationOption option;
+  // The size of a file is limited by the memory, not by `max_tokens`.
+  option.max_tokens = 0xffffffffu;
+
+  const char *input_filename = nullptr;
+  const char *output_filename = nullptr;
+  bool lines = false;
+  bool stats = false;
+  bool rule_stats = false;
+  size_t num_threads = 1;
+  bool ok = true;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1) < argc;
+    size_t value = 0;
+
+    if ((arg == "-h") || (arg == "--help")) {
+      usage();
+      return EXIT_SUCCESS;
+    } else if ((arg == "-o") && has_value) {
+      output_filename = argv[++i];
+    } else if (arg == "--lines") {
+      lines = true;
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if (arg == "--rule-stats") {
+      rule_stats = true;
+    } else if ((arg == "--threads") && has_value && cli::parse_size(argv[i + 1], value)) {
+      num_threads = value;
+      i++;
+    } else if (cli::parse_normalization_option(argc, argv, i, option, ok)) {
+      if (!ok) {
+        return EXIT_FAILURE;
+      }
+    } else if (((arg.size() > 1) && (arg[0] == '-')) || input_filename) {
+      std::fprintf(stderr, "Invalid argument: %s\n", arg.c_str());
+      usage();
+      return EXIT_FAILURE;
+    } else {
+      input_filename = argv[i];
+    }
+  }
+
+  int in_fd = cli::open_input(input_filename);
+  if (in_fd < 0) {
+    return EXIT_FAILURE;
+  }
+  int out_fd = cli::open_output(output_filename);
+  if (out_fd < 0) {
+    return EXIT_FAILURE;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  Output out(out_fd);
+  jpnormalizer::NormalizationStats counters;
+  jpnormalizer::NormalizationStats *counters_ptr = rule_stats ? &counters : nullptr;
+  size_t bytes_read = 0;
+
+  cli::MappedFile file;
+  if (file.map(in_fd)) {
+    bytes_read = file.size();
+
+    if (lines) {
+      jpnormalizer::Normalizer normalizer(option);
+      normalizer.set_stats(counters_ptr);
+      std::string line_out;
+      normalize_lines(normalizer, file.data(), file.size(), /* eof */true,
+                      line_out, out);
+    } else if ((num_threads != 1) && !rule_stats && (file.size() <= option.max_tokens)) {
+      std::string result;
+      jpnormalizer::normalize_parallel(file.data(), file.size(), result, option,
+                                       num_threads);
+      out.write(result);
+    } else {
+      // Constant memory regardless of the file size.
+      jpnormalizer::StreamNormalizer stream(option);
+      stream.set_stats(counters_ptr);
+      std::string result;
+      for (size_t pos = 0; pos < file.size(); pos += kBufferSize) {
+        size_t len = (std::min)(kBufferSize, file.size() - pos);
+        stream.feed(file.data() + pos, len, result);
+        out.write(result);
+        result.clear();
+      }
+      stream.finish(result);
+      out.write(result);
+    }
+  } else {
+    // pipe or terminal.
+    std::string buf(kBufferSize, '\0');
+    std::string result;
+
+    if (lines) {
+      jpnormalizer::Normalizer normalizer(option);
+      normalizer.set_stats(counters_ptr);
+      size_t pending = 0;  // bytes of an incomplete line at the front of `buf`.
+      for (;;) {
+        if (pending == buf.size()) {
+          // a very long line.
+          buf.resize(buf.size() * 2);
+        }
+
+        ssize_t n = cli::read_some(in_fd, &buf[pending], buf.size() - pending);
+        if (n < 0) {
+          std::fprintf(stderr, "Read error: %s\n", std::strerror(errno));
+          ok = false;
+          break;
+        }
+
+        bytes_read += size_t(n);
+        bool eof = (n == 0);
+        size_t len = pending + size_t(n);
+        size_t consumed =
+            normalize_lines(normalizer, buf.data(), len, eof, result, out);
+        pending = len - consumed;
+        std::memmove(&buf[0], buf.data() + consumed, pending);
+
+        if (eof) {
+          break;
+        }
+      }
+    } else {
+      jpnormalizer::StreamNormalizer stream(option);
+      stream.set_stats(counters_ptr);
+      for (;;) {
+        ssize_t n = cli::read_some(in_fd, &buf[0], buf.size());
+        if (n < 0) {
+          std::fprintf(stderr, "Read error: %s\n", std::strerror(errno));
+          ok = false;
+          break;
+        }
+        if (n == 0) {
+          break;
+        }
+
+        bytes_read += size_t(n);
+        stream.feed(buf.data(), size_t(n), result);
+        out.write(result);
+        result.clear();
+      }
+      stream.finish(result);
+      out.write(result);
+    }
+  }
+
+  // A failed write is reported once here(`ok` is for read errors).
+  out.flush();
+  if (out.error() != 0) {
+    std::fprintf(stderr, "Write error: %s\n", std::strerror(out.error()));
+    ok = false;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  if (stats) {
+    double sec = std::chrono::duration<double>(end - start).count();
+    std::fprintf(stderr,
+                 "input: %zu bytes, output: %zu bytes, %.3f sec, %.2f MB/s\n",
+                 bytes_read, out.bytes_written(), sec,
+                 double(bytes_read) / (1024.0 * 1024.0) / ((sec > 0.0) ? sec : 1e-9));
+  }
+
+  if (rule_stats) {
+    print_rule_stats(counters);
+  }
+
+  if (in_fd != STDIN_FILENO) {
+    ::close(in_fd);
+  }
+  if ((out_fd != STDOUT_FILENO) && (::close(out_fd) != 0)) {
+    ok = false;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,272 @@
+// Shared parts of the command-line tools(jpnormalize, jpnormalize-jsonl).
+// Include after jp_normalizer.hh. POSIX only.
+//
+#ifndef JPNORMALIZE_CLI_HH_
+#define JPNORMALIZE_CLI_HH_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace cli {
+
+const size_t kBufferSize = 1024 * 1024;
+
+// Help of the options parsed by `parse_normalization_option()`.
+const char kNormalizationOptionUsage[] =
+    "  --repeat N               Shorten repeats of more than N times(default 0: off).\n"
+    "  --max-repeat-substr-len N\n"
+    "                           Max length of a repeated substring(default 8).\n"
+    "  --keep-space             Do not remove spaces.\n"
+    "  --tilde MODE             remove(default), ignore, normalize or zenkaku.\n"
+    "  --invalid MODE           Invalid UTF-8: stop(default), skip or replace(U+FFFD).\n"
+    "  --no-parenthesized-ideographs\n"
+    "                           Do not expand parenthesized ideographs(e.g. '㈱').\n";
+
+///
+/// Buffered output to a file descriptor.
+/// Large data is written directly together with the buffered bytes by
+/// `writev()`, without copying. The `errno` of the first failed write is
+/// kept in `error()`.
+///
+class Output {
+ public:
+  explicit Output(int fd) : fd_(fd) { buf_.reserve(kBufferSize); }
+
+  bool write(const char *data, size_t len) {
+    if ((buf_.size() + len) <= kBufferSize) {
+      buf_.append(data, len);
+      return true;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = &buf_[0];
+    iov[0].iov_len = buf_.size();
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = len;
+
+    bool ret = write_all(iov, 2);
+    buf_.clear();
+    return ret;
+  }
+
+  bool write(const std::string &str) { return write(str.data(), str.size()); }
+
+  bool flush() {
+    struct iovec iov[1];
+    iov[0].iov_base = &buf_[0];
+    iov[0].iov_len = buf_.size();
+
+    bool ret = write_all(iov, 1);
+    buf_.clear();
+    return ret;
+  }
+
+  size_t bytes_written() const { return bytes_written_; }
+
+  // `errno` of the first failed write(0: none).
+  int error() const { return error_; }
+
+ private:
+  bool write_all(struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+      if (iov[0].iov_len == 0) {
+        iov++;
+        iovcnt--;
+        continue;
+      }
+
+      ssize_t n = ::writev(fd_, iov, iovcnt);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (error_ == 0) {
+          error_ = errno;
+        }
+        return false;
+      }
+
+      size_t written = size_t(n);
+      bytes_written_ += written;
+      while ((iovcnt > 0) && (written >= iov[0].iov_len)) {
+        written -= iov[0].iov_len;
+        iov++;
+        iovcnt--;
+      }
+      if (iovcnt > 0) {
+        iov[0].iov_base = static_cast<char *>(iov[0].iov_base) + written;
+        iov[0].iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+  int fd_;
+  std::string buf_;
+  size_t bytes_written_{0};
+  int error_{0};
+};
+
+///
+/// Read-only memory mapping of a whole file.
+///
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (addr_) {
+      ::munmap(addr_, size_);
+    }
+  }
+
+  // Returns false when `fd` cannot be mapped(e.g. pipe). The caller should
+  // read it instead.
+  bool map(int fd) {
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+      return false;
+    }
+
+    size_ = size_t(st.st_size);
+    if (size_ == 0) {
+      return true;
+    }
+
+    void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      size_ = 0;
+      return false;
+    }
+    addr_ = addr;
+
+#if defined(POSIX_MADV_SEQUENTIAL)
+    ::posix_madvise(addr_, size_, POSIX_MADV_SEQUENTIAL);
+#endif
+    return true;
+  }
+
+  const char *data() const { return static_cast<const char *>(addr_); }
+  size_t size() const { return size_; }
+
+ private:
+  void *addr_{nullptr};
+  size_t size_{0};
+};
+
+// Read up to `len` bytes. Returns the bytes read(0 at EOF), or -1 on error.
+inline ssize_t read_some(int fd, char *buf, size_t len) {
+  for (;;) {
+    ssize_t n = ::read(fd, buf, len);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    return n;
+  }
+}
+
+inline bool parse_size(const char *s, size_t &value) {
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long v = std::strtoull(s, &end, 10);
+  if ((errno != 0) || !end || (*end != '\0') || (end == s)) {
+    return false;
+  }
+  value = size_t(v);
+  return true;
+}
+
+///
+/// Parse a `NormalizationOption` flag at argv[i](see
+/// `kNormalizationOptionUsage`). `i` is advanced past its value.
+/// Returns false when argv[i] is not one of them. `ok` is set to false on an
+/// unknown mode(reported to stderr).
+///
+inline bool parse_normalization_option(int argc, char **argv, int &i,
+                                       jpnormalizer::NormalizationOption &option,
+                                       bool &ok) {
+  std::string arg = argv[i];
+  bool has_value = (i + 1) < argc;
+  size_t value = 0;
+
+  if (arg == "--keep-space") {
+    option.remove_space = false;
+  } else if (arg == "--no-parenthesized-ideographs") {
+    option.parenthesized_ideographs = false;
+  } else if ((arg == "--repeat") && has_value && parse_size(argv[i + 1], value)) {
+    option.repeat = uint32_t(value);
+    i++;
+  } else if ((arg == "--max-repeat-substr-len") && has_value &&
+             parse_size(argv[i + 1], value)) {
+    option.max_repeat_substr_len = uint32_t(value);
+    i++;
+  } else if ((arg == "--tilde") && has_value) {
+    std::string mode = argv[++i];
+    if (mode == "remove") {
+      option.tilde = jpnormalizer::NormalizationOption::TildeMode::Remove;
+    } else if (mode == "ignore") {
+      option.tilde = jpnormalizer::NormalizationOption::TildeMode::Ignore;
+    } else if (mode == "normalize") {
+      option.tilde = jpnormalizer::NormalizationOption::TildeMode::Normalize;
+    } else if (mode == "zenkaku") {
+      option.tilde = jpnormalizer::NormalizationOption::TildeMode::Zenkaku;
+    } else {
+      std::fprintf(stderr, "Unknown tilde mode: %s\n", mode.c_str());
+      ok = false;
+    }
+  } else if ((arg == "--invalid") && has_value) {
+    std::string mode = argv[++i];
+    if (mode == "stop") {
+      option.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Stop;
+    } else if (mode == "skip") {
+      option.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Skip;
+    } else if (mode == "replace") {
+      option.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Replace;
+    } else {
+      std::fprintf(stderr, "Unknown invalid mode: %s\n", mode.c_str());
+      ok = false;
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Open the input(stdin for nullptr or "-"). Returns -1 on error(reported).
+inline int open_input(const char *filename) {
+  if (!filename || (std::strcmp(filename, "-") == 0)) {
+    return STDIN_FILENO;
+  }
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    std::fprintf(stderr, "Failed to open %s: %s\n", filename, std::strerror(errno));
+  }
+  return fd;
+}
+
+// Open the output(stdout for nullptr or "-"). Returns -1 on error(reported).
+inline int open_output(const char *filename) {
+  if (!filename || (std::strcmp(filename, "-") == 0)) {
+    return STDOUT_FILENO;
+  }
+  int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::fprintf(stderr, "Failed to open %s: %s\n", filename, std::strerror(errno));
+  }
+  return fd;
+}
+
+}  // namespace cli
+
+#endif  // JPNORMALIZE_CLI_HH_
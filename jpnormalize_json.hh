@@ -0,0 +1,367 @@
+// JSON Lines scanning of jpnormalize-jsonl: find a top-level string field of
+// a record, unescape it and escape the normalized text back.
+// Include after jp_normalizer.hh.
+//
+#ifndef JPNORMALIZE_JSON_HH_
+#define JPNORMALIZE_JSON_HH_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace jsonl {
+
+inline bool is_json_space(char c) {
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+inline const char *skip_space(const char *p, const char *end) {
+  while ((p < end) && is_json_space(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// `p` is after the opening '"'. Returns the closing '"', or nullptr when the
+// string is not terminated. `escaped` is set when it has a backslash.
+inline const char *find_string_end(const char *p, const char *end, bool &escaped) {
+  while (p < end) {
+    if (*p == '"') {
+      return p;
+    }
+    if (*p == '\\') {
+      escaped = true;
+      if (++p == end) {
+        break;
+      }
+    }
+    p++;
+  }
+  return nullptr;
+}
+
+// Returns the end of the value at `p`, or nullptr when it is malformed.
+// Only strings and brackets are checked.
+inline const char *skip_value(const char *p, const char *end) {
+  bool escaped = false;
+  if (*p == '"') {
+    const char *q = find_string_end(p + 1, end, escaped);
+    return q ? (q + 1) : nullptr;
+  }
+
+  if ((*p == '{') || (*p == '[')) {
+    size_t depth = 0;
+    for (; p < end; p++) {
+      if (*p == '"') {
+        p = find_string_end(p + 1, end, escaped);
+        if (!p) {
+          return nullptr;
+        }
+      } else if ((*p == '{') || (*p == '[')) {
+        depth++;
+      } else if ((*p == '}') || (*p == ']')) {
+        if (--depth == 0) {
+          return p + 1;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  // number, true, false or null.
+  const char *q = p;
+  while ((q < end) && !is_json_space(*q) && (*q != ',') && (*q != '}') && (*q != ']')) {
+    q++;
+  }
+  return (q == p) ? nullptr : q;
+}
+
+inline bool parse_hex4(const char *s, const char *end, uint32_t &code) {
+  if ((end - s) < 4) {
+    return false;
+  }
+  code = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = s[i];
+    uint32_t v;
+    if ((c >= '0') && (c <= '9')) {
+      v = uint32_t(c - '0');
+    } else if ((c >= 'a') && (c <= 'f')) {
+      v = uint32_t(c - 'a' + 10);
+    } else if ((c >= 'A') && (c <= 'F')) {
+      v = uint32_t(c - 'A' + 10);
+    } else {
+      return false;
+    }
+    code = (code << 4) | v;
+  }
+  return true;
+}
+
+///
+/// Unescape the content of a JSON string into `dst`(UTF-8).
+/// A lone surrogate becomes U+FFFD. Returns false on an invalid escape.
+///
+inline bool unescape_json(const char *s, size_t len, std::string &dst) {
+  dst.clear();
+  const char *end = s + len;
+  while (s < end) {
+    const char *bs = static_cast<const char *>(std::memchr(s, '\\', size_t(end - s)));
+    if (!bs) {
+      dst.append(s, size_t(end - s));
+      break;
+    }
+    dst.append(s, size_t(bs - s));
+    if ((bs + 1) == end) {
+      return false;
+    }
+
+    s = bs + 2;
+    switch (bs[1]) {
+      case '"':
+      case '\\':
+      case '/':
+        dst += bs[1];
+        break;
+      case 'b':
+        dst += '\b';
+        break;
+      case 'f':
+        dst += '\f';
+        break;
+      case 'n':
+        dst += '\n';
+        break;
+      case 'r':
+        dst += '\r';
+        break;
+      case 't':
+        dst += '\t';
+        break;
+      case 'u': {
+        uint32_t code;
+        if (!parse_hex4(s, end, code)) {
+          return false;
+        }
+        s += 4;
+        if ((code >= 0xd800) && (code <= 0xdfff)) {
+          uint32_t low;
+          if ((code <= 0xdbff) && ((end - s) >= 6) && (s[0] == '\\') && (s[1] == 'u') &&
+              parse_hex4(s + 2, end, low) && (low >= 0xdc00) && (low <= 0xdfff)) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            s += 6;
+          } else {
+            code = 0xfffd;
+          }
+        }
+        char buf[4];
+        dst.append(buf, jpnormalizer::detail::encode_utf8(code, buf));
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+///
+/// Append `s` to `out` as the content of a JSON string. Only '"', '\' and
+/// control chars are escaped; non-ASCII chars are output as is.
+///
+inline void escape_json(const char *s, size_t len, std::string &out) {
+  static const char kHex[] = "0123456789abcdef";
+  size_t run = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = uint8_t(s[i]);
+    if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+      continue;
+    }
+    out.append(s + run, i - run);
+    run = i + 1;
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\b':
+        out += "\\b";
+        break;
+      case '\f':
+        out += "\\f";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        out += "\\u00";
+        out += kHex[c >> 4];
+        out += kHex[c & 0xf];
+        break;
+    }
+  }
+  out.append(s + run, len - run);
+}
+
+///
+/// Find the string value of the top-level `key` of the JSON object
+/// line[0, len). [begin, end) is set to the raw value(without quotes).
+/// For a duplicate key the last one is taken, as most JSON parsers do.
+/// Returns false when the line is not an object, or the key is missing or
+/// not a string.
+///
+inline bool find_string_field(const char *line, size_t len, const std::string &key,
+                              std::string &scratch, const char *&begin,
+                              const char *&end, bool &escaped) {
+  const char *line_end = line + len;
+  const char *p = skip_space(line, line_end);
+  if ((p == line_end) || (*p != '{')) {
+    return false;
+  }
+  p = skip_space(p + 1, line_end);
+  if ((p != line_end) && (*p == '}')) {
+    return false;
+  }
+
+  bool found = false;
+  for (;;) {
+    if ((p == line_end) || (*p != '"')) {
+      return false;
+    }
+
+    bool key_escaped = false;
+    const char *key_end = find_string_end(p + 1, line_end, key_escaped);
+    if (!key_end) {
+      return false;
+    }
+    size_t key_len = size_t(key_end - (p + 1));
+    bool match = key_escaped
+                     ? (unescape_json(p + 1, key_len, scratch) && (scratch == key))
+                     : ((key_len == key.size()) && (std::memcmp(p + 1, key.data(), key_len) == 0));
+
+    p = skip_space(key_end + 1, line_end);
+    if ((p == line_end) || (*p != ':')) {
+      return false;
+    }
+    p = skip_space(p + 1, line_end);
+    if (p == line_end) {
+      return false;
+    }
+
+    if (match) {
+      found = (*p == '"');
+      if (found) {
+        escaped = false;
+        const char *value_end = find_string_end(p + 1, line_end, escaped);
+        if (!value_end) {
+          return false;
+        }
+        begin = p + 1;
+        end = value_end;
+      }
+    }
+
+    p = skip_value(p, line_end);
+    if (!p) {
+      return false;
+    }
+    p = skip_space(p, line_end);
+    if ((p != line_end) && (*p == '}')) {
+      return found;
+    }
+    if ((p == line_end) || (*p != ',')) {
+      return false;
+    }
+    p = skip_space(p + 1, line_end);
+  }
+}
+
+struct Counters {
+  uint64_t records{0};
+  uint64_t normalized{0};
+};
+
+///
+/// Normalizes the field of each record. One per thread.
+///
+class RecordRewriter {
+ public:
+  RecordRewriter(const jpnormalizer::NormalizationOption &option, const std::string &field)
+      : normalizer_(option), field_(field) {}
+
+  ///
+  /// Rewrite the lines data[0, len) and append them to `out`. A line is
+  /// terminated by '\n'(the last one may be unterminated), and a '\r' before
+  /// it is kept as is.
+  ///
+  void rewrite(const char *data, size_t len, std::string &out) {
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+      const char *nl = static_cast<const char *>(std::memchr(p, '\n', size_t(end - p)));
+      const char *line_end = nl ? nl : end;
+      if (line_end != p) {
+        rewrite_record(p, size_t(line_end - p), out);
+      }
+      if (nl) {
+        out += '\n';
+        line_end++;
+      }
+      p = line_end;
+    }
+  }
+
+  const Counters &counters() const { return counters_; }
+
+ private:
+  void rewrite_record(const char *line, size_t len, std::string &out) {
+    counters_.records++;
+
+    const char *begin;
+    const char *end;
+    bool escaped;
+    if (!find_string_field(line, len, field_, scratch_, begin, end, escaped)) {
+      out.append(line, len);
+      return;
+    }
+
+    const char *text = begin;
+    size_t text_len = size_t(end - begin);
+    if (escaped) {
+      if (!unescape_json(begin, text_len, scratch_)) {
+        out.append(line, len);
+        return;
+      }
+      text = scratch_.data();
+      text_len = scratch_.size();
+    }
+
+    if (!normalizer_.normalize_into(text, text_len, normalized_)) {
+      out.append(line, len);
+      return;
+    }
+
+    out.append(line, size_t(begin - line));
+    escape_json(normalized_.data(), normalized_.size(), out);
+    out.append(end, size_t((line + len) - end));
+    counters_.normalized++;
+  }
+
+  jpnormalizer::Normalizer normalizer_;
+  const std::string &field_;
+  std::string scratch_;
+  std::string normalized_;
+  Counters counters_;
+};
+
+}  // namespace jsonl
+
+#endif  // JPNORMALIZE_JSON_HH_
@@ -0,0 +1,412 @@
+// Normalize a string field of each JSON Lines record.
+//
+// $ ./jpnormalize-jsonl [options] [input_file(default: stdin)]
+//
+// A reader(main thread), N normalizer workers and an ordered writer are
+// connected by bounded lock-free queues. The input is split into batches of
+// whole lines. Workers rewrite the field of each record, and the writer
+// outputs the batches in input order. Only the value of the field is
+// unescaped and escaped again; the rest of a record is copied verbatim.
+// POSIX only.
+//
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define JP_NORMALIZER_IMPLEMENTATION
+#include "jp_normalizer.hh"
+#include "jpnormalize_cli.hh"
+#include "jpnormalize_json.hh"
+
+namespace {
+
+using cli::kBufferSize;
+
+void usage() {
+  std::fprintf(stderr,
+      "Usage: jpnormalize-jsonl [options] [input_file]\n"
+      "\n"
+      "Normalize a string field of each JSON Lines record. Other fields, and records\n"
+      "without the field, are copied as is. Reads stdin when input_file is omitted or '-'.\n"
+      "\n"
+      "  -o FILE                  Write to FILE instead of stdout.\n"
+      "  --field NAME             Top-level field to normalize(default \"text\").\n"
+      "  --threads N              Normalizer threads(0: all cores, default 0).\n"
+      "%s"
+      "  --stats                  Report throughput to stderr.\n"
+      "  -h, --help               Show this help.\n",
+      cli::kNormalizationOptionUsage);
+}
+
+///
+/// Wait for a queue: spin, then yield, then sleep, so that idle threads do
+/// not burn cores while the disk is the bottleneck.
+///
+class Backoff {
+ public:
+  void wait() {
+    if (count_ >= 64) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      return;
+    }
+    if (count_ >= 16) {
+      std::this_thread::yield();
+    }
+    count_++;
+  }
+
+ private:
+  unsigned count_{0};
+};
+
+///
+/// Bounded lock-free MPMC queue(Vyukov's). The sequence number of a cell
+/// tells whether it is ready for the next push or pop.
+///
+template <class T>
+class BoundedQueue {
+ public:
+  // `capacity` is rounded up to a power of 2.
+  explicit BoundedQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    cells_.reset(new Cell[n]);
+    mask_ = n - 1;
+    for (size_t i = 0; i < n; i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false when full.
+  bool try_push(T value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells_[pos & mask_];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false when empty.
+  bool try_pop(T &value) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells_[pos & mask_];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      if (seq == (pos + 1)) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = cell.value;
+          cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < (pos + 1)) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(T value) {
+    Backoff backoff;
+    while (!try_push(value)) {
+      backoff.wait();
+    }
+  }
+
+  T pop() {
+    T value;
+    Backoff backoff;
+    while (!try_pop(value)) {
+      backoff.wait();
+    }
+    return value;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_{0};
+  // On separate cache lines, so that producers and consumers do not share one.
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) std::atomic<size_t> head_{0};
+};
+
+///
+/// Whole lines of the input, and their result.
+///
+struct Batch {
+  uint64_t seq{0};
+  const char *data{nullptr};  // into the mapped file or `input`.
+  size_t len{0};
+  std::string input;  // read buffer for a pipe.
+  std::string output;
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  jpnormalizer::NormalizationOption option;
+  // The size of a record is limited by the memory, not by `max_tokens`.
+  option.max_tokens = 0xffffffffu;
+
+  const char *input_filename = nullptr;
+  const char *output_filename = nullptr;
+  std::string field = "text";
+  bool stats = false;
+  size_t num_threads = 0;
+  bool ok = true;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1) < argc;
+    size_t value = 0;
+
+    if ((arg == "-h") || (arg == "--help")) {
+      usage();
+      return EXIT_SUCCESS;
+    } else if ((arg == "-o") && has_value) {
+      output_filename = argv[++i];
+    } else if ((arg == "--field") && has_value) {
+      field = argv[++i];
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if ((arg == "--threads") && has_value && cli::parse_size(argv[i + 1], value)) {
+      num_threads = value;
+      i++;
+    } else if (cli::parse_normalization_option(argc, argv, i, option, ok)) {
+      if (!ok) {
+        return EXIT_FAILURE;
+      }
+    } else if (((arg.size() > 1) && (arg[0] == '-')) || input_filename) {
+      std::fprintf(stderr, "Invalid argument: %s\n", arg.c_str());
+      usage();
+      return EXIT_FAILURE;
+    } else {
+      input_filename = argv[i];
+    }
+  }
+
+  if (num_threads == 0) {
+    num_threads = (std::max)(1u, std::thread::hardware_concurrency());
+  }
+
+  int in_fd = cli::open_input(input_filename);
+  if (in_fd < 0) {
+    return EXIT_FAILURE;
+  }
+  int out_fd = cli::open_output(output_filename);
+  if (out_fd < 0) {
+    return EXIT_FAILURE;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  // Batches in flight. Bounds the memory and how far the workers run ahead
+  // of the writer.
+  const size_t num_batches = num_threads * 2 + 2;
+  std::vector<Batch> batches(num_batches);
+
+  // nullptr tells a worker(and the writer) that the input is done.
+  BoundedQueue<Batch *> free_queue(num_batches + num_threads);
+  BoundedQueue<Batch *> work_queue(num_batches + num_threads);
+  BoundedQueue<Batch *> done_queue(num_batches + num_threads);
+  for (Batch &batch : batches) {
+    free_queue.push(&batch);
+  }
+
+  std::vector<jsonl::Counters> counters(num_threads);
+  std::vector<std::thread> workers;
+  workers.reserve(num_threads);
+  for (size_t w = 0; w < num_threads; w++) {
+    workers.emplace_back([&, w]() {
+      jsonl::RecordRewriter rewriter(option, field);
+      while (Batch *batch = work_queue.pop()) {
+        batch->output.clear();
+        batch->output.reserve(batch->len + batch->len / 8);
+        rewriter.rewrite(batch->data, batch->len, batch->output);
+        done_queue.push(batch);
+      }
+      counters[w] = rewriter.counters();
+      done_queue.push(nullptr);
+    });
+  }
+
+  cli::Output out(out_fd);
+  bool write_ok = true;
+  int write_errno = 0;  // `errno` is per thread.
+  std::thread writer([&]() {
+    // Results by `seq % num_batches`: at most `num_batches` are in flight.
+    std::vector<Batch *> pending(num_batches, nullptr);
+    uint64_t next = 0;
+    size_t finished = 0;
+    while (finished < num_threads) {
+      Batch *batch = done_queue.pop();
+      if (!batch) {
+        finished++;
+        continue;
+      }
+      pending[batch->seq % num_batches] = batch;
+      while (Batch *ready = pending[next % num_batches]) {
+        if (!out.write(ready->output) && write_ok) {
+          write_ok = false;
+          write_errno = errno;
+        }
+        pending[next % num_batches] = nullptr;
+        next++;
+        free_queue.push(ready);
+      }
+    }
+    if (!out.flush() && write_ok) {
+      write_ok = false;
+      write_errno = errno;
+    }
+  });
+
+  // Reader: split the input into batches of whole lines.
+  size_t bytes_read = 0;
+  uint64_t seq = 0;
+  cli::MappedFile file;
+  if (file.map(in_fd)) {
+    bytes_read = file.size();
+    size_t pos = 0;
+    while (pos < file.size()) {
+      size_t cut = (std::min)(pos + kBufferSize, file.size());
+      if (cut < file.size()) {
+        // Cut after the last '\n', or after the next one for a long line.
+        size_t nl = cut;
+        while ((nl > pos) && (file.data()[nl - 1] != '\n')) {
+          nl--;
+        }
+        if (nl > pos) {
+          cut = nl;
+        } else {
+          const char *next_nl = static_cast<const char *>(
+              std::memchr(file.data() + cut, '\n', file.size() - cut));
+          cut = next_nl ? size_t(next_nl - file.data()) + 1 : file.size();
+        }
+      }
+
+      Batch *batch = free_queue.pop();
+      batch->seq = seq++;
+      batch->data = file.data() + pos;
+      batch->len = cut - pos;
+      work_queue.push(batch);
+      pos = cut;
+    }
+  } else {
+    // pipe or terminal.
+    std::string carry;  // an incomplete line at the end of the last batch.
+    bool eof = false;
+    while (!eof) {
+      Batch *batch = free_queue.pop();
+      std::string &buf = batch->input;
+      buf.assign(carry);
+      buf.resize((std::max)(kBufferSize, carry.size() * 2));
+      size_t filled = carry.size();
+      bool has_nl = false;
+
+      for (;;) {
+        if (filled == buf.size()) {
+          if (has_nl) {
+            break;
+          }
+          // a very long line.
+          buf.resize(buf.size() * 2);
+        }
+
+        ssize_t n = cli::read_some(in_fd, &buf[filled], buf.size() - filled);
+        if (n < 0) {
+          std::fprintf(stderr, "Read error: %s\n", std::strerror(errno));
+          ok = false;
+        }
+        if (n <= 0) {
+          eof = true;
+          break;
+        }
+
+        has_nl = has_nl || (std::memchr(&buf[filled], '\n', size_t(n)) != nullptr);
+        filled += size_t(n);
+        bytes_read += size_t(n);
+      }
+
+      size_t cut = filled;
+      if (!eof) {
+        while (buf[cut - 1] != '\n') {
+          cut--;
+        }
+      }
+      carry.assign(buf, cut, filled - cut);
+
+      if (cut == 0) {
+        free_queue.push(batch);
+        continue;
+      }
+      batch->seq = seq++;
+      batch->data = buf.data();
+      batch->len = cut;
+      work_queue.push(batch);
+    }
+  }
+
+  for (size_t w = 0; w < num_threads; w++) {
+    work_queue.push(nullptr);
+  }
+  for (std::thread &th : workers) {
+    th.join();
+  }
+  writer.join();
+
+  if (!write_ok) {
+    std::fprintf(stderr, "Write error: %s\n", std::strerror(write_errno));
+    ok = false;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  if (stats) {
+    jsonl::Counters total;
+    for (const jsonl::Counters &c : counters) {
+      total.records += c.records;
+      total.normalized += c.normalized;
+    }
+    double sec = std::chrono::duration<double>(end - start).count();
+    std::fprintf(stderr,
+                 "input: %zu bytes, output: %zu bytes, records: %" PRIu64
+                 "(normalized %" PRIu64 "), %.3f sec, %.2f MB/s\n",
+                 bytes_read, out.bytes_written(), total.records, total.normalized, sec,
+                 double(bytes_read) / (1024.0 * 1024.0) / ((sec > 0.0) ? sec : 1e-9));
+  }
+
+  if (in_fd != STDIN_FILENO) {
+    ::close(in_fd);
+  }
+  if ((out_fd != STDOUT_FILENO) && (::close(out_fd) != 0)) {
+    ok = false;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
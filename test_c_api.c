@@ -0,0 +1,100 @@
+/* Test of the C API(libjpnormalizer.so). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jp_normalizer_c.h"
+
+#define CHECK(cond, name) do { \
+  if (cond) { \
+    printf("ok: %s\n", name); \
+  } else { \
+    fprintf(stderr, "fail: %s\n", name); \
+    failed = 1; \
+  } \
+} while (0)
+
+int main(void) {
+  int failed = 0;
+  const char *text = "ﾊﾝｶｸｶﾅ ㈱ ～";
+  const char *expected = "ハンカクカナ(株)";
+
+  jpn_normalizer *normalizer = jpn_normalizer_new(NULL);
+
+  {
+    char out[64];
+    size_t out_len = 0;
+    jpn_status status = jpn_normalize(normalizer, text, strlen(text), out,
+                                      sizeof(out), &out_len);
+    CHECK((status == JPN_OK) && (out_len == strlen(expected)) &&
+          (memcmp(out, expected, out_len) == 0), "jpn_normalize");
+  }
+
+  {
+    size_t out_len = 0;
+    jpn_status status = jpn_normalize(normalizer, text, strlen(text), NULL, 0, &out_len);
+    CHECK((status == JPN_OK) && (out_len == strlen(expected)), "jpn_normalize(size query)");
+
+    char out[4];
+    status = jpn_normalize(normalizer, text, strlen(text), out, sizeof(out), &out_len);
+    CHECK((status == JPN_BUFFER_TOO_SMALL) && (out_len == strlen(expected)),
+          "jpn_normalize(buffer too small)");
+  }
+
+  {
+    jpn_options *options = jpn_options_new();
+    jpn_options_set_tilde(options, JPN_TILDE_ZENKAKU);
+    jpn_options_set_invalid_char(options, JPN_INVALID_REPLACE);
+    jpn_normalizer *zenkaku = jpn_normalizer_new(options);
+    jpn_options_free(options);
+
+    const char *in = "~\xff";
+    char out[16];
+    size_t out_len = 0;
+    jpn_status status = jpn_normalize(zenkaku, in, strlen(in), out,
+                                      jpn_normalize_bound(strlen(in)), &out_len);
+    CHECK((status == JPN_OK) && (out_len == 6) &&
+          (memcmp(out, "\xe3\x80\x9c\xef\xbf\xbd", 6) == 0), "jpn_normalize_bound");
+    jpn_normalizer_free(zenkaku);
+  }
+
+  {
+    jpn_str inputs[3] = {{"ｱｲｳ", 9}, {"", 0}, {"ＡＢＣ　ｄｅｆ", 21}};
+    jpn_str outputs[3];
+    size_t total = 0;
+    jpn_status status = jpn_normalize_batch(normalizer, inputs, 3, NULL, 0, NULL, &total);
+    CHECK((status == JPN_OK) && (total == 16), "jpn_normalize_batch(size query)");
+
+    char *out = (char *)malloc(total);
+    status = jpn_normalize_batch(normalizer, inputs, 3, out, total, outputs, &total);
+    CHECK((status == JPN_OK) && (outputs[0].len == 9) &&
+          (memcmp(outputs[0].data, "アイウ", 9) == 0) && (outputs[1].len == 0) &&
+          (outputs[2].len == 7) && (memcmp(outputs[2].data, "ABC def", 7) == 0),
+          "jpn_normalize_batch");
+    free(out);
+
+    /* Written straight into `out`. */
+    out = (char *)malloc(jpn_normalize_bound(9 + 0 + 21));
+    status = jpn_normalize_batch(normalizer, inputs, 3, out, jpn_normalize_bound(9 + 0 + 21),
+                                 outputs, &total);
+    CHECK((status == JPN_OK) && (total == 16) && (outputs[0].data == out) &&
+          (memcmp(outputs[0].data, "アイウ", 9) == 0) && (outputs[2].data == out + 9) &&
+          (memcmp(outputs[2].data, "ABC def", 7) == 0),
+          "jpn_normalize_batch(bound)");
+    free(out);
+
+    /* Only outputs[0] fits. The others have no data. */
+    char small[12];
+    status = jpn_normalize_batch(normalizer, inputs, 3, small, sizeof(small), outputs, &total);
+    CHECK((status == JPN_BUFFER_TOO_SMALL) && (total == 16) &&
+          (outputs[0].data == small) && (outputs[0].len == 9) &&
+          (memcmp(outputs[0].data, "アイウ", 9) == 0) &&
+          (outputs[1].data == small + 9) && (outputs[1].len == 0) &&
+          (outputs[2].data == NULL) && (outputs[2].len == 7),
+          "jpn_normalize_batch(buffer too small)");
+  }
+
+  jpn_normalizer_free(normalizer);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,7 +1,9 @@
+#include <cstring>
 #include <iostream>
 
 #define JP_NORMALIZER_IMPLEMENTATION
 #include "jp_normalizer.hh"
+#include "jpnormalize_json.hh"
 
 #ifdef __clang__
 #if __has_warning("-Wc++20-compat")
@@ -46,6 +48,9 @@ static void unit_test() {
   opt.repeat = 1;
   CHECK_TEXT_OPT("無駄無駄無駄無駄ァ", "無駄ァ", opt);
 
+  opt.repeat = 3;
+  CHECK_TEXT_OPT("草ｗｗｗｗｗｗｗ草草草草", "草www草草草", opt);
+
   opt.repeat = 0;
   opt.tilde = jpnormalizer::NormalizationOption::TildeMode::Normalize;
   CHECK_TEXT_OPT("1995〜2001年", "1995~2001年", opt);
@@ -61,6 +66,537 @@ static void unit_test() {
   // Addtional
   opt.parenthesized_ideographs = true;
   CHECK_TEXT_OPT("ﾜｶﾞﾊｲは㈱である", "ワガハイは(株)である", opt);
+
+  // Enclosed and squared forms(generated from Unicode data).
+  CHECK_TEXT_OPT("①⑳⑴ⓐⒶ", "120(1)aA", opt);
+  CHECK_TEXT_OPT("㍻元年㋿", "平成元年令和", opt);
+  CHECK_TEXT_OPT("㌔㌖㍿㎏㎡", "キロキロメートル株式会社kgm2", opt);
+  CHECK_TEXT_OPT("㋕ﾞ", "ガ", opt);
+  opt.parenthesized_ideographs = false;
+  CHECK_TEXT_OPT("①㍻㌖", "①㍻㌖", opt);
+  opt.parenthesized_ideographs = true;
+
+  // Options fixed at compile time.
+  {
+    typedef jpnormalizer::StaticNormalizationOption<
+        false, jpnormalizer::NormalizationOption::TildeMode::Zenkaku, false, 3>
+        StaticOpts;
+    opt = jpnormalizer::NormalizationOption();
+    opt.remove_space = false;
+    opt.tilde = jpnormalizer::NormalizationOption::TildeMode::Zenkaku;
+    opt.parenthesized_ideographs = false;
+    opt.repeat = 3;
+
+    const char *input = "ﾊﾝｶｸ  ｶﾅ～ ㈱ ｗｗｗｗｗ";
+    std::string out = jpnormalizer::normalize<StaticOpts>(input);
+    if (out.compare("ハンカク  カナ〜 ㈱ www") != 0) {
+      std::cerr << "fail: expected \"ハンカク  カナ〜 ㈱ www\" but got \"" << out << "\"\n";
+    } else {
+      std::cout << "ok: \"" << out << "\"\n";
+    }
+    CHECK_TEXT_OPT(input, out, opt);
+
+    out = jpnormalizer::normalize<jpnormalizer::StaticNormalizationOption<>>(input);
+    CHECK_TEXT(input, out);
+  }
+
+  // Reuse Normalizer and output buffer.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    opt.repeat = 1;
+    jpnormalizer::Normalizer normalizer(opt);
+    std::string out;
+    normalizer.normalize_into("無駄無駄無駄無駄ァ", out);
+    CHECK_TEXT_OPT("無駄無駄無駄無駄ァ", out, opt);
+    normalizer.normalize_into(std::string("ﾊﾝｶｸｶﾅ"), out);
+    CHECK_TEXT_OPT("ﾊﾝｶｸｶﾅ", out, opt);
+    const char *input = "　ＰＲＭＬ　副読本　";
+    normalizer.normalize_into(input, strlen(input), out);
+    CHECK_TEXT_OPT(input, out, opt);
+
+    // Append to the output(with and without repeat shortening).
+    for (uint32_t repeat : {0u, 1u}) {
+      opt.repeat = repeat;
+      normalizer.set_option(opt);
+      std::string appended = "ｗ";
+      normalizer.normalize_append("ﾊﾝｶｸ ｶﾅ", strlen("ﾊﾝｶｸ ｶﾅ"), appended);
+      normalizer.normalize_append("ｗｗｗ", strlen("ｗｗｗ"), appended);
+      std::string expected = "ｗ" + jpnormalizer::normalize("ﾊﾝｶｸ ｶﾅ", opt) +
+                             jpnormalizer::normalize("ｗｗｗ", opt);
+      if (appended != expected) {
+        std::cerr << "fail: expected \"" << expected << "\" but got \"" << appended << "\"\n";
+      } else {
+        std::cout << "ok: \"" << appended << "\"\n";
+      }
+
+      // Straight into a fixed buffer.
+      const char *text = "㌖ ～ ｗｗｗ\xff";
+      std::vector<char> buf(jpnormalizer::normalize_bound(strlen(text)));
+      size_t buf_len = 0;
+      bool small = normalizer.normalize_to(text, strlen(text), buf.data(),
+                                           buf.size() - 1, buf_len);
+      bool ret = normalizer.normalize_to(text, strlen(text), buf.data(),
+                                         buf.size(), buf_len);
+      expected = jpnormalizer::normalize(text, opt);
+      if (small || !ret || (std::string(buf.data(), buf_len) != expected)) {
+        std::cerr << "fail: normalize_to \"" << expected << "\"\n";
+      } else {
+        std::cout << "ok: normalize_to \"" << expected << "\"\n";
+      }
+    }
+  }
+
+  // UTF-16/UTF-32. Same result as UTF-8.
+  {
+    if (jpnormalizer::normalize(std::u16string(u"ﾊﾝｶｸ ｶﾅ～𠮷")) != u"ハンカクカナ𠮷") {
+      std::cerr << "fail: UTF-16 normalize\n";
+    } else {
+      std::cout << "ok: UTF-16 normalize\n";
+    }
+
+    const char *inputs[] = {"ﾜｶﾞﾊｲは㈱である.  ㈴ＭＡＥはまだ迺ｗｗｗｗ ",
+                            " Natural Language　Processing 𠮷野家 ",
+                            "ｳﾞｧｲｵﾘﾝ〜ﾊﾟﾊﾟーーー--1995∼2001",
+                            "㌖㍻①㋕ﾞ㍿㍿"};
+    for (int repeat = 0; repeat <= 2; repeat += 2) {
+      opt = jpnormalizer::NormalizationOption();
+      opt.repeat = uint32_t(repeat);
+      opt.tilde = jpnormalizer::NormalizationOption::TildeMode::Zenkaku;
+      for (const char *input : inputs) {
+        std::vector<uint32_t> codes = jpnormalizer::detail::to_codepoints(
+            jpnormalizer::normalize(input, opt));
+        std::u16string expected16;
+        std::u32string expected32;
+        jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), expected16);
+        jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), expected32);
+
+        codes = jpnormalizer::detail::to_codepoints(input);
+        std::u16string input16;
+        std::u32string input32;
+        jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), input16);
+        jpnormalizer::detail::codepoints_to_units(codes.data(), codes.size(), input32);
+
+        if ((jpnormalizer::normalize(input16, opt) != expected16) ||
+            (jpnormalizer::normalize(input32, opt) != expected32)) {
+          std::cerr << "fail: UTF-16/UTF-32 differs from UTF-8: \"" << input << "\"\n";
+        } else {
+          std::cout << "ok: UTF-16/UTF-32 \"" << input << "\"\n";
+        }
+      }
+    }
+  }
+
+  // Offset map.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    const std::string input = "ﾊﾟﾊﾟ abc ＡＢ ㈱テスト ｗｗｗｗ";
+    for (uint32_t repeat = 0; repeat <= 2; repeat += 2) {
+      opt.repeat = repeat;
+      jpnormalizer::OffsetMap offsets;
+      std::string out = jpnormalizer::normalize(input, opt, offsets);
+      CHECK_TEXT_OPT(input, out, opt);
+
+      // "パパabc AB (株)テストww"
+      const size_t kOutput[] = {0, 3, 6, 9, 10, 13, 18, out.size()};
+      const size_t kInput[] = {0, 6, 13, 16, 17, 24, 27, input.size()};
+      bool ok = true;
+      for (size_t i = 0; i < 8; i++) {
+        ok = ok && (jpnormalizer::map_to_input(offsets, kOutput[i]) == kInput[i]);
+      }
+      if (!ok || (offsets.back().output != out.size())) {
+        std::cerr << "fail: offset map(repeat " << repeat << ")\n";
+      } else {
+        std::cout << "ok: offset map(repeat " << repeat << ", " << offsets.size() << " entries)\n";
+      }
+    }
+  }
+
+  // Invalid UTF-8.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    const std::string input = "ﾊﾝ\xff ｶｸ\xe3\x81ﾞ abc\xed\xa0\x80";
+    if (jpnormalizer::find_invalid_utf8(input.data(), input.size()) != 6) {
+      std::cerr << "fail: find_invalid_utf8\n";
+    } else {
+      std::cout << "ok: find_invalid_utf8\n";
+    }
+
+    CHECK_TEXT_OPT(input, "ハン", opt);
+    opt.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Skip;
+    CHECK_TEXT_OPT(input, "ハンカグabc", opt);
+    opt.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Replace;
+    CHECK_TEXT_OPT(input, "ハン\uFFFDカク\uFFFDﾞabc\uFFFD\uFFFD\uFFFD", opt);
+
+    jpnormalizer::StreamNormalizer stream(opt);
+    std::string out;
+    for (size_t i = 0; i < input.size(); i++) {
+      stream.feed(&input[i], 1, out);
+    }
+    stream.finish(out);
+    CHECK_TEXT_OPT(input, out, opt);
+
+    if (jpnormalizer::normalize(std::u16string(u"ﾊﾝ") + char16_t(0xd800) + u"ｶ", opt) !=
+        u"ハン\uFFFDカ") {
+      std::cerr << "fail: UTF-16 lone surrogate\n";
+    } else {
+      std::cout << "ok: UTF-16 lone surrogate\n";
+    }
+  }
+
+  // Rule counters.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    opt.repeat = 2;
+    opt.invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Skip;
+    const std::string input = "ﾊﾟﾊﾟ  abc～ーーｰ‐‐ ㈱ ＡＢ\xff ｗｗｗｗ ";
+    jpnormalizer::NormalizationStats stats;
+    std::string out = jpnormalizer::normalize(input, opt, stats);
+    CHECK_TEXT_OPT(input, out, opt);
+
+    jpnormalizer::NormalizationStats stream_stats;
+    jpnormalizer::StreamNormalizer stream(opt);
+    stream.set_stats(&stream_stats);
+    for (size_t i = 0; i < input.size(); i++) {
+      stream.feed(&input[i], 1, out);
+    }
+    out.clear();
+    stream.finish(out);
+
+    jpnormalizer::NormalizationStats batch_stats;
+    jpnormalizer::normalize_batch(std::vector<std::string>(10, input), opt, 3, &batch_stats);
+
+    if ((stats.texts != 1) || (stats.bytes_in != input.size()) || (stats.chars != 26) ||
+        (stats.ascii_fast_path != 3) || (stats.halfwidth_kana != 2) ||
+        (stats.fullwidth_ascii != 6) || (stats.kana_merged != 2) ||
+        (stats.hyphens != 1) || (stats.hyphens_collapsed != 1) ||
+        (stats.choonpu != 1) || (stats.choonpu_collapsed != 2) ||
+        (stats.tildes_removed != 1) || (stats.spaces_removed != 4) ||
+        (stats.parenthesized != 1) || (stats.repeat_cut != 2) ||
+        (stats.invalid_sequences != 1) ||
+        (stream_stats.bytes_out != stats.bytes_out) ||
+        (stream_stats.spaces_removed != stats.spaces_removed) ||
+        (batch_stats.chars != stats.chars * 10)) {
+      std::cerr << "fail: NormalizationStats\n";
+    } else {
+      std::cout << "ok: NormalizationStats\n";
+    }
+  }
+
+  // Quick check of already normalized text.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    opt.repeat = 3;
+    const std::string inputs[] = {"", "abc", "ハンカク", "ﾊﾝｶｸ", "パ", "ﾊﾟ", "a b", "日本 語",
+                                  "abc ", "ｗｗｗ", "ｗｗｗｗ", "wwww", "ababab", "abababab",
+                                  "(株)", "㈱", "ー-~", "a\xff", "ー", "ーー"};
+    bool ok = true;
+    for (const std::string &input : inputs) {
+      bool unchanged = false;
+      std::string out = jpnormalizer::normalize(input, opt, unchanged);
+      bool expected = (jpnormalizer::normalize(input, opt) == input);
+      if ((jpnormalizer::is_normalized(input, opt) != expected) || (unchanged != expected) ||
+          (!unchanged && (out != jpnormalizer::normalize(input, opt)))) {
+        std::cerr << "fail: is_normalized(\"" << input << "\")\n";
+        ok = false;
+      }
+    }
+    if (jpnormalizer::is_normalized(u"ﾊﾝｶｸ") || !jpnormalizer::is_normalized(U"ハンカク")) {
+      std::cerr << "fail: is_normalized(UTF-16/UTF-32)\n";
+      ok = false;
+    }
+
+    // A repeat longer than the inline ring(32 codepoints).
+    opt.repeat = 1;
+    opt.max_repeat_substr_len = 40;
+    jpnormalizer::Normalizer normalizer(opt);
+    std::string unit = "abcdefghijklmnopqrstuvwxyz0123456789ABC";  // 39 chars
+    const std::string long_inputs[] = {unit, unit + unit + "!!!", unit + "x" + unit,
+                                       unit + "DE" + unit + "DE"};
+    for (const std::string &input : long_inputs) {
+      bool expected = (jpnormalizer::normalize(input, opt) == input);
+      if ((normalizer.is_normalized(input.data(), input.size()) != expected) ||
+          (jpnormalizer::is_normalized(input, opt) != expected)) {
+        std::cerr << "fail: is_normalized(max_repeat_substr_len 40, \"" << input << "\")\n";
+        ok = false;
+      }
+    }
+    if (normalizer.is_normalized((unit + unit + "!!!").data(), unit.size() * 2 + 3)) {
+      std::cerr << "fail: is_normalized(max_repeat_substr_len 40)\n";
+      ok = false;
+    }
+    if (ok) {
+      std::cout << "ok: is_normalized\n";
+    }
+  }
+
+  // In place. Expanding rules('㌖', '~' to '〜', U+FFFD) use the spill buffer.
+  {
+    const std::string inputs[] = {"ﾊﾝｶｸ ｶﾅ", "ＡＢＣ　ｄｅｆ", "㌖㌖a", "~~~", "a\xff\xfe\xff",
+                                  "ｶﾞ㍻", "ｗｗｗｗｗ", "abababab ", "  ", "日本 語 a b"};
+    jpnormalizer::NormalizationOption opts[3];
+    opts[1].tilde = jpnormalizer::NormalizationOption::TildeMode::Zenkaku;
+    opts[1].parenthesized_ideographs = true;
+    opts[1].invalid_char = jpnormalizer::NormalizationOption::InvalidCharMode::Replace;
+    opts[2].repeat = 2;
+    bool ok = true;
+    for (const jpnormalizer::NormalizationOption &o : opts) {
+      for (const std::string &input : inputs) {
+        std::string expected = jpnormalizer::normalize(input, o);
+        std::string str = input;
+        ok = ok && jpnormalizer::normalize_inplace(str, o) && (str == expected);
+
+        // char buffer: too small, then large enough.
+        char buf[64];
+        memcpy(buf, input.data(), input.size());
+        size_t len = input.size();
+        bool fits = jpnormalizer::normalize_inplace(buf, len, input.size(), o);
+        ok = ok && (fits == (expected.size() <= input.size())) && (len == expected.size());
+        memcpy(buf, input.data(), input.size());
+        len = input.size();
+        ok = ok && jpnormalizer::normalize_inplace(buf, len, sizeof(buf), o) &&
+             (std::string(buf, len) == expected);
+        if (!ok) {
+          std::cerr << "fail: normalize_inplace(\"" << input << "\")\n";
+          break;
+        }
+      }
+    }
+    if (ok) {
+      std::cout << "ok: normalize_inplace\n";
+    }
+  }
+
+  // Result cache.
+  {
+    jpnormalizer::NormalizationCacheOption cache_option;
+    cache_option.max_bytes = 64 * 1024;
+    cache_option.num_shards = 2;
+    jpnormalizer::NormalizationCache cache(cache_option);
+
+    opt = jpnormalizer::NormalizationOption();
+    jpnormalizer::NormalizationOption opt_repeat;
+    opt_repeat.repeat = 1;
+
+    bool ok = (cache.normalize("ﾊﾝｶｸ ｶﾅ", opt) == "ハンカクカナ") &&
+              (cache.normalize("ﾊﾝｶｸ ｶﾅ", opt) == "ハンカクカナ") &&
+              (cache.normalize("ｗｗｗｗｗ", opt) == "wwwww") &&
+              (cache.normalize("ｗｗｗｗｗ", opt_repeat) == "w") &&
+              (cache.hits() == 1) && (cache.misses() == 3) && (cache.size() == 3);
+
+    // Memory stays bounded.
+    for (int i = 0; i < 10000; i++) {
+      std::string query = "ｸｴﾘ" + std::to_string(i);
+      if (cache.normalize(query, opt) != jpnormalizer::normalize(query, opt)) {
+        ok = false;
+      }
+    }
+    ok = ok && (cache.bytes() <= cache_option.max_bytes) && (cache.size() < 10000);
+
+    // Long inputs bypass the cache.
+    std::string long_text(cache_option.max_input_len + 1, 'a');
+    uint64_t misses = cache.misses();
+    ok = ok && (cache.normalize(long_text, opt) == long_text) && (cache.misses() == misses);
+
+    if (ok) {
+      std::cout << "ok: NormalizationCache\n";
+    } else {
+      std::cerr << "fail: NormalizationCache\n";
+    }
+  }
+
+  // Column(buffer plus offsets).
+  {
+    opt = jpnormalizer::NormalizationOption();
+    const std::string rows[] = {"ﾊﾝｶｸ", "", "ＡＢＣ　ｄｅｆ", "㈱", " ", "ｶﾞ"};
+    const size_t n = sizeof(rows) / sizeof(rows[0]);
+    std::string data = "skipped";
+    std::vector<uint64_t> offsets(1, data.size());
+    for (const std::string &row : rows) {
+      data += row;
+      offsets.push_back(data.size());
+    }
+
+    bool ok = true;
+    for (size_t num_threads : {size_t(1), size_t(4)}) {
+      std::string out_data;
+      std::vector<uint64_t> out_offsets;
+      jpnormalizer::normalize_column(data.data(), offsets.data(), n, out_data,
+                                     out_offsets, opt, num_threads);
+      ok = ok && (out_offsets.size() == n + 1) && (out_offsets[0] == 0) &&
+           (out_offsets[n] == out_data.size());
+      for (size_t i = 0; ok && (i < n); i++) {
+        ok = out_data.compare(out_offsets[i], out_offsets[i + 1] - out_offsets[i],
+                              jpnormalizer::normalize(rows[i], opt)) == 0;
+      }
+    }
+    if (ok) {
+      std::cout << "ok: normalize_column\n";
+    } else {
+      std::cerr << "fail: normalize_column\n";
+    }
+  }
+
+  // Streaming. Feed byte by byte.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    opt.repeat = 2;
+    const std::string input = "ﾜｶﾞﾊｲは㈱である.  ㈴ＭＡＥはまだ迺ｗｗｗｗ ";
+    jpnormalizer::StreamNormalizer stream(opt);
+    std::string out;
+    for (size_t i = 0; i < input.size(); i++) {
+      stream.feed(&input[i], 1, out);
+    }
+    stream.finish(out);
+    CHECK_TEXT_OPT(input, out, opt);
+  }
+
+  // Batch.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    std::vector<std::string> docs;
+    for (size_t i = 0; i < 100; i++) {
+      docs.push_back(std::string(i, ' ') + "ﾊﾝｶｸｶﾅ" + std::to_string(i));
+    }
+    std::vector<std::string> rets = jpnormalizer::normalize_batch(docs, opt, 4);
+    for (size_t i = 0; i < docs.size(); i += 33) {
+      CHECK_TEXT_OPT(docs[i], rets[i], opt);
+    }
+  }
+
+  // Dedup.
+  {
+    std::string out = jpnormalizer::normalize_for_dedup("２０２３年１２月 ｗｗｗ");
+    if (out.compare("0000年00月www") != 0) {
+      std::cerr << "fail: expected \"0000年00月www\" but got \"" << out << "\"\n";
+    } else {
+      std::cout << "ok: \"" << out << "\"\n";
+    }
+
+    // Texts which differ only in digits have the same signature.
+    jpnormalizer::DedupSignature a = jpnormalizer::compute_dedup_signature("吾輩は猫である。2023年12月1日生まれ");
+    jpnormalizer::DedupSignature b = jpnormalizer::compute_dedup_signature("吾輩は猫である。1999年10月3日生まれ");
+    jpnormalizer::DedupSignature c = jpnormalizer::compute_dedup_signature("吾輩は犬である。名前はもうある。");
+    if ((jpnormalizer::estimate_jaccard(a, b) != 1.0) || (a.simhash != b.simhash) ||
+        (jpnormalizer::estimate_jaccard(a, c) >= 0.5)) {
+      std::cerr << "fail: compute_dedup_signature\n";
+    } else {
+      std::cout << "ok: compute_dedup_signature\n";
+    }
+  }
+
+  // Parallel normalization of a single large text.
+  {
+    opt = jpnormalizer::NormalizationOption();
+    opt.repeat = 3;
+    std::string doc;
+    for (size_t i = 0; doc.size() < 512 * 1024; i++) {
+      doc += "ﾊﾝｶｸ ｶﾅ abc ｗｗｗｗｗ(" + std::to_string(i % 100) + ")  ﾊﾟﾊﾟ\n";
+    }
+    std::string out = jpnormalizer::normalize_parallel(doc, opt, 4);
+    if (out.compare(jpnormalizer::normalize(doc, opt)) != 0) {
+      std::cerr << "fail: normalize_parallel differs from normalize\n";
+    } else {
+      std::cout << "ok: normalize_parallel(" << out.size() << " bytes)\n";
+    }
+  }
+
+  // JSON Lines scanner of jpnormalize-jsonl.
+  {
+    // Round trip of escape_json/unescape_json.
+    std::string raw = "a\"b\\c/d\b\f\n\r\t\x01\x1f\x7f ｶﾅ 𠮷";
+    std::string escaped;
+    std::string unescaped;
+    jsonl::escape_json(raw.data(), raw.size(), escaped);
+    if (!jsonl::unescape_json(escaped.data(), escaped.size(), unescaped) ||
+        (unescaped != raw) || (escaped.find('\n') != std::string::npos)) {
+      std::cerr << "fail: JSON escape round trip \"" << escaped << "\"\n";
+    } else {
+      std::cout << "ok: JSON escape round trip \"" << escaped << "\"\n";
+    }
+
+    // Escapes: {input, expected}. Invalid ones have no expected result.
+    const char *escapes[][2] = {
+        {"\\ud842\\udfb7", "𠮷"},                      // surrogate pair
+        {"\\uD842\\uDFB7", "𠮷"},
+        {"\\ud842x", "\xef\xbf\xbd" "x"},              // lone high surrogate
+        {"\\udfb7", "\xef\xbf\xbd"},                   // lone low surrogate
+        {"\\ud842\\u0041", "\xef\xbf\xbd" "A"},
+        {"\\ud842", "\xef\xbf\xbd"},
+        {"\\u00e9\\/\\\"", "é/\""},
+        {"\\x", nullptr},
+        {"\\u12", nullptr},
+        {"\\u12g4", nullptr},
+        {"abc\\", nullptr},
+    };
+    for (const auto &e : escapes) {
+      bool ret = jsonl::unescape_json(e[0], strlen(e[0]), unescaped);
+      if (e[1] ? (!ret || (unescaped != e[1])) : ret) {
+        std::cerr << "fail: unescape_json \"" << e[0] << "\"\n";
+      } else {
+        std::cout << "ok: unescape_json \"" << e[0] << "\"\n";
+      }
+    }
+
+    // Records: {input, expected output} with --field text.
+    const char *records[][2] = {
+        {"{\"id\":1,\"text\":\"ﾊﾝｶｸ\"}", "{\"id\":1,\"text\":\"ハンカク\"}"},
+        {" { \"text\" : \"ＡＢ\" , \"n\" : 1 } ", " { \"text\" : \"AB\" , \"n\" : 1 } "},
+        // escaped quotes and backslashes in the value
+        {"{\"text\":\"ａ\\\"ｂ\\\\ｃ\"}", "{\"text\":\"a\\\"b\\\\c\"}"},
+        {"{\"text\":\"\\uff21\\tＢ\\u3000\"}", "{\"text\":\"A\\tB\"}"},
+        {"{\"text\":\"\\ud842\\udfb7\\udfb7\"}", "{\"text\":\"𠮷\xef\xbf\xbd\"}"},
+        // escaped keys
+        {"{\"te\\u0078t\":\"ＡＢ\"}", "{\"te\\u0078t\":\"AB\"}"},
+        {"{\"a\\\"text\":\"ＡＢ\",\"text\\\\\":\"ＣＤ\"}", "{\"a\\\"text\":\"ＡＢ\",\"text\\\\\":\"ＣＤ\"}"},
+        // the name in nested objects, arrays and values
+        {"{\"meta\":{\"text\":\"ＡＢ\"},\"list\":[\"text\",{\"text\":\"ＣＤ\"}],\"text\":\"ＥＦ\"}",
+         "{\"meta\":{\"text\":\"ＡＢ\"},\"list\":[\"text\",{\"text\":\"ＣＤ\"}],\"text\":\"EF\"}"},
+        {"{\"meta\":{\"text\":\"ＡＢ\"}}", "{\"meta\":{\"text\":\"ＡＢ\"}}"},
+        {"{\"title\":\"text\",\"x\":\"ＡＢ\"}", "{\"title\":\"text\",\"x\":\"ＡＢ\"}"},
+        // duplicate keys: the last one
+        {"{\"text\":\"ＡＢ\",\"text\":\"ＣＤ\"}", "{\"text\":\"ＡＢ\",\"text\":\"CD\"}"},
+        {"{\"text\":\"ＡＢ\",\"text\":1}", "{\"text\":\"ＡＢ\",\"text\":1}"},
+        {"{\"text\":1,\"text\":\"ＣＤ\"}", "{\"text\":1,\"text\":\"CD\"}"},
+        // not a string
+        {"{\"text\":123}", "{\"text\":123}"},
+        {"{\"text\":null,\"x\":\"ＡＢ\"}", "{\"text\":null,\"x\":\"ＡＢ\"}"},
+        {"{\"text\":[\"ＡＢ\"]}", "{\"text\":[\"ＡＢ\"]}"},
+        {"{\"text\":{\"text\":\"ＡＢ\"}}", "{\"text\":{\"text\":\"ＡＢ\"}}"},
+        // not an object, or malformed
+        {"[\"text\",\"ＡＢ\"]", "[\"text\",\"ＡＢ\"]"},
+        {"\"ＡＢ\"", "\"ＡＢ\""},
+        {"{}", "{}"},
+        {"{\"text\":\"ＡＢ\"", "{\"text\":\"ＡＢ\""},
+        {"{\"text\":\"ＡＢ", "{\"text\":\"ＡＢ"},
+        {"{\"text\":\"ＡＢ\\\"}", "{\"text\":\"ＡＢ\\\"}"},
+        {"{\"text\":\"ＡＢ\\x\"}", "{\"text\":\"ＡＢ\\x\"}"},
+        {"{\"text\" \"ＡＢ\"}", "{\"text\" \"ＡＢ\"}"},
+        {"{\"text\":\"ＡＢ\" \"x\":1}", "{\"text\":\"ＡＢ\" \"x\":1}"},
+    };
+    std::string field = "text";
+    jsonl::RecordRewriter rewriter(jpnormalizer::NormalizationOption(), field);
+    for (const auto &r : records) {
+      std::string out;
+      rewriter.rewrite(r[0], strlen(r[0]), out);
+      if (out != r[1]) {
+        std::cerr << "fail: expected " << r[1] << " but got " << out << "\n";
+      } else {
+        std::cout << "ok: " << out << "\n";
+      }
+    }
+
+    // CRLF, empty lines and the last line without '\n'.
+    const std::string lines = "{\"text\":\"ＡＢ\"}\r\n\n{\"x\":1}\n{\"text\":\"ＣＤ\"}";
+    std::string out;
+    jsonl::RecordRewriter counted(jpnormalizer::NormalizationOption(), field);
+    counted.rewrite(lines.data(), lines.size(), out);
+    if ((out != "{\"text\":\"AB\"}\r\n\n{\"x\":1}\n{\"text\":\"CD\"}") ||
+        (counted.counters().records != 3) || (counted.counters().normalized != 2)) {
+      std::cerr << "fail: JSON Lines \"" << out << "\"\n";
+    } else {
+      std::cout << "ok: JSON Lines\n";
+    }
+  }
 }
 
 int main(int argc, char **argv) {
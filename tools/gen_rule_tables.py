@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""Generate the rule tables(`kRules`, `kKanaTen`, `kKanaMaru`) of jp_normalizer.hh.
+
+Inputs:
+
+  data/neologdn_rules.txt         neologdn rules
+  data/UnicodeData-subset.txt     compatibility decompositions of the enclosed
+                                  and squared CJK forms(UnicodeData.txt format)
+
+The neologdn rules are resolved to one kind per char(space, hyphen, choonpu,
+tilde, then replace). Chars of `COMPAT_BLOCKS` without a neologdn rule get
+their full compatibility decomposition(e.g. '㍻' -> '平成', '①' -> '1') as a
+`RuleKind::Parenthesized` rule, so they follow the `parenthesized_ideographs`
+option.
+
+Usage:
+
+  $ python3 tools/gen_rule_tables.py          # rewrite jp_normalizer.hh
+  $ python3 tools/gen_rule_tables.py --check  # fail when it is out of date
+"""
+
+import argparse
+import os
+import sys
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_HEADER = os.path.join(TOOLS_DIR, '..', 'jp_normalizer.hh')
+NEOLOGDN_RULES = os.path.join(TOOLS_DIR, 'data', 'neologdn_rules.txt')
+UNICODE_DATA = os.path.join(TOOLS_DIR, 'data', 'UnicodeData-subset.txt')
+
+BEGIN_MARKER = '// BEGIN GENERATED RULES'
+END_MARKER = '// END GENERATED RULES'
+
+# Blocks whose compatibility decompositions become rules.
+COMPAT_BLOCKS = [
+    (0x2460, 0x24FF),  # Enclosed Alphanumerics
+    (0x3200, 0x32FF),  # Enclosed CJK Letters and Months
+    (0x3300, 0x33FF),  # CJK Compatibility
+]
+
+# Hangul compatibility forms decompose into conjoining jamo, which need
+# canonical composition(not done here) to become syllables.
+EXCLUDED_RANGES = [
+    (0x1100, 0x11FF),  # Hangul Jamo
+]
+
+# Precedence of the neologdn kinds(the order of `if` branches in `normalize()`).
+NEOLOGDN_KINDS = ['space', 'hyphen', 'choonpu', 'tilde', 'replace']
+
+CPP_KINDS = {
+    'space': 'RuleKind::Space',
+    'hyphen': 'RuleKind::Hyphen',
+    'choonpu': 'RuleKind::Choonpu',
+    'tilde': 'RuleKind::Tilde',
+    'replace': 'RuleKind::Replace',
+    'compat': 'RuleKind::Parenthesized',
+}
+
+# Max UTF-8 bytes of a replacement(`RuleEntry::len`).
+MAX_REPLACEMENT_BYTES = 255
+
+
+def parse_codes(field):
+    return [int(c, 16) for c in field.split()]
+
+
+def read_lines(path):
+    with open(path, encoding='utf-8') as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].strip()
+            if line:
+                yield lineno, line
+
+
+def load_neologdn_rules(path):
+    """Returns ({code: (kind, repl)}, {code: ten}, {code: maru})."""
+    rules = {}
+    ten = {}
+    maru = {}
+    for lineno, line in read_lines(path):
+        fields = [f.strip() for f in line.split(';')]
+        if len(fields) != 3:
+            sys.exit('{}:{}: expected 3 fields'.format(path, lineno))
+        (code,), kind, repl = parse_codes(fields[0]), fields[1], parse_codes(fields[2])
+        if kind in ('kana_ten', 'kana_maru'):
+            if len(repl) != 1:
+                sys.exit('{}:{}: kana must map to one char'.format(path, lineno))
+            (ten if kind == 'kana_ten' else maru)[code] = repl[0]
+            continue
+        if kind not in NEOLOGDN_KINDS:
+            sys.exit('{}:{}: unknown kind `{}`'.format(path, lineno, kind))
+        if (kind == 'replace') != bool(repl):
+            sys.exit('{}:{}: only `replace` has a replacement'.format(path, lineno))
+
+        if code in rules:
+            if NEOLOGDN_KINDS.index(kind) >= NEOLOGDN_KINDS.index(rules[code][0]):
+                continue
+        rules[code] = (kind, repl)
+    return rules, ten, maru
+
+
+def load_decompositions(path):
+    """Returns {code: [codes]} of the compatibility decompositions.
+
+    Canonical decompositions are not followed, so precomposed chars(e.g. 'パ')
+    stay composed and the result equals NFKC without a composition step.
+    """
+    decomps = {}
+    for lineno, line in read_lines(path):
+        fields = line.split(';')
+        if len(fields) != 15:
+            sys.exit('{}:{}: expected 15 fields'.format(path, lineno))
+        decomp = fields[5].split()
+        if decomp and decomp[0].startswith('<'):
+            decomps[int(fields[0], 16)] = [int(c, 16) for c in decomp[1:]]
+    return decomps
+
+
+def full_decomposition(code, decomps):
+    if code not in decomps:
+        return [code]
+    result = []
+    for c in decomps[code]:
+        result.extend(full_decomposition(c, decomps))
+    return result
+
+
+def in_ranges(code, ranges):
+    return any(begin <= code <= end for begin, end in ranges)
+
+
+def build_rules(neologdn, decomps):
+    """Returns {code: (kind, replacement str)}."""
+    rules = {code: (kind, ''.join(chr(c) for c in repl))
+             for code, (kind, repl) in neologdn.items()}
+
+    for code in sorted(decomps):
+        if not in_ranges(code, COMPAT_BLOCKS) or code in rules:
+            continue
+        repl = full_decomposition(code, decomps)
+        if any(in_ranges(c, EXCLUDED_RANGES) for c in repl):
+            continue
+
+        # The result is normalized text, so apply the neologdn replacements.
+        text = ''
+        for c in repl:
+            if c not in neologdn:
+                text += chr(c)
+                continue
+            kind, r = neologdn[c]
+            if kind == 'hyphen':
+                text += '-'
+            elif kind == 'choonpu':
+                text += '\u30fc'  # 'ー'
+            elif kind == 'replace':
+                text += ''.join(chr(x) for x in r)
+            else:
+                sys.exit('U+{:04X}: decomposition has a `{}` char'.format(code, kind))
+        rules[code] = ('compat', text)
+
+    for code, (kind, text) in rules.items():
+        if code > 0xFFFF:
+            sys.exit('U+{:04X}: only BMP chars are supported'.format(code))
+        if len(text.encode('utf-8')) > MAX_REPLACEMENT_BYTES:
+            sys.exit('U+{:04X}: replacement is too long'.format(code))
+    return rules
+
+
+def cpp_literal(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def display_width(s):
+    # Rough: CJK chars take two columns.
+    return sum(2 if ord(c) >= 0x1100 else 1 for c in s)
+
+
+def pack(items, indent='    ', width=80):
+    lines = []
+    line = ''
+    for item in items:
+        if line and display_width(indent + line + ' ' + item) > width:
+            lines.append(indent + line)
+            line = ''
+        line = (line + ' ' + item) if line else item
+    if line:
+        lines.append(indent + line)
+    return '\n'.join(lines)
+
+
+def generate(rules, ten, maru):
+    rule_items = ['{{{}, {}, {}}},'.format(cpp_literal(chr(code)), CPP_KINDS[kind],
+                                            cpp_literal(text))
+                  for code, (kind, text) in sorted(rules.items())]
+
+    def kana_items(pairs):
+        return ['{{{}, {}}},'.format(cpp_literal(chr(k)), cpp_literal(chr(v)))
+                for k, v in sorted(pairs.items())]
+
+    return '\n'.join([
+        BEGIN_MARKER + '(tools/gen_rule_tables.py). Do not edit by hand.',
+        '',
+        '///',
+        '/// All rules, sorted by the codepoint of `from`(checked at compile time).',
+        '///',
+        'static constexpr RuleSource kRules[] = {',
+        pack(rule_items),
+        '};',
+        '',
+        '// Voiced(dakuten) forms of kana.',
+        'static constexpr KanaPair kKanaTen[] = {',
+        pack(kana_items(ten)),
+        '};',
+        '',
+        '// Semi-voiced(handakuten) forms of kana.',
+        'static constexpr KanaPair kKanaMaru[] = {',
+        pack(kana_items(maru)),
+        '};',
+        '',
+        END_MARKER,
+    ])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('header', nargs='?', default=DEFAULT_HEADER)
+    parser.add_argument('--check', action='store_true',
+                        help='exit with 1 when the header is out of date')
+    args = parser.parse_args()
+
+    neologdn, ten, maru = load_neologdn_rules(NEOLOGDN_RULES)
+    rules = build_rules(neologdn, load_decompositions(UNICODE_DATA))
+    generated = generate(rules, ten, maru)
+
+    with open(args.header, encoding='utf-8') as f:
+        src = f.read()
+    begin = src.find(BEGIN_MARKER)
+    end = src.find(END_MARKER)
+    if (begin < 0) or (end < begin):
+        sys.exit('{}: generated rules markers not found'.format(args.header))
+    end += len(END_MARKER)
+    updated = src[:begin] + generated + src[end:]
+
+    if args.check:
+        if updated != src:
+            sys.exit('{} is out of date. Run tools/gen_rule_tables.py'.format(args.header))
+        return
+    if updated != src:
+        with open(args.header, 'w', encoding='utf-8') as f:
+            f.write(updated)
+    print('{} rules, {} voiced and {} semi-voiced kana'.format(len(rules), len(ten),
+                                                               len(maru)))
+
+
+if __name__ == '__main__':
+    main()